@@ -0,0 +1,569 @@
+/*
+ * Copyright (c) 2005 Topspin Communications.  All rights reserved.
+ * Copyright (c) 2005 Mellanox Technologies Ltd.  All rights reserved.
+ * Copyright (c) 2009 HNR Consulting.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * $Id$
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perftest_parameters.h"
+#include "perftest_resources.h"
+#include "perftest_communication.h"
+
+/* Staged chunks are double buffered, a neighbour is at most one iteration ahead. */
+#define RING_STAGE_BANKS	(2)
+
+typedef float vfloat __attribute__ ((vector_size (32)));
+
+struct ring_state {
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	struct pingpong_dest		*rem_dest;
+	float				*data;
+	char				*stage;
+	uint64_t			region;
+	uint64_t			slot;
+	int				ranks;
+	int				rank;
+	int				steps;
+	int				count;
+	int				outstanding;
+	uint64_t			iter;
+	uint64_t			recvs_done;
+	uint64_t			recvs_used;
+	struct ibv_recv_wr		*rwr;
+	struct ibv_sge			*rsge;
+	cycles_t			step_sum;
+	cycles_t			step_max;
+	uint64_t			step_cnt;
+};
+
+/******************************************************************************
+ * Sums src into dst, eight floats at a time so the compiler emits SIMD adds.
+ ******************************************************************************/
+static void reduce_sum(float *dst, const float *src, int n)
+{
+	vfloat a,b;
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a += b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+
+	for (; i < n; i++)
+		dst[i] += src[i];
+}
+
+/******************************************************************************
+ * Chunk c of the vector, the remainder is spread over the first chunks.
+ ******************************************************************************/
+static inline int chunk_off(struct ring_state *ring, int c)
+{
+	int base = ring->count / ring->ranks;
+	int rem = ring->count % ring->ranks;
+
+	return c * base + (c < rem ? c : rem);
+}
+
+static inline int chunk_len(struct ring_state *ring, int c)
+{
+	return ring->count / ring->ranks + (c < ring->count % ring->ranks);
+}
+
+static inline uint64_t stage_off(struct ring_state *ring, uint64_t iter, int c)
+{
+	return ((iter % RING_STAGE_BANKS) * ring->ranks + c) * ring->slot;
+}
+
+/******************************************************************************
+ * The chunk that arrives from the left neighbour at step j of an iteration.
+ ******************************************************************************/
+static inline int recv_chunk(struct ring_state *ring, int j)
+{
+	int s = (j < ring->ranks - 1) ? j + 1 : j - (ring->ranks - 1);
+
+	return (ring->rank - s + ring->ranks) % ring->ranks;
+}
+
+/******************************************************************************
+ * Posts the receives of two iterations. Each one is reposted as it completes,
+ * so the receive queue keeps the same pattern of staging slots.
+ ******************************************************************************/
+static int ring_post_recvs(struct ring_state *ring)
+{
+	struct ibv_recv_wr	*bad_wr;
+	int			k,depth = RING_STAGE_BANKS * ring->steps;
+
+	ALLOCATE(ring->rwr, struct ibv_recv_wr, depth);
+	ALLOCATE(ring->rsge, struct ibv_sge, depth);
+	memset(ring->rwr, 0, depth * sizeof(struct ibv_recv_wr));
+
+	for (k = 0; k < depth; k++) {
+		ring->rsge[k].addr = (uintptr_t)ring->stage + stage_off(ring, k / ring->steps, recv_chunk(ring, k % ring->steps));
+		ring->rsge[k].length = ring->slot;
+		ring->rsge[k].lkey = ring->ctx->mr[0]->lkey;
+
+		ring->rwr[k].wr_id = k;
+		ring->rwr[k].sg_list = &ring->rsge[k];
+		/* With WRITE with immediate the data is already in place. */
+		ring->rwr[k].num_sge = ring->user_param->ring_send ? 1 : 0;
+
+		if (ibv_post_recv(ring->ctx->qp[1], &ring->rwr[k], &bad_wr)) {
+			fprintf(stderr, "Couldn't post recv: rank %d\n", ring->rank);
+			return FAILURE;
+		}
+	}
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ring_poll(struct ring_state *ring)
+{
+	struct ibv_wc		wc[CTX_POLL_BATCH];
+	struct ibv_recv_wr	*bad_wr;
+	int			ne,i;
+
+	ne = ibv_poll_cq(ring->ctx->send_cq, CTX_POLL_BATCH, wc);
+	if (ne < 0) {
+		fprintf(stderr, "poll CQ failed %d\n", ne);
+		return FAILURE;
+	}
+
+	for (i = 0; i < ne; i++) {
+		if (wc[i].status != IBV_WC_SUCCESS) {
+			fprintf(stderr, " Completion with error at rank %d\n", ring->rank);
+			fprintf(stderr, " Failed status %d: wr_id %d syndrom 0x%x\n", wc[i].status, (int)wc[i].wr_id, wc[i].vendor_err);
+			return FAILURE;
+		}
+
+		if (wc[i].opcode & IBV_WC_RECV) {
+			ring->recvs_done++;
+			if (ibv_post_recv(ring->ctx->qp[1], &ring->rwr[wc[i].wr_id], &bad_wr)) {
+				fprintf(stderr, "Couldn't post recv: rank %d\n", ring->rank);
+				return FAILURE;
+			}
+		} else {
+			ring->outstanding--;
+		}
+	}
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Sends chunk c to the right neighbour, into its staging slot or its vector.
+ ******************************************************************************/
+static int ring_send_chunk(struct ring_state *ring, int c, int to_stage)
+{
+	struct perftest_parameters	*user_param = ring->user_param;
+	struct ibv_send_wr		wr,*bad_wr;
+	struct ibv_sge			sge;
+
+	while (ring->outstanding >= user_param->tx_depth) {
+		if (ring_poll(ring))
+			return FAILURE;
+	}
+
+	sge.addr = (uintptr_t)(ring->data + chunk_off(ring, c));
+	sge.length = chunk_len(ring, c) * sizeof(float);
+	sge.lkey = ring->ctx->mr[0]->lkey;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	if (sge.length <= user_param->inline_size)
+		wr.send_flags |= IBV_SEND_INLINE;
+
+	if (user_param->ring_send) {
+		wr.opcode = IBV_WR_SEND;
+	} else {
+		wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+		wr.imm_data = htonl(c);
+		wr.wr.rdma.rkey = ring->rem_dest->rkey;
+		wr.wr.rdma.remote_addr = ring->rem_dest->vaddr + (to_stage ?
+				ring->region + stage_off(ring, ring->iter, c) : chunk_off(ring, c) * sizeof(float));
+	}
+
+	if (ibv_post_send(ring->ctx->qp[0], &wr, &bad_wr)) {
+		fprintf(stderr, "Couldn't post send: rank %d\n", ring->rank);
+		return FAILURE;
+	}
+	ring->outstanding++;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ring_wait_chunk(struct ring_state *ring)
+{
+	while (ring->recvs_done == ring->recvs_used) {
+		if (ring_poll(ring))
+			return FAILURE;
+	}
+	ring->recvs_used++;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static inline void ring_step_done(struct ring_state *ring, cycles_t start)
+{
+	cycles_t t = get_cycles() - start;
+
+	ring->step_sum += t;
+	if (t > ring->step_max)
+		ring->step_max = t;
+	ring->step_cnt++;
+}
+
+/******************************************************************************
+ * One all-reduce: N-1 reduce-scatter steps, then N-1 all-gather steps.
+ ******************************************************************************/
+static int ring_allreduce(struct ring_state *ring)
+{
+	int		n = ring->ranks,r = ring->rank;
+	int		s,c;
+	cycles_t	start;
+
+	for (s = 0; s < n - 1; s++) {
+		start = get_cycles();
+		if (ring_send_chunk(ring, (r - s + n) % n, 1) || ring_wait_chunk(ring))
+			return FAILURE;
+
+		c = (r - s - 1 + n) % n;
+		reduce_sum(ring->data + chunk_off(ring, c),
+				(float*)(ring->stage + stage_off(ring, ring->iter, c)), chunk_len(ring, c));
+		ring_step_done(ring, start);
+	}
+
+	for (s = 0; s < n - 1; s++) {
+		start = get_cycles();
+		if (ring_send_chunk(ring, (r + 1 - s + n) % n, 0) || ring_wait_chunk(ring))
+			return FAILURE;
+
+		/* A SEND lands in the staging slot, WRITE with immediate already wrote the vector. */
+		if (ring->user_param->ring_send) {
+			c = (r - s + n) % n;
+			memcpy(ring->data + chunk_off(ring, c), ring->stage + stage_off(ring, ring->iter, c),
+					chunk_len(ring, c) * sizeof(float));
+		}
+		ring_step_done(ring, start);
+	}
+
+	ring->iter++;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ring_drain(struct ring_state *ring)
+{
+	while (ring->outstanding) {
+		if (ring_poll(ring))
+			return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Checks one all-reduce of rank + 1 on every rank, then times the iterations.
+ ******************************************************************************/
+static int run_iter_allreduce(struct ring_state *ring, struct perftest_comm *left,
+		struct perftest_comm *right, uint64_t size)
+{
+	struct perftest_parameters	*user_param = ring->user_param;
+	double				cycles_to_units,t_avg,algbw;
+	float				expected = ring->ranks * (ring->ranks + 1) / 2.0;
+	long				format_factor = (user_param->report_fmt == MBS) ? 0x100000 : 125000000;
+	cycles_t			start;
+	int				i;
+
+	ring->count = size / sizeof(float);
+
+	for (i = 0; i < ring->count; i++)
+		ring->data[i] = ring->rank + 1;
+
+	if (ctx_ring_barrier(left, right, ring->rank) || ring_allreduce(ring) || ring_drain(ring))
+		return FAILURE;
+
+	for (i = 0; i < ring->count; i++) {
+		if (ring->data[i] != expected) {
+			fprintf(stderr, " Wrong result at rank %d, float %d: %f instead of %f\n", ring->rank, i, ring->data[i], expected);
+			return FAILURE;
+		}
+	}
+
+	/* Zeros keep the timed sums away from overflows and denormals. */
+	memset(ring->data, 0, size);
+	ring->step_sum = 0;
+	ring->step_max = 0;
+	ring->step_cnt = 0;
+
+	if (ctx_ring_barrier(left, right, ring->rank))
+		return FAILURE;
+
+	start = get_cycles();
+	for (i = 0; i < user_param->iters; i++) {
+		if (ring_allreduce(ring))
+			return FAILURE;
+	}
+	t_avg = (double)(get_cycles() - start) / user_param->iters;
+
+	if (ring_drain(ring))
+		return FAILURE;
+
+	cycles_to_units = get_cpu_mhz(user_param->cpu_freq_f);
+	if (cycles_to_units == 0) {
+		fprintf(stderr, "Can't produce a report\n");
+		return FAILURE;
+	}
+
+	t_avg /= cycles_to_units;
+	algbw = size / t_avg * 1000000 / format_factor;
+
+	printf(REPORT_FMT_ALLREDUCE, (unsigned long)size, user_param->iters, t_avg, algbw,
+		algbw * 2 * (ring->ranks - 1) / ring->ranks,
+		ring->step_sum / (double)ring->step_cnt / cycles_to_units, ring->step_max / cycles_to_units);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+	int				ret_parser,i;
+	struct ibv_device		*ib_dev = NULL;
+	struct pingpong_context		ctx;
+	struct pingpong_dest		my_dest[2],rem_dest[2];
+	struct perftest_parameters	user_param;
+	struct perftest_comm		left_comm,right_comm;
+	struct ring_state		ring;
+	uint64_t			max_chunk;
+
+	/* init default values to user's parameters */
+	memset(&ctx,0,sizeof(struct pingpong_context));
+	memset(&user_param,0,sizeof(struct perftest_parameters));
+	memset(&left_comm,0,sizeof(struct perftest_comm));
+	memset(&right_comm,0,sizeof(struct perftest_comm));
+	memset(my_dest,0,sizeof(my_dest));
+	memset(rem_dest,0,sizeof(rem_dest));
+	memset(&ring,0,sizeof(ring));
+
+	user_param.verb    = WRITE;
+	user_param.tst     = BW;
+	user_param.is_collective = ON;
+	strncpy(user_param.version, VERSION, sizeof(user_param.version));
+
+	/* Configure the parameters values according to user arguments or default values. */
+	ret_parser = parser(&user_param,argv,argc);
+	if (ret_parser) {
+		if (ret_parser != VERSION_EXIT && ret_parser != HELP_EXIT)
+			fprintf(stderr," Parser function exited with Error\n");
+		return 1;
+	}
+
+	/* QP 0 writes to the right neighbour, QP 1 is written by the left one. */
+	user_param.num_of_qps = 2;
+	/* Neighbours may be other ranks of this very binary, there is no version to match. */
+	user_param.dont_xchg_versions = 1;
+	if (user_param.tx_depth < 4 * user_param.ring_size)
+		user_param.tx_depth = 4 * user_param.ring_size;
+	if (user_param.rx_depth < 4 * user_param.ring_size)
+		user_param.rx_depth = 4 * user_param.ring_size;
+
+	/* Finding the IB device selected (or default if none is selected). */
+	ib_dev = ctx_find_dev(user_param.ib_devname);
+	if (!ib_dev) {
+		fprintf(stderr," Unable to find the Infiniband/RoCE device\n");
+		return 1;
+	}
+
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
+	/* Getting the relevant context from the device */
+	ctx.context = ibv_open_device(ib_dev);
+	if (!ctx.context) {
+		fprintf(stderr, " Couldn't get context for the device\n");
+		return 1;
+	}
+
+	/* See if MTU and link type are valid and supported. */
+	if (check_link(ctx.context,&user_param)) {
+		fprintf(stderr, " Couldn't get context for the device\n");
+		return FAILURE;
+	}
+
+	if (user_param.output == FULL_VERBOSITY) {
+		printf("\n************************************\n");
+		printf("* Waiting for the ring to connect. *\n");
+		printf("************************************\n");
+	}
+
+	/* Connect to both neighbours over the out of band channel. */
+	if (establish_ring_connection(&left_comm,&right_comm,&user_param)) {
+		fprintf(stderr," Unable to connect the ring\n");
+		return FAILURE;
+	}
+
+	if (check_mtu(ctx.context,&user_param,&right_comm)) {
+		fprintf(stderr, " Couldn't get context for the device\n");
+		return FAILURE;
+	}
+
+	/* Print basic test information. */
+	ctx_print_test_info(&user_param);
+
+	/* Allocating arrays needed for the test. */
+	alloc_ctx(&ctx,&user_param);
+
+	/* create all the basic IB resources (data buffer, PD, MR, CQ and events channel) */
+	if (ctx_init(&ctx, &user_param)) {
+		fprintf(stderr, " Couldn't create IB resources\n");
+		return FAILURE;
+	}
+
+	/* Set up the Connection. */
+	if (set_up_connection(&ctx,&user_param,my_dest)) {
+		fprintf(stderr," Unable to set up socket connection\n");
+		return FAILURE;
+	}
+
+	/* The vector lives in the first QP region and the staging slots after it. */
+	my_dest[0].vaddr = my_dest[1].vaddr = (uintptr_t)ctx.buf[0];
+
+	for (i=0; i < user_param.num_of_qps; i++)
+		ctx_print_pingpong_data(&my_dest[i],&right_comm);
+
+	if (ctx_ring_hand_shake(&left_comm,&right_comm,user_param.ring_rank,my_dest,rem_dest)) {
+		fprintf(stderr," Failed to exchange data between the ring neighbours\n");
+		return 1;
+	}
+
+	right_comm.rdma_params->side = REMOTE;
+	for (i=0; i < user_param.num_of_qps; i++)
+		ctx_print_pingpong_data(&rem_dest[i],&right_comm);
+
+	if (ctx_check_gid_compatibility(&my_dest[0], &rem_dest[0])) {
+		fprintf(stderr,"\n Found Incompatibility issue with GID types.\n");
+		fprintf(stderr," Please Try to use a different IP version.\n\n");
+		return 1;
+	}
+
+	if (ctx_connect(&ctx,rem_dest,&user_param,my_dest)) {
+		fprintf(stderr," Unable to Connect the HCA's through the link\n");
+		return FAILURE;
+	}
+
+	ring.ctx = &ctx;
+	ring.user_param = &user_param;
+	ring.rem_dest = &rem_dest[0];
+	ring.ranks = user_param.ring_size;
+	ring.rank = user_param.ring_rank;
+	ring.steps = 2 * (ring.ranks - 1);
+	ring.data = (float*)ctx.buf[0];
+	ring.region = (char*)ctx.buf[1] - (char*)ctx.buf[0];
+	ring.stage = (char*)ctx.buf[1];
+	ring.slot = ((ctx.buff_size - ring.region) / (RING_STAGE_BANKS * ring.ranks)) & ~(uint64_t)(sizeof(float) - 1);
+
+	max_chunk = (user_param.size / sizeof(float) + ring.ranks - 1) / ring.ranks * sizeof(float);
+	if (ring.slot < max_chunk) {
+		fprintf(stderr," Staging slots of %lu bytes can't hold chunks of %lu bytes\n", ring.slot, max_chunk);
+		return FAILURE;
+	}
+
+	if (ring_post_recvs(&ring)) {
+		fprintf(stderr," Couldn't post the ring receives\n");
+		return FAILURE;
+	}
+
+	/* Every rank posted its receives before anyone sends. */
+	if (ctx_ring_barrier(&left_comm,&right_comm,user_param.ring_rank)) {
+		fprintf(stderr," Failed to synchronize the ring\n");
+		return FAILURE;
+	}
+
+	if (user_param.output == FULL_VERBOSITY) {
+		printf(RESULT_LINE);
+		printf((user_param.report_fmt == MBS ? RESULT_FMT_ALLREDUCE : RESULT_FMT_G_ALLREDUCE));
+	}
+
+	if (user_param.test_method == RUN_ALL) {
+
+		for (i = 1; i < 24 ; ++i) {
+
+			if (((uint64_t)1 << i) < sizeof(float) * ring.ranks)
+				continue;
+
+			if (run_iter_allreduce(&ring,&left_comm,&right_comm,(uint64_t)1 << i)) {
+				fprintf(stderr," Failed to complete run_iter_allreduce function successfully\n");
+				return 1;
+			}
+		}
+
+	} else {
+
+		if (run_iter_allreduce(&ring,&left_comm,&right_comm,user_param.size)) {
+			fprintf(stderr," Failed to complete run_iter_allreduce function successfully\n");
+			return 1;
+		}
+	}
+
+	if (user_param.output == FULL_VERBOSITY)
+		printf(RESULT_LINE);
+
+	/* Closing connection. */
+	if (ctx_ring_close_connection(&left_comm,&right_comm,user_param.ring_rank,my_dest,rem_dest)) {
+		fprintf(stderr,"Failed to close connection between the ring neighbours\n");
+		return 1;
+	}
+
+	free(ring.rwr);
+	free(ring.rsge);
+
+	return destroy_ctx(&ctx,&user_param);
+}
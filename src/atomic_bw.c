@@ -72,6 +72,17 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* Run one test per device and aggregate their reports. */
+	if (user_param.num_devices > 1)
+		return run_multi_device(&user_param,argc,argv);
+
+	/* Accept every incast client up front and serve each one from its own process. */
+	if (user_param.incast > 1) {
+		ret_parser = run_incast_server(&user_param);
+		if (ret_parser != INCAST_CHILD)
+			return ret_parser;
+	}
+
 	if (user_param.use_xrc && user_param.duplex) {
 		user_param.num_of_qps *= 2;
 	}
@@ -80,6 +91,12 @@ int main(int argc, char *argv[])
 	if (!ib_dev)
 		return 7;
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -88,7 +105,8 @@ int main(int argc, char *argv[])
 	}
 
 	#ifdef HAVE_MASKED_ATOMICS
-	if (check_masked_atomics_support(&ctx)) {
+	/* The contention levels post regular atomics with their own compare values. */
+	if (!user_param.contention_levels && check_masked_atomics_support(&ctx)) {
 		user_param.masked_atomics = 1;
 		user_param.use_exp = 1;
 	}
@@ -209,6 +227,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Hold this incast client until all of them are connected. */
+	if (ctx_incast_barrier(&user_param)) {
+		fprintf(stderr," Failed to synchronize the incast clients\n");
+		return FAILURE;
+	}
+
 	/* An additional handshake is required after moving qp to RTR. */
 	if (ctx_hand_shake(&user_comm, &my_dest[0], &rem_dest[0])) {
 		fprintf(stderr, "Failed to exchange data between server and clients\n");
@@ -220,6 +244,8 @@ int main(int argc, char *argv[])
 		if (user_param.output == FULL_VERBOSITY) {
 			printf(RESULT_LINE);
 			printf((user_param.report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+			if (user_param.working_set)
+				printf(RESULT_EXT_WS);
 			printf((user_param.cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
 		}
 
@@ -240,6 +266,11 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
+		if (results_finish(&user_param)) {
+			fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+			return 1;
+		}
+
 		return destroy_ctx(&ctx, &user_param);
 	}
 
@@ -249,15 +280,26 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 	}
-	if (user_param.output == FULL_VERBOSITY) {
+	if (user_param.output == FULL_VERBOSITY && !user_param.contention_levels) {
 		printf(RESULT_LINE);
 		printf((user_param.report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+		if (user_param.working_set)
+			printf(RESULT_EXT_WS);
+		if (user_param.warmup_tol > 0 && (user_param.machine == CLIENT || user_param.duplex))
+			printf(RESULT_EXT_WARMUP);
 		printf((user_param.cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
 	}
 
 	ctx_set_send_wqes(&ctx, &user_param, rem_dest);
 
-	if (user_param.test_method == RUN_REGULAR || user_param.test_method == RUN_ALL) {
+	if (user_param.test_method == RUN_REGULAR && user_param.contention_levels) {
+
+		if (run_atomic_contention_bw(&ctx, &user_param, rem_dest, &my_bw_rep)) {
+			fprintf(stderr, " Failed to complete the contention levels\n");
+			return 1;
+		}
+
+	} else if (user_param.test_method == RUN_REGULAR || user_param.test_method == RUN_ALL) {
 
 		if (perform_warm_up(&ctx, &user_param)) {
 			fprintf(stderr, "Problems with warm up\n");
@@ -335,5 +377,10 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	return destroy_ctx(&ctx, &user_param);
 }
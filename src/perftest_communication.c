@@ -437,7 +437,7 @@ static int rdma_read_keys(struct pingpong_dest *rem_dest,
 /******************************************************************************
  *
  ******************************************************************************/
-static int ethernet_client_connect(struct perftest_comm *comm)
+static int ethernet_client_socket(struct perftest_comm *comm)
 {
 	struct addrinfo *res, *t;
 	struct addrinfo hints;
@@ -450,7 +450,7 @@ static int ethernet_client_connect(struct perftest_comm *comm)
 
 	if (check_add_port(&service,comm->rdma_params->port,comm->rdma_params->servername,&hints,&res)) {
 		fprintf(stderr, "Problem in resolving basic address and port\n");
-		return 1;
+		return -1;
 	}
 
 	for (t = res; t; t = t->ai_next) {
@@ -465,6 +465,15 @@ static int ethernet_client_connect(struct perftest_comm *comm)
 	}
 
 	freeaddrinfo(res);
+	return sockfd;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ethernet_client_connect(struct perftest_comm *comm)
+{
+	int sockfd = ethernet_client_socket(comm);
 
 	if (sockfd < 0) {
 		fprintf(stderr, "Couldn't connect to %s:%d\n",comm->rdma_params->servername,comm->rdma_params->port);
@@ -478,14 +487,14 @@ static int ethernet_client_connect(struct perftest_comm *comm)
 /******************************************************************************
  *
  ******************************************************************************/
-static int ethernet_server_connect(struct perftest_comm *comm)
+static int ethernet_server_listen(struct perftest_comm *comm)
 {
 	struct addrinfo *res, *t;
 	struct addrinfo hints;
 	char *service;
 	int n;
 
-	int sockfd = -1, connfd;
+	int sockfd = -1;
 	memset(&hints, 0, sizeof hints);
 	hints.ai_flags    = AI_PASSIVE;
 	hints.ai_family   = AF_INET;
@@ -493,7 +502,7 @@ static int ethernet_server_connect(struct perftest_comm *comm)
 
 	if (check_add_port(&service,comm->rdma_params->port,NULL,&hints,&res)) {
 		fprintf(stderr, "Problem in resolving basic adress and port\n");
-		return 1;
+		return -1;
 	}
 
 	for (t = res; t; t = t->ai_next) {
@@ -512,11 +521,19 @@ static int ethernet_server_connect(struct perftest_comm *comm)
 
 	if (sockfd < 0) {
 		fprintf(stderr, "Couldn't listen to port %d\n", comm->rdma_params->port);
-		return 1;
+		return -1;
 	}
 
 	listen(sockfd, 1);
-	connfd = accept(sockfd, NULL, 0);
+	return sockfd;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ethernet_server_accept(struct perftest_comm *comm, int sockfd)
+{
+	int connfd = accept(sockfd, NULL, 0);
 
 	if (connfd < 0) {
 		perror("server accept");
@@ -529,6 +546,26 @@ static int ethernet_server_connect(struct perftest_comm *comm)
 	return 0;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ethernet_server_connect(struct perftest_comm *comm)
+{
+	int sockfd;
+
+	/* An incast server already accepted this client before forking. */
+	if (comm->rdma_params->incast_sockfd >= 0) {
+		comm->rdma_params->sockfd = comm->rdma_params->incast_sockfd;
+		return 0;
+	}
+
+	sockfd = ethernet_server_listen(comm);
+	if (sockfd < 0)
+		return 1;
+
+	return ethernet_server_accept(comm, sockfd);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1016,6 +1053,28 @@ int create_comm_struct(struct perftest_comm *comm,
 	comm->rdma_params->retry_count		= user_param->retry_count;
 	comm->rdma_params->mr_per_qp		= user_param->mr_per_qp;
 	comm->rdma_params->dlid			= user_param->dlid;
+	comm->rdma_params->incast_sockfd	= user_param->incast_sockfd;
+
+	/* Fan-out: peer 0 is this comm, the rest connect to the other servers. */
+	if (user_param->num_servers > 1) {
+		int k;
+
+		if (user_param->fanout[0].port)
+			comm->rdma_params->port = user_param->fanout[0].port;
+
+		comm->num_peers = user_param->num_servers;
+		comm->qps_per_peer = user_param->num_of_qps / user_param->num_servers;
+		ALLOCATE(comm->peers, struct perftest_comm, comm->num_peers);
+		memset(comm->peers, 0, comm->num_peers * sizeof(struct perftest_comm));
+
+		comm->peers[0].rdma_params = comm->rdma_params;
+		for (k = 1; k < comm->num_peers; k++) {
+			ALLOCATE(comm->peers[k].rdma_params, struct perftest_parameters, 1);
+			memcpy(comm->peers[k].rdma_params, comm->rdma_params, sizeof(struct perftest_parameters));
+			comm->peers[k].rdma_params->servername = user_param->fanout[k].host;
+			comm->peers[k].rdma_params->port = user_param->fanout[k].port ? user_param->fanout[k].port : user_param->port;
+		}
+	}
 
 	if (user_param->use_rdma_cm) {
 
@@ -1050,6 +1109,17 @@ int create_comm_struct(struct perftest_comm *comm,
 int establish_connection(struct perftest_comm *comm)
 {
 	int (*ptr)(struct perftest_comm*);
+	int k;
+
+	if (comm->num_peers) {
+		for (k = 0; k < comm->num_peers; k++) {
+			if (establish_connection(&comm->peers[k])) {
+				fprintf(stderr," Unable to connect to %s\n", comm->peers[k].rdma_params->servername);
+				return 1;
+			}
+		}
+		return 0;
+	}
 
 	if (comm->rdma_params->use_rdma_cm) {
 
@@ -1081,6 +1151,131 @@ int establish_connection(struct perftest_comm *comm)
 	return 0;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+int establish_ring_connection(struct perftest_comm *left, struct perftest_comm *right,
+		struct perftest_parameters *user_param)
+{
+	int next = (user_param->ring_rank + 1) % user_param->ring_size;
+	int sockfd,retry;
+
+	if (create_comm_struct(left,user_param) || create_comm_struct(right,user_param))
+		return 1;
+
+	left->rdma_params->servername = NULL;
+	left->rdma_params->port = user_param->port + user_param->ring_rank;
+	right->rdma_params->servername = user_param->ring_hosts[next];
+	right->rdma_params->port = user_param->port + next;
+
+	/* Listen before connecting, so no rank has to wait for another one to start. */
+	sockfd = ethernet_server_listen(left);
+	if (sockfd < 0)
+		return 1;
+
+	for (retry = 0; retry < RING_CONNECT_RETRIES; retry++) {
+		right->rdma_params->sockfd = ethernet_client_socket(right);
+		if (right->rdma_params->sockfd >= 0)
+			break;
+		usleep(RING_CONNECT_INTERVAL);
+	}
+
+	if (right->rdma_params->sockfd < 0) {
+		fprintf(stderr, "Couldn't connect to rank %d at %s:%d\n", next,
+				right->rdma_params->servername, right->rdma_params->port);
+		close(sockfd);
+		return 1;
+	}
+
+	return ethernet_server_accept(left, sockfd);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_ring_hand_shake(struct perftest_comm *left, struct perftest_comm *right, int rank,
+		struct pingpong_dest *my_dest, struct pingpong_dest *rem_dest)
+{
+	if (rank == 0) {
+		if (ctx_hand_shake(right,&my_dest[0],&rem_dest[0]) || ctx_hand_shake(left,&my_dest[1],&rem_dest[1]))
+			return 1;
+	} else {
+		if (ctx_hand_shake(left,&my_dest[1],&rem_dest[1]) || ctx_hand_shake(right,&my_dest[0],&rem_dest[0]))
+			return 1;
+	}
+	return 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_ring_barrier(struct perftest_comm *left, struct perftest_comm *right, int rank)
+{
+	char token = 0;
+	int round;
+
+	/* A token goes around twice: the first lap gathers all ranks, the second releases them. */
+	for (round = 0; round < 2; round++) {
+		if (rank == 0) {
+			if (ethernet_write_data(right,&token,sizeof(token)) || ethernet_read_data(left,&token,sizeof(token)))
+				return 1;
+		} else {
+			if (ethernet_read_data(left,&token,sizeof(token)) || ethernet_write_data(right,&token,sizeof(token)))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_ring_close_connection(struct perftest_comm *left, struct perftest_comm *right, int rank,
+		struct pingpong_dest *my_dest, struct pingpong_dest *rem_dest)
+{
+	if (rank == 0) {
+		if (ctx_close_connection(right,&my_dest[0],&rem_dest[0]) || ctx_close_connection(left,&my_dest[1],&rem_dest[1]))
+			return 1;
+	} else {
+		if (ctx_close_connection(left,&my_dest[1],&rem_dest[1]) || ctx_close_connection(right,&my_dest[0],&rem_dest[0]))
+			return 1;
+	}
+	return 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_repeat_next(struct perftest_comm *comm, struct perftest_parameters *user_param)
+{
+	int my_more = 0,rem_more = 0;
+
+	if (user_param->repeat < 2)
+		return 0;
+
+	if (user_param->machine == CLIENT)
+		my_more = repeat_more_trials(user_param);
+
+	my_more = hton_int(my_more);
+	if (ctx_xchg_data(comm, &my_more, &rem_more, sizeof(int))) {
+		fprintf(stderr," Failed to sync the trials between server and client\n");
+		return -1;
+	}
+
+	return (user_param->machine == CLIENT) ? hton_int(my_more) : hton_int(rem_more);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+struct perftest_comm *ctx_peer_comm(struct perftest_comm *comm, int qp_index)
+{
+	if (!comm->num_peers)
+		return comm;
+
+	return &comm->peers[qp_index / comm->qps_per_peer];
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1090,6 +1285,16 @@ int ctx_hand_shake(struct perftest_comm *comm,
 {
 	int (*read_func_ptr) (struct pingpong_dest*,struct perftest_comm*);
 	int (*write_func_ptr)(struct pingpong_dest*,struct perftest_comm*);
+	int k;
+
+	/* Fan-out: sync with every server on the first QP of its group. */
+	if (comm->num_peers) {
+		for (k = 0; k < comm->num_peers; k++) {
+			if (ctx_hand_shake(&comm->peers[k], my_dest + k * comm->qps_per_peer, rem_dest + k * comm->qps_per_peer))
+				return 1;
+		}
+		return 0;
+	}
 
 	if (comm->rdma_params->use_rdma_cm || comm->rdma_params->work_rdma_cm) {
 		read_func_ptr  = &rdma_read_keys;
@@ -1305,6 +1510,14 @@ int ctx_xchg_data( struct perftest_comm *comm,
 		void *my_data,
 		void *rem_data,int size)
 {
+	int k;
+
+	if (comm->num_peers) {
+		for (k = 0; k < comm->num_peers; k++)
+			ctx_xchg_data(&comm->peers[k],my_data,rem_data,size);
+		return 0;
+	}
+
 	if (comm->rdma_params->use_rdma_cm || comm->rdma_params->work_rdma_cm)
 		ctx_xchg_data_rdma(comm,my_data,rem_data,size);
 	else
@@ -1455,6 +1668,16 @@ int ctx_close_connection(struct perftest_comm *comm,
 		struct pingpong_dest *my_dest,
 		struct pingpong_dest *rem_dest)
 {
+	int k;
+
+	if (comm->num_peers) {
+		for (k = 0; k < comm->num_peers; k++) {
+			if (ctx_close_connection(&comm->peers[k], my_dest + k * comm->qps_per_peer, rem_dest + k * comm->qps_per_peer))
+				return 1;
+		}
+		return 0;
+	}
+
 	/*Signal client is finished.*/
 	if (ctx_hand_shake(comm,my_dest,rem_dest)) {
 		return 1;
@@ -1496,7 +1719,7 @@ void check_sys_data(struct perftest_comm *user_comm, struct perftest_parameters
 	int rem_cycle_buffer = 0;
 	int rem_cache_line_size = 0;
 
-	int m_cycle_buffer = hton_int(user_param->cycle_buffer);
+	int m_cycle_buffer = hton_int((int)user_param->cycle_buffer);
 	int m_cache_line_size = hton_int(user_param->cache_line_size);
 
 	/*keep compatibility between older versions, without this feature.*/
@@ -1505,7 +1728,7 @@ void check_sys_data(struct perftest_comm *user_comm, struct perftest_parameters
 	}
 
 	if (!user_param->dont_xchg_versions) {
-		if (ctx_xchg_data(user_comm,(void*)(&m_cycle_buffer),(void*)(&rem_cycle_buffer), sizeof(user_param->cycle_buffer))) {
+		if (ctx_xchg_data(user_comm,(void*)(&m_cycle_buffer),(void*)(&rem_cycle_buffer), sizeof(m_cycle_buffer))) {
 			fprintf(stderr," Failed to exchange Page Size data between server and client\n");
 			exit(1);
 		}
@@ -1519,7 +1742,8 @@ void check_sys_data(struct perftest_comm *user_comm, struct perftest_parameters
 	rem_cache_line_size = ntoh_int(rem_cache_line_size);
 
 	/*take the max and update user_param*/
-	user_param->cycle_buffer = (rem_cycle_buffer > user_param->cycle_buffer) ? rem_cycle_buffer : user_param->cycle_buffer;
+	if (rem_cycle_buffer > 0 && (uint64_t)rem_cycle_buffer > user_param->cycle_buffer)
+		user_param->cycle_buffer = rem_cycle_buffer;
 	user_param->cache_line_size = (rem_cache_line_size > user_param->cache_line_size) ? rem_cache_line_size : user_param->cache_line_size;
 
 	/*update user_comm as well*/
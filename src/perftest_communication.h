@@ -78,6 +78,10 @@
 #define KEY_MSG_SIZE_GID (108)   /* Message size with gid (MGID as well). */
 #define SYNC_SPEC_ID	 (5)
 
+/* A ring rank retries its right neighbour for up to a minute. */
+#define RING_CONNECT_RETRIES	(600)
+#define RING_CONNECT_INTERVAL	(100000)
+
 /* The Format of the message we pass through sockets , without passing Gid. */
 #define KEY_PRINT_FMT "%04x:%04x:%06x:%06x:%08x:%016Lx:%08x"
 
@@ -106,6 +110,10 @@
 struct perftest_comm {
 	struct pingpong_context    *rdma_ctx;
 	struct perftest_parameters *rdma_params;
+	/* Fan-out: one comm per server, each owning qps_per_peer QPs. */
+	int			   num_peers;
+	int			   qps_per_peer;
+	struct perftest_comm	   *peers;
 };
 
 /* bswap_double
@@ -165,6 +173,78 @@ int set_up_connection(struct pingpong_context *ctx,
  */
 int establish_connection(struct perftest_comm *comm);
 
+/* establish_ring_connection .
+ *
+ * Description : Connects this rank to its ring neighbours. Every rank listens
+ *		 on port + rank for its left neighbour and connects to
+ *		 port + rank + 1 on the host of its right neighbour.
+ *
+ * Parameters :
+ *	left       - comm struct to create for the previous rank.
+ *	right      - comm struct to create for the next rank.
+ *	user_param - the perftest parameters (--ring and --rank).
+ *
+ * Return Value : 0 upon success. Otherwise 1.
+ */
+int establish_ring_connection(struct perftest_comm *left, struct perftest_comm *right,
+		struct perftest_parameters *user_param);
+
+/* ctx_ring_hand_shake .
+ *
+ * Description : Exchanges my_dest[0]/rem_dest[0] with the right neighbour and
+ *		 my_dest[1]/rem_dest[1] with the left one. Rank 0 starts
+ *		 with its right neighbour and the others with their left one,
+ *		 so the exchange ripples around the ring without deadlocking.
+ *
+ * Return Value : 0 upon success. Otherwise 1.
+ */
+int ctx_ring_hand_shake(struct perftest_comm *left, struct perftest_comm *right, int rank,
+		struct pingpong_dest *my_dest, struct pingpong_dest *rem_dest);
+
+/* ctx_ring_barrier .
+ *
+ * Description : Returns once every rank of the ring has entered the barrier.
+ *
+ * Return Value : 0 upon success. Otherwise 1.
+ */
+int ctx_ring_barrier(struct perftest_comm *left, struct perftest_comm *right, int rank);
+
+/* ctx_ring_close_connection .
+ *
+ * Description : Closes the connections to both ring neighbours.
+ *
+ * Return Value : 0 upon success. Otherwise 1.
+ */
+int ctx_ring_close_connection(struct perftest_comm *left, struct perftest_comm *right, int rank,
+		struct pingpong_dest *my_dest, struct pingpong_dest *rem_dest);
+
+/* ctx_repeat_next .
+ *
+ * Description : Syncs both sides between --repeat trials. The client decides
+ *		 with repeat_more_trials whether another trial runs and tells the
+ *		 server, so both sides stop together.
+ *
+ * Parameters :
+ *	comm       - the comm struct of the test.
+ *	user_param - the parameters of the test.
+ *
+ * Return Value : 1 for another trial, 0 when done, -1 on error.
+ */
+int ctx_repeat_next(struct perftest_comm *comm, struct perftest_parameters *user_param);
+
+/* ctx_peer_comm .
+ *
+ * Description : Returns the comm of the server that owns QP qp_index.
+ *		 Without fan-out this is comm itself.
+ *
+ * Parameters :
+ *	comm     - the comm struct of the test.
+ *	qp_index - the QP index.
+ *
+ * Return Value : the comm to exchange the QP data on.
+ */
+struct perftest_comm *ctx_peer_comm(struct perftest_comm *comm, int qp_index);
+
 /* rdma_client_connect .
  *
  * Description : Connects the client to a QP on the other machine with rdma_cm.
@@ -3,7 +3,11 @@
 #include <string.h>
 #include <getopt.h>
 #include <limits.h>
+#include <ctype.h>
 #include <arpa/inet.h>
+#include <time.h>
+#include <math.h>
+#include <sys/utsname.h>
 #include "perftest_parameters.h"
 
 #define MAC_LEN (17)
@@ -17,6 +21,9 @@ static const char *portStates[] = {"Nop","Down","Init","Armed","","Active Defer"
 static const char *qp_state[] = {"OFF","ON"};
 static const char *exchange_state[] = {"Ethernet","rdma_cm"};
 static const char *atomicTypesStr[] = {"CMP_AND_SWAP","FETCH_AND_ADD"};
+static const char *hugepageStr[] = {"4K (regular)","2M (hugetlb)","1G (hugetlb)","THP (madvise)"};
+static const char *accessStr[] = {"seq","stride","random"};
+static const char *sgeSpreadStr[] = {"line","page","mr"};
 
 /******************************************************************************
  * parse_mac_from_str.
@@ -106,6 +113,857 @@ int check_if_valid_udp_port(int udp_port)
 {
 	return ON;
 }
+
+/******************************************************************************
+ * Parses a size with an optional K, M or G suffix, *end points past it.
+ ******************************************************************************/
+static uint64_t parse_size_with_suffix(const char *str, char **end)
+{
+	uint64_t value = strtoull(str, end, 0);
+
+	switch (**end) {
+		case 'G': value <<= 10;
+			/* fall through */
+		case 'M': value <<= 10;
+			/* fall through */
+		case 'K': value <<= 10; (*end)++; break;
+		default : break;
+	}
+
+	return value;
+}
+
+/******************************************************************************
+ * Parses the --devices list. A single device is the same as -d/-i.
+ ******************************************************************************/
+static int parse_devices(char *list, struct perftest_parameters *user_param)
+{
+	char	*copy = strdup(list);
+	char	*tok,*save = NULL,*colon;
+	int	n = 0;
+
+	if (!copy)
+		return FAILURE;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_DEVICES || *tok == ':') {
+			free(copy);
+			return FAILURE;
+		}
+
+		user_param->device_ports[n] = DEF_IB_PORT;
+		colon = strchr(tok, ':');
+		if (colon) {
+			*colon = '\0';
+			user_param->device_ports[n] = strtol(colon + 1, NULL, 0);
+			if (user_param->device_ports[n] < MIN_IB_PORT || user_param->device_ports[n] > MAX_IB_PORT) {
+				free(copy);
+				return FAILURE;
+			}
+		}
+		user_param->devices[n++] = strdup(tok);
+	}
+	free(copy);
+
+	if (!n)
+		return FAILURE;
+
+	user_param->num_devices = n;
+	user_param->ib_devname = user_param->devices[0];
+	user_param->ib_port = user_param->device_ports[0];
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Parses the --fanout server list. The first server is the regular servername.
+ ******************************************************************************/
+static int parse_fanout(char *list, struct perftest_parameters *user_param)
+{
+	char	*copy = strdup(list);
+	char	*tok,*save = NULL,*colon;
+	int	n = 0;
+
+	if (!copy)
+		return FAILURE;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_FANOUT || *tok == ':') {
+			free(copy);
+			return FAILURE;
+		}
+
+		user_param->fanout[n].port = 0;
+		colon = strchr(tok, ':');
+		if (colon) {
+			*colon = '\0';
+			user_param->fanout[n].port = strtol(colon + 1, NULL, 0);
+			if (user_param->fanout[n].port <= 0 || user_param->fanout[n].port > 65535) {
+				free(copy);
+				return FAILURE;
+			}
+		}
+		user_param->fanout[n++].host = strdup(tok);
+	}
+	free(copy);
+
+	if (!n)
+		return FAILURE;
+
+	user_param->num_servers = n;
+	user_param->servername = user_param->fanout[0].host;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Parses the --ring host list, one host per rank.
+ ******************************************************************************/
+static int parse_ring(char *list, struct perftest_parameters *user_param)
+{
+	char	*copy = strdup(list);
+	char	*tok,*save = NULL;
+	int	n = 0;
+
+	if (!copy)
+		return FAILURE;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_RING_RANKS) {
+			free(copy);
+			return FAILURE;
+		}
+		user_param->ring_hosts[n++] = strdup(tok);
+	}
+	free(copy);
+
+	if (n < 2)
+		return FAILURE;
+
+	user_param->ring_size = n;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Parses one --sweep=<param>=<values> dimension. The values are a comma
+ * separated list of numbers and <min>:<max> ranges, which double each step.
+ ******************************************************************************/
+static int parse_sweep(char *spec, struct perftest_parameters *user_param)
+{
+	static const char	*names[SWEEP_PARAMS] = {"size","qps","tx_depth","post_list","cq_mod"};
+	struct sweep_dim	*dim = NULL;
+	char			*copy,*tok,*save = NULL,*end;
+	uint64_t		val,max;
+	size_t			len = 0;
+	int			p;
+
+	for (p = 0; p < SWEEP_PARAMS; p++) {
+		len = strlen(names[p]);
+		if (strncmp(spec, names[p], len) == 0 && spec[len] == '=') {
+			dim = &user_param->sweep[p];
+			break;
+		}
+	}
+
+	/* Each parameter is given once. */
+	if (!dim || dim->count)
+		return FAILURE;
+
+	copy = strdup(spec + len + 1);
+	if (!copy)
+		return FAILURE;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		val = parse_size_with_suffix(tok, &end);
+		max = val;
+		if (*end == ':')
+			max = parse_size_with_suffix(end + 1, &end);
+
+		if (*end != '\0' || val == 0 || max < val) {
+			free(copy);
+			return FAILURE;
+		}
+
+		for (; val <= max; val *= 2) {
+			if (dim->count == MAX_SWEEP_VALUES) {
+				free(copy);
+				return FAILURE;
+			}
+			dim->val[dim->count++] = val;
+		}
+	}
+	free(copy);
+
+	if (!dim->count)
+		return FAILURE;
+
+	user_param->is_sweep = 1;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Fills a sweep dimension with min, 2*min, ... and max itself.
+ ******************************************************************************/
+static void fill_doubling(struct sweep_dim *dim, uint64_t min, uint64_t max)
+{
+	uint64_t val;
+
+	dim->count = 0;
+	for (val = min; val < max && dim->count < MAX_SWEEP_VALUES - 1; val *= 2)
+		dim->val[dim->count++] = val;
+	dim->val[dim->count++] = max;
+}
+
+/******************************************************************************
+ * Parses the --load_lat steps, a comma separated list of percentages.
+ ******************************************************************************/
+static int parse_load_lat(char *spec, struct perftest_parameters *user_param)
+{
+	char *copy,*tok,*save = NULL,*end;
+	long val;
+
+	copy = strdup(spec);
+	if (!copy)
+		return FAILURE;
+
+	user_param->load_lat_steps = 0;
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		val = strtol(tok, &end, 0);
+		if (*end != '\0' || val < 1 || val > 100 || user_param->load_lat_steps == MAX_LOAD_STEPS)
+			break;
+		user_param->load_lat[user_param->load_lat_steps++] = val;
+	}
+	free(copy);
+
+	return (tok || !user_param->load_lat_steps) ? FAILURE : SUCCESS;
+}
+
+/******************************************************************************
+ * Parses the --contention levels: "hot" (one address), <K> (K addresses
+ * picked uniformly) or zipf:<K>:<s> (K addresses with Zipf skew s).
+ ******************************************************************************/
+static int parse_contention(char *spec, struct perftest_parameters *user_param)
+{
+	struct contention_level *level;
+	char *copy,*tok,*save = NULL,*end;
+
+	copy = strdup(spec);
+	if (!copy)
+		return FAILURE;
+
+	user_param->contention_levels = 0;
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (user_param->contention_levels == MAX_CONTENTION_LEVELS)
+			break;
+		level = &user_param->contention[user_param->contention_levels];
+		level->zipf = 0;
+
+		if (strcmp(tok, "hot") == 0) {
+			level->addrs = 1;
+		} else if (strncmp(tok, "zipf:", 5) == 0) {
+			level->addrs = strtol(tok + 5, &end, 0);
+			if (*end != ':')
+				break;
+			level->zipf = strtod(end + 1, &end);
+			if (*end != '\0' || level->zipf <= 0)
+				break;
+		} else {
+			level->addrs = strtol(tok, &end, 0);
+			if (*end != '\0')
+				break;
+		}
+
+		if (level->addrs < 1 || level->addrs > MAX_CONTENTION_ADDRS)
+			break;
+		user_param->contention_levels++;
+	}
+	free(copy);
+
+	return (tok || !user_param->contention_levels) ? FAILURE : SUCCESS;
+}
+
+/******************************************************************************
+ * Results file and baseline comparison.
+ *
+ * The file is plain text, one record per line: "test", "device" and "config"
+ * describe the run, then one "bw" or "lat" row per printed result (so each
+ * trial of --repeat is a row) and a "hist" row of log2 latency buckets.
+ ******************************************************************************/
+static const char *resultsMetricStr[] = {"bw","msg_rate","lat","p99"};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void results_set_device(struct ibv_context *context,struct perftest_parameters *user_param)
+{
+	struct ibv_device_attr attr;
+	struct utsname uts;
+
+	if (!user_param->results.file && !user_param->results.baseline)
+		return;
+
+	if (!ibv_query_device(context,&attr))
+		snprintf(user_param->results.fw_ver, sizeof(user_param->results.fw_ver), "%s", attr.fw_ver);
+	if (!uname(&uts))
+		snprintf(user_param->results.kernel, sizeof(user_param->results.kernel), "%s", uts.release);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void results_test_line(struct perftest_parameters *user_param, char *line, size_t len)
+{
+	const char *units;
+
+	if (user_param->tst == BW)
+		units = (user_param->report_fmt == MBS) ? "MB/sec" : "Gb/sec";
+	else
+		units = user_param->r_flag->cycles ? "cycles" : "usec";
+
+	snprintf(line, len, "%s %s %s %s%s", testsStr[user_param->verb], user_param->tst == BW ? "BW" : "LAT",
+		connStr[user_param->connection_type], units, user_param->duplex ? " bidirectional" : "");
+}
+
+/******************************************************************************
+ * Keeps a row for the comparison and writes it to the results file.
+ ******************************************************************************/
+static void results_add_row(struct perftest_parameters *user_param, int is_lat, uint64_t size,
+		double val0, double val1, const char *line)
+{
+	struct results_data *res = &user_param->results;
+	char test[128];
+
+	if (res->baseline && res->num_rows < RESULTS_MAX_ROWS) {
+		if (!res->rows)
+			ALLOCATE(res->rows, struct results_row, RESULTS_MAX_ROWS);
+		res->rows[res->num_rows].size = size;
+		res->rows[res->num_rows].is_lat = is_lat;
+		res->rows[res->num_rows].val[0] = val0;
+		res->rows[res->num_rows++].val[1] = val1;
+	}
+
+	if (!res->file)
+		return;
+
+	if (!res->fp) {
+		res->fp = fopen(res->file, "w");
+		if (!res->fp) {
+			fprintf(stderr, " Unable to open results file '%s', not writing results\n", res->file);
+			res->file = NULL;
+			return;
+		}
+		results_test_line(user_param, test, sizeof(test));
+		fprintf(res->fp, "# perftest %s results\n", user_param->version);
+		fprintf(res->fp, "test %s\n", test);
+		fprintf(res->fp, "device %s fw %s kernel %s\n", user_param->ib_devname ? user_param->ib_devname : "-",
+			res->fw_ver[0] ? res->fw_ver : "-", res->kernel[0] ? res->kernel : "-");
+		fprintf(res->fp, "config iters %d qps %d tx_depth %d post_list %d cq_mod %d inline %d mtu %d\n",
+			user_param->iters, user_param->num_of_qps, user_param->tx_depth, user_param->post_list,
+			user_param->cq_mod, user_param->inline_size, user_param->curr_mtu);
+		if (res->cmdline)
+			fprintf(res->fp, "cmdline %s\n", res->cmdline);
+	}
+
+	fputs(line, res->fp);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void results_add_bw(struct perftest_parameters *user_param, uint64_t size, int iters,
+		double bw_peak, double bw_avg, double msgRate_avg)
+{
+	char line[256];
+
+	snprintf(line, sizeof(line), "bw %lu %.6lf %.6lf %.6lf %d\n", size, bw_avg, msgRate_avg, bw_peak, iters);
+	results_add_row(user_param, 0, size, bw_avg, msgRate_avg, line);
+}
+
+/******************************************************************************
+ * delta holds n sorted samples, divided by scale they are in the test units.
+ ******************************************************************************/
+static void results_add_lat(struct perftest_parameters *user_param, cycles_t *delta, int n,
+		cycles_t median_cycles, double scale)
+{
+	char line[256];
+	double sum = 0,median,p99;
+	int i;
+	FILE *fp;
+
+	if (n < 1)
+		return;
+
+	for (i = 0; i < n; i++)
+		sum += delta[i];
+
+	median = median_cycles / scale;
+	p99 = delta[(n - 1) * 99 / 100] / scale;
+
+	snprintf(line, sizeof(line), "lat %lu %.4lf %.4lf %.4lf %.4lf %.4lf %.4lf\n", (unsigned long)user_param->size,
+		delta[0] / scale, median, sum / n / scale, p99, delta[(n - 1) * 999 / 1000] / scale, delta[n - 1] / scale);
+	results_add_row(user_param, 1, user_param->size, median, p99, line);
+
+	fp = user_param->results.fp;
+	if (!fp)
+		return;
+
+	fprintf(fp, "hist %lu", (unsigned long)user_param->size);
+	print_hist_buckets(fp, delta, n, scale);
+	fputc('\n', fp);
+}
+
+/******************************************************************************
+ * Parses --compare_tol, a percentage for all metrics or <metric>=<percent>,...
+ ******************************************************************************/
+static int parse_compare_tol(char *spec, struct perftest_parameters *user_param)
+{
+	char *copy,*tok,*save = NULL,*end,*eq;
+	double tol;
+	int m;
+
+	tol = strtod(spec, &end);
+	if (*end == '\0') {
+		if (tol < 0)
+			return FAILURE;
+		for (m = 0; m < RESULTS_METRICS; m++)
+			user_param->results.tol[m] = tol;
+		return SUCCESS;
+	}
+
+	copy = strdup(spec);
+	if (!copy)
+		return FAILURE;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		eq = strchr(tok, '=');
+		if (!eq)
+			break;
+		*eq = '\0';
+
+		for (m = 0; m < RESULTS_METRICS; m++)
+			if (!strcmp(tok, resultsMetricStr[m]))
+				break;
+
+		tol = strtod(eq + 1, &end);
+		if (m == RESULTS_METRICS || *end != '\0' || tol < 0)
+			break;
+		user_param->results.tol[m] = tol;
+	}
+	free(copy);
+
+	return tok ? FAILURE : SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int results_load_baseline(struct perftest_parameters *user_param, struct results_row *rows,
+		char *test, size_t test_len, char *device, size_t device_len)
+{
+	FILE *file;
+	char line[1024];
+	unsigned long size;
+	double val[6];
+	int n = 0;
+
+	file = fopen(user_param->results.baseline, "r");
+	if (!file) {
+		fprintf(stderr, " Unable to open baseline file '%s'\n", user_param->results.baseline);
+		return -1;
+	}
+
+	test[0] = device[0] = '\0';
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "test ", 5)) {
+			snprintf(test, test_len, "%.*s", (int)test_len - 1, line + 5);
+		} else if (!strncmp(line, "device ", 7)) {
+			snprintf(device, device_len, "%.*s", (int)device_len - 1, line + 7);
+		} else if (n < RESULTS_MAX_ROWS && sscanf(line, "bw %lu %lf %lf", &size, &val[0], &val[1]) == 3) {
+			rows[n].size = size;
+			rows[n].is_lat = 0;
+			rows[n].val[0] = val[0];
+			rows[n++].val[1] = val[1];
+		} else if (n < RESULTS_MAX_ROWS && sscanf(line, "lat %lu %lf %lf %lf %lf", &size, &val[0], &val[1], &val[2], &val[3]) == 5) {
+			rows[n].size = size;
+			rows[n].is_lat = 1;
+			rows[n].val[0] = val[1];
+			rows[n++].val[1] = val[3];
+		}
+	}
+	fclose(file);
+
+	return n;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void results_stats(struct results_row *rows, int n, int is_lat, uint64_t size, int v,
+		int *count, double *mean, double *var)
+{
+	double delta,m2 = 0;
+	int i;
+
+	*count = 0;
+	*mean = 0;
+	for (i = 0; i < n; i++) {
+		if (rows[i].is_lat != is_lat || rows[i].size != size)
+			continue;
+		delta = rows[i].val[v] - *mean;
+		*mean += delta / ++(*count);
+		m2 += delta * (rows[i].val[v] - *mean);
+	}
+	*var = (*count > 1) ? m2 / (*count - 1) : 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int results_finish(struct perftest_parameters *user_param)
+{
+	struct results_data *res = &user_param->results;
+	struct results_row *base = NULL;
+	char test[128],base_test[128],base_device[256];
+	double base_mean,base_var,cur_mean,cur_var,worse,se,t,dof;
+	int base_rows,base_n,cur_n,i,j,v,m,significant;
+	int regressions = 0;
+	const char *verdict;
+
+	if (res->fp) {
+		fclose(res->fp);
+		res->fp = NULL;
+	}
+
+	if (!res->baseline || !res->num_rows)
+		return SUCCESS;
+
+	ALLOCATE(base, struct results_row, RESULTS_MAX_ROWS);
+	base_rows = results_load_baseline(user_param, base, base_test, sizeof(base_test), base_device, sizeof(base_device));
+	if (base_rows < 0) {
+		free(base);
+		return FAILURE;
+	}
+
+	results_test_line(user_param, test, sizeof(test));
+	printf(RESULT_LINE);
+	printf(" Baseline        : %s\n", res->baseline);
+	printf(" Baseline device : %s\n", base_device[0] ? base_device : "-");
+	printf(" Current device  : %s fw %s kernel %s\n", user_param->ib_devname ? user_param->ib_devname : "-",
+		res->fw_ver[0] ? res->fw_ver : "-", res->kernel[0] ? res->kernel : "-");
+
+	if (strcmp(test, base_test)) {
+		fprintf(stderr, " The baseline is for '%s', this test is '%s'\n", base_test, test);
+		free(base);
+		return FAILURE;
+	}
+
+	printf(RESULT_FMT_COMPARE);
+	for (i = 0; i < res->num_rows; i++) {
+		/* Each size is compared once, over all of its rows. */
+		for (j = 0; j < i; j++)
+			if (res->rows[j].is_lat == res->rows[i].is_lat && res->rows[j].size == res->rows[i].size)
+				break;
+		if (j < i)
+			continue;
+
+		for (v = 0; v < 2; v++) {
+			m = res->rows[i].is_lat ? RESULTS_LAT + v : RESULTS_BW + v;
+			results_stats(base, base_rows, res->rows[i].is_lat, res->rows[i].size, v, &base_n, &base_mean, &base_var);
+			results_stats(res->rows, res->num_rows, res->rows[i].is_lat, res->rows[i].size, v, &cur_n, &cur_mean, &cur_var);
+
+			if (!base_n || base_mean <= 0) {
+				printf(REPORT_FMT_COMPARE_NONE, (unsigned long)res->rows[i].size, resultsMetricStr[m], cur_mean);
+				continue;
+			}
+
+			/* Positive is worse: lower BW and msg rate, higher latency. */
+			worse = 100 * (res->rows[i].is_lat ? cur_mean - base_mean : base_mean - cur_mean) / base_mean;
+
+			/* With trials on both sides, Welch's t-test must also see the change. */
+			significant = 1;
+			if (base_n > 1 && cur_n > 1) {
+				se = sqrt(base_var / base_n + cur_var / cur_n);
+				if (se > 0) {
+					t = fabs(cur_mean - base_mean) / se;
+					dof = pow(se, 4) / (pow(base_var / base_n, 2) / (base_n - 1) + pow(cur_var / cur_n, 2) / (cur_n - 1));
+					significant = t > student_t95(dof < 1 ? 1 : (int)dof);
+				}
+			}
+
+			if (worse > res->tol[m] && significant) {
+				verdict = "REGRESSION";
+				regressions++;
+			} else if (worse > res->tol[m]) {
+				verdict = "not significant";
+			} else if (-worse > res->tol[m] && significant) {
+				verdict = "improved";
+			} else {
+				verdict = "ok";
+			}
+
+			printf(REPORT_FMT_COMPARE, (unsigned long)res->rows[i].size, resultsMetricStr[m], base_mean, cur_mean,
+				res->rows[i].is_lat ? worse : -worse, base_n, cur_n, verdict);
+		}
+	}
+	free(base);
+
+	printf(" Regressions     : %d\n", regressions);
+	return regressions ? FAILURE : SUCCESS;
+}
+
+/******************************************************************************
+ * Parses a time period into milliseconds. Plain numbers are seconds (and may be
+ * fractional), an "ms" suffix gives milliseconds and an "s" suffix seconds.
+ ******************************************************************************/
+static int parse_time_ms(const char *str, int *ms)
+{
+	char	*end;
+	double	value = strtod(str, &end);
+
+	if (end == str)
+		return FAILURE;
+
+	if (!strcmp(end, "ms"))
+		;
+	else if (*end == '\0' || !strcmp(end, "s"))
+		value *= 1000;
+	else
+		return FAILURE;
+
+	if (value < 0 || value > INT_MAX)
+		return FAILURE;
+
+	*ms = (int)(value + 0.5);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int size_dist_class(uint64_t size)
+{
+	int c = 0;
+
+	while (c < SIZE_DIST_CLASSES - 1 && ((uint64_t)1 << c) < size)
+		c++;
+
+	return c;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int add_size_dist_entry(struct size_dist *dist, uint64_t size, double weight)
+{
+	if (dist->num_of_entries == MAX_SIZE_DIST_ENTRIES) {
+		fprintf(stderr, " Too many entries in size distribution (max %d)\n", MAX_SIZE_DIST_ENTRIES);
+		return FAILURE;
+	}
+
+	if (size < 1 || size > MAX_SIZE || weight < 0) {
+		fprintf(stderr, " Invalid size distribution entry %lu (weight %lf)\n", size, weight);
+		return FAILURE;
+	}
+
+	dist->sizes[dist->num_of_entries] = size;
+	dist->weights[dist->num_of_entries] = weight;
+	dist->num_of_entries++;
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * CDF file format: one "<size> <cumulative probability>" pair per line,
+ * in increasing order. Lines starting with '#' are ignored.
+ ******************************************************************************/
+static int read_size_dist_cdf(const char *fname, struct size_dist *dist)
+{
+	FILE *file;
+	char line[256];
+	unsigned long size;
+	double cdf, prev_cdf = 0;
+
+	file = fopen(fname, "r");
+	if (!file) {
+		fprintf(stderr, " Unable to open CDF file '%s'\n", fname);
+		return FAILURE;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%lu %lf", &size, &cdf) != 2 || cdf < prev_cdf || cdf > 1.0) {
+			fprintf(stderr, " Invalid line in CDF file: %s", line);
+			fclose(file);
+			return FAILURE;
+		}
+
+		if (add_size_dist_entry(dist, size, cdf - prev_cdf)) {
+			fclose(file);
+			return FAILURE;
+		}
+		prev_cdf = cdf;
+	}
+
+	fclose(file);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int parse_size_dist(char *spec, struct size_dist *dist)
+{
+	char *ptr, *end;
+	uint64_t size, size2;
+	double weight, weighted_bytes = 0;
+	int i;
+
+	memset(dist, 0, sizeof(struct size_dist));
+	dist->type = SIZE_DIST_WEIGHTED;
+
+	if (strncmp(spec, "fixed:", 6) == 0) {
+		size = parse_size_with_suffix(spec + 6, &end);
+		if (*end != '\0' || add_size_dist_entry(dist, size, 1))
+			goto bad_spec;
+
+	} else if (strncmp(spec, "uniform:", 8) == 0) {
+		dist->type = SIZE_DIST_UNIFORM;
+		dist->min_size = parse_size_with_suffix(spec + 8, &end);
+		if (*end != '-')
+			goto bad_spec;
+
+		dist->max_size = parse_size_with_suffix(end + 1, &end);
+		if (*end != '\0' || dist->min_size < 1 || dist->max_size < dist->min_size || dist->max_size > MAX_SIZE)
+			goto bad_spec;
+
+	} else if (strncmp(spec, "bimodal:", 8) == 0) {
+		size = parse_size_with_suffix(spec + 8, &end);
+		if (*end != ',')
+			goto bad_spec;
+
+		size2 = parse_size_with_suffix(end + 1, &end);
+		if (*end != ',')
+			goto bad_spec;
+
+		weight = strtod(end + 1, &end);
+		if (*end != '\0' || weight < 0 || weight > 100)
+			goto bad_spec;
+
+		if (add_size_dist_entry(dist, size, 100 - weight) || add_size_dist_entry(dist, size2, weight))
+			goto bad_spec;
+
+	} else if (strncmp(spec, "list:", 5) == 0) {
+		ptr = spec + 5;
+		do {
+			size = parse_size_with_suffix(ptr, &end);
+			if (*end != ':')
+				goto bad_spec;
+
+			weight = strtod(end + 1, &end);
+			if (add_size_dist_entry(dist, size, weight))
+				goto bad_spec;
+
+			ptr = end + 1;
+		} while (*end == ',');
+
+		if (*end != '\0')
+			goto bad_spec;
+
+	} else if (strncmp(spec, "cdf:", 4) == 0) {
+		if (read_size_dist_cdf(spec + 4, dist))
+			return FAILURE;
+
+	} else {
+		goto bad_spec;
+	}
+
+	/* Compute the average size. */
+	if (dist->type == SIZE_DIST_UNIFORM) {
+		dist->avg_size = (dist->min_size + dist->max_size) / 2.0;
+	} else {
+		dist->min_size = MAX_SIZE;
+		for (i = 0; i < dist->num_of_entries; i++) {
+			if (dist->weights[i] == 0)
+				continue;
+
+			dist->total_weight += dist->weights[i];
+			weighted_bytes += dist->weights[i] * dist->sizes[i];
+			dist->min_size = (dist->sizes[i] < dist->min_size) ? dist->sizes[i] : dist->min_size;
+			dist->max_size = (dist->sizes[i] > dist->max_size) ? dist->sizes[i] : dist->max_size;
+		}
+
+		if (dist->total_weight <= 0)
+			goto bad_spec;
+
+		dist->avg_size = weighted_bytes / dist->total_weight;
+	}
+
+	return SUCCESS;
+
+bad_spec:
+	fprintf(stderr, " Invalid size distribution '%s'\n", spec);
+	fprintf(stderr, " Please use fixed:<s>, uniform:<min>-<max>, bimodal:<s1>,<s2>,<%%s2>, list:<s>:<w>,... or cdf:<file>\n");
+	return FAILURE;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static const char *mix_verb_str[] = {"send", "write", "read"};
+
+static int parse_verb_mix(char *spec, struct verb_mix *mix)
+{
+	char *ptr, *end;
+	int current[MIX_NUM_OF_VERBS] = {0};
+	int i, v, best, len = 0, weight;
+
+	memset(mix, 0, sizeof(struct verb_mix));
+
+	ptr = spec;
+	do {
+		for (v = 0; v < MIX_NUM_OF_VERBS; v++) {
+			len = strlen(mix_verb_str[v]);
+			if (strncmp(ptr, mix_verb_str[v], len) == 0 && ptr[len] == ':')
+				break;
+		}
+
+		if (v == MIX_NUM_OF_VERBS)
+			goto bad_spec;
+
+		weight = strtol(ptr + len + 1, &end, 10);
+		if (end == ptr + len + 1 || weight < 0 || weight > MIX_RING_LEN)
+			goto bad_spec;
+
+		mix->weights[v] += weight;
+		mix->total_weight += weight;
+		ptr = end + 1;
+	} while (*end == ',');
+
+	if (*end != '\0' || mix->total_weight == 0)
+		goto bad_spec;
+
+	/* Smooth weighted round robin, so the verbs are interleaved instead of bunched. */
+	for (i = 0; i < MIX_RING_LEN; i++) {
+		best = 0;
+		for (v = 0; v < MIX_NUM_OF_VERBS; v++) {
+			current[v] += mix->weights[v];
+			if (current[v] > current[best])
+				best = v;
+		}
+		current[best] -= mix->total_weight;
+		mix->ring[i] = best;
+	}
+
+	return SUCCESS;
+
+bad_spec:
+	fprintf(stderr, " Invalid verb mix '%s'\n", spec);
+	fprintf(stderr, " Please use <verb>:<weight>,... with verbs send, write and read\n");
+	return FAILURE;
+}
+
 /******************************************************************************
   get cache line size from system
  ******************************************************************************/
@@ -140,7 +998,7 @@ static int get_cache_line_size()
 /******************************************************************************
  *
  ******************************************************************************/
-static void usage(const char *argv0, VerbType verb, TestType tst, int connection_type)
+static void usage(const char *argv0, VerbType verb, TestType tst, int connection_type, int is_collective)
 {
 	printf("Usage:\n");
 	printf("  %s            start a server and wait for connection\n", argv0);
@@ -183,15 +1041,123 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 	printf(" Use IB device <dev> (default first device found)\n");
 
 	printf("  -D, --duration ");
-	printf(" Run test for a customized period of seconds.\n");
+	printf(" Run test for a customized period of seconds, or milliseconds with an ms suffix (e.g. 500ms)\n");
 
 	if (verb != WRITE) {
 		printf("  -e, --events ");
 		printf(" Sleep on CQ events (default poll)\n");
 	}
 
+	if (tst == BW) {
+		printf("      --devices=<dev>[:<port>],... ");
+		printf(" Run the test on each device concurrently and report per device and aggregate BW (same list on both sides)\n");
+	}
+
+	if (tst == BW && (verb == WRITE || verb == READ)) {
+		printf("      --sweep=<param>=<values> ");
+		printf(" Run all combinations over one connection, <param> is size, qps, tx_depth, post_list or cq_mod.\n");
+		printf("                                        <values> is a list of <n> and <min>:<max> (doubling). May be repeated, same sweeps on both sides\n");
+
+		printf("      --load_lat=<percent>,... ");
+		printf(" Load-latency curve: run the other QPs at these loads (percent of their top rate) while one more QP probes the round trip.\n");
+		printf("                                        Same option on both sides. -H adds a histogram per load\n");
+
+		printf("      --autotune=<rate|p99> ");
+		printf(" Search qps, tx_depth, post_list, cq_mod and inline for the best message rate or p99 latency, by coordinate descent.\n");
+		printf("                                        The ranges go up to -q, -t, -l (default %d) and -Q, or are given with --sweep. Same options on both sides\n", AUTOTUNE_MAX_POST_LIST);
+	}
+
+	if (tst == BW && verb == SEND && connection_type == UD) {
+		printf("      --ud_dests=<M>[,random] ");
+		printf(" Send from each UD QP to a table of <M> AHs over the remote QPs (-q), round robin or at random.\n");
+		printf("                                        Prints the AH creation cost, needs -D. Same -q on both sides\n");
+	}
+
+	if (tst == BW && verb == ATOMIC) {
+		printf("      --contention=<level>,... ");
+		printf(" Aim all QPs at a shared set of remote words, one row per level: hot (one word), <K> (K words, uniform)\n");
+		printf("                                        or zipf:<K>:<s> (K words, Zipf skew s). Same option on both sides. -H adds a histogram per level\n");
+
+		printf("      --cas_retry ");
+		printf(" With --contention and CMP_AND_SWAP, each QP increments by a CAS retry loop, one attempt in flight,\n");
+		printf("                                        and the CAS success rate and retries per increment are reported\n");
+	}
+
+	if (tst == BW && (verb == WRITE || verb == READ)) {
+		printf("      --target_time=<sec> ");
+		printf(" Scale the iterations of each size to this time, run in chunks after a short pilot (ms suffix allowed)\n");
+
+		printf("      --target_ci=<percent> ");
+		printf(" Extend each size in chunks until the 95%% confidence interval of the BW is within this percentage\n");
+	}
+
+	if (tst == LAT) {
+		printf("      --qd=<n> ");
+		printf(" Keep <n> operations in flight over RC and report the latency of each one, matched by its slot (same option on both sides)\n");
+	}
+
+	if ((tst == BW && (verb == WRITE || verb == READ)) || (tst == LAT && verb != ATOMIC)) {
+		printf("      --repeat=<trials> ");
+		printf(" Run up to %d trials on the same connection and report mean, stddev and 95%% CI, without outlier trials\n", MAX_REPEAT);
+
+		printf("      --repeat_ci=<percent> ");
+		printf(" Stop the trials once the 95%% CI of the BW average (median latency) is within this percentage\n");
+	}
+
+	printf("      --results=<file> ");
+	printf(" Write the test, device, firmware, kernel, parameters and every result row (with latency histograms) to this file\n");
+
+	printf("      --compare=<file> ");
+	printf(" Compare the results with a baseline written by --results, exit with an error on a regression\n");
+
+	printf("      --compare_tol=<percent>|<metric>=<percent>,... ");
+	printf(" Allowed degradation of bw, msg_rate, lat and p99 (default %.0f%%). Trials of --repeat add a t-test\n", RESULTS_DEF_TOL);
+
+	if (tst == BW && verb != SEND) {
+		printf("      --steady_warmup=<percent> ");
+		printf(" Warm up all QPs at once after touching every buffer page, until %d windows of %dms agree within this percentage\n",
+			WARMUP_WINDOWS, WARMUP_WINDOW_MS);
+	}
+
+	if (tst == BW) {
+		printf("      --incast=<clients> ");
+		printf(" Server side: accept this many clients, each with its own QP set, start them together and report aggregate BW and fairness\n");
+	}
+
+	if (verb == WRITE && tst == BW) {
+		printf("      --fanout=<host>[:<port>],... ");
+		printf(" Client side: write to all these servers at once, -q QPs per server on a shared send CQ\n");
+
+		printf("      --fanout_same_buf ");
+		printf(" Post the same local buffer to every server (like replication) instead of a buffer per QP\n");
+	}
+
+	if (is_collective) {
+		printf("      --ring=<host0>,<host1>,... ");
+		printf(" ib_allreduce_bw: the hosts of all ranks in ring order, rank r uses port + r\n");
+
+		printf("      --rank=<r> ");
+		printf(" ib_allreduce_bw: the rank of this process in the ring\n");
+
+		printf("      --ring_send ");
+		printf(" ib_allreduce_bw: move chunks with SEND instead of RDMA WRITE with immediate\n");
+	}
+
+	if (verb == SEND) {
+		printf("      --recv_batch=<n> ");
+		printf(" Repost receives in chained batches of <n> WRs (default 1)\n");
+	}
+
+	if (verb != WRITE || tst == BW) {
+		printf("      --event_spin=<usec> ");
+		printf(" Hybrid completion mode: busy poll the CQ for <usec>, then arm it and sleep (implies -e)\n");
+
+		printf("      --cq_moderation=<count>:<usec> ");
+		printf(" Moderate CQ events to one per <count> completions or <usec>, where supported\n");
+	}
+
 	printf("  -f, --margin ");
-	printf(" measure results within margins. (default=2sec)\n");
+	printf(" measure results within margins, in seconds or with an ms suffix. (default=duration/4)\n");
 
 	printf("  -F, --CPU-freq ");
 	printf(" Do not show a warning even if cpufreq_ondemand module is loaded, and cpu-freq is not on max.\n");
@@ -336,6 +1302,9 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 		printf(" delay time between each post send\n");
 	}
 
+	printf("      --numa=<auto|node|off> ");
+	printf(" Bind memory and pin the polling thread to the device NUMA node (auto) or to <node>. Default is off\n");
+
 	printf("      --mmap=file ");
 	printf(" Use an mmap'd file as the buffer for testing P2P transfers.\n");
 	printf("      --mmap-offset=<offset> ");
@@ -370,7 +1339,7 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 		printf(" Reverse traffic direction - Server send to client\n");
 
 		printf("      --run_infinitely ");
-		printf(" Run test forever, print results every <duration> seconds\n");
+		printf(" Run test forever, print results every <duration>\n");
 	}
 
 	printf("      --retry_count=<value> ");
@@ -381,6 +1350,41 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 	printf(" Use CUDA lib for GPU-Direct testing.\n");
 	#endif
 
+	if (tst == BW) {
+		printf("      --working_set=<size>[:<max>] ");
+		printf(" Spread local and remote addresses over <size> bytes per QP (K/M/G suffix allowed).\n");
+		printf("                                        With <max>, sweep the working set from <size> to <max> in powers of 2. Must be given on both sides\n");
+
+		printf("      --access=<seq|stride:n|random> ");
+		printf(" Address pattern over the working set. Default is seq\n");
+	}
+
+	if (verb != ATOMIC) {
+		printf("      --size_dist=<spec> ");
+		printf(" Per message size distribution: fixed:<s>, uniform:<min>-<max>, bimodal:<s1>,<s2>,<%%s2>,\n");
+		printf("                                        list:<s>:<w>,<s>:<w>,... or cdf:<file>. Must be given on both sides\n");
+	}
+
+	if (verb != ATOMIC && tst == BW) {
+		printf("      --sge=<n>[:<max>] ");
+		printf(" Number of SGEs per WR (max %d). With <max>, write and read sweep it in powers of 2 up to max\n", MAX_SGE);
+
+		printf("      --sge_layout=<s1>,<s2>,... ");
+		printf(" Size of each SGE (K/M/G suffix allowed). The message size is their sum. Default is an even split\n");
+
+		printf("      --sge_spread=<line|page|mr> ");
+		printf(" Start each SGE on its own cache line, page or MR. Default is line\n");
+	}
+
+	if (verb == SEND && tst == BW) {
+		printf("      --mix=<verb>:<weight>,... ");
+		printf(" Mix send, write and read on the same RC QPs (e.g. write:60,read:30,send:10).\n");
+		printf("                                        Must be given on both sides; the server reports the send part\n");
+	}
+
+	printf("      --use_hugepages=<2M|1G|thp> ");
+	printf(" Back the data buffers with huge pages (MAP_HUGETLB for 2M/1G, madvise for thp)\n");
+
 
 	#ifdef HAVE_VERBS_EXP
 	printf("      --use_exp ");
@@ -462,6 +1466,9 @@ void usage_raw_ethernet()
  ******************************************************************************/
 static void init_perftest_params(struct perftest_parameters *user_param)
 {
+	long page_size;
+	int i;
+
 	user_param->port		= DEF_PORT;
 	user_param->ib_port		= DEF_IB_PORT;
 	user_param->ib_port2		= DEF_IB_PORT2;
@@ -543,11 +1550,8 @@ static void init_perftest_params(struct perftest_parameters *user_param)
 	user_param->raw_mcast			= 0;
 	user_param->masked_atomics		= 0;
 	user_param->cache_line_size		= get_cache_line_size();
-	user_param->cycle_buffer		= sysconf(_SC_PAGESIZE);
-
-	if (user_param->cycle_buffer <= 0) {
-		user_param->cycle_buffer = DEF_PAGE_SIZE;
-	}
+	page_size				= sysconf(_SC_PAGESIZE);
+	user_param->cycle_buffer		= (page_size > 0) ? page_size : DEF_PAGE_SIZE;
 
 	user_param->verb_type		= NORMAL_INTF;
 	user_param->is_exp_cq		= 0;
@@ -555,6 +1559,63 @@ static void init_perftest_params(struct perftest_parameters *user_param)
 	user_param->use_res_domain	= 0;
 	user_param->mr_per_qp		= 0;
 	user_param->dlid		= 0;
+	user_param->use_hugepages	= HUGEPAGE_OFF;
+	user_param->numa_mode		= NUMA_OFF;
+	user_param->numa_node		= -1;
+	user_param->numa_cpu		= -1;
+	user_param->working_set		= 0;
+	user_param->working_set_max	= 0;
+	user_param->access_pattern	= ACCESS_SEQ;
+	user_param->access_stride	= 1;
+	user_param->num_sge		= 1;
+	user_param->num_sge_max		= 0;
+	user_param->sge_spread		= SGE_SPREAD_LINE;
+	user_param->sge_layout_entries	= 0;
+	user_param->recv_batch		= 1;
+	user_param->num_devices		= 0;
+	user_param->incast		= 0;
+	user_param->incast_sockfd	= -1;
+	user_param->incast_ready_fd	= -1;
+	user_param->incast_go_fd	= -1;
+	user_param->num_servers		= 0;
+	user_param->fanout_same_buf	= 0;
+	user_param->ring_size		= 0;
+	user_param->ring_rank		= -1;
+	user_param->ring_send		= 0;
+	user_param->is_sweep		= 0;
+	memset(user_param->sweep, 0, sizeof(user_param->sweep));
+	user_param->autotune		= AUTOTUNE_OFF;
+	user_param->tune_p99		= 0;
+	memset(&user_param->results, 0, sizeof(user_param->results));
+	user_param->load_lat_steps	= 0;
+	user_param->qd			= 1;
+	user_param->qd_samples		= 0;
+	user_param->contention_levels	= 0;
+	user_param->cas_retry		= 0;
+	user_param->ud_dests		= 0;
+	user_param->ud_dest_random	= 0;
+	for (i = 0; i < RESULTS_METRICS; i++)
+		user_param->results.tol[i] = RESULTS_DEF_TOL;
+	user_param->adaptive		= 0;
+	user_param->target_time_ms	= 0;
+	user_param->target_ci		= 0;
+	user_param->achieved_ci		= 0;
+	user_param->repeat		= 1;
+	user_param->repeat_ci		= 0;
+	memset(&user_param->repeat_stats, 0, sizeof(user_param->repeat_stats));
+	user_param->warmup_tol		= 0;
+	user_param->warmup_ms		= 0;
+	user_param->warmup_stable	= 0;
+	user_param->cycles_per_sec	= 0;
+	user_param->timer_deadline	= TIMER_NEVER;
+	memset(&user_param->alive, 0, sizeof(user_param->alive));
+	user_param->alive.deadline	= TIMER_NEVER;
+	user_param->event_spin		= -1;
+	user_param->event_spin_cycles	= 0;
+	user_param->event_wakeups	= 0;
+	user_param->event_start		= 0;
+	user_param->cq_moderation_count	= 0;
+	user_param->cq_moderation_period	= 0;
 }
 
 /******************************************************************************
@@ -652,6 +1713,89 @@ int set_eth_mtu(struct perftest_parameters *user_param)
  ******************************************************************************/
 static void force_dependecies(struct perftest_parameters *user_param)
 {
+	int i;
+
+	/* Autotune searches a sweep grid, the dimensions not given go up to the options. */
+	if (user_param->autotune) {
+		uint64_t tx_depth = (user_param->tx_depth > user_param->iters) ? user_param->iters : user_param->tx_depth;
+
+		if (user_param->sweep[SWEEP_SIZE].count > 1) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Autotune runs on a single message size\n");
+			exit(1);
+		}
+
+		if (!user_param->sweep[SWEEP_QPS].count)
+			fill_doubling(&user_param->sweep[SWEEP_QPS], 1, user_param->num_of_qps);
+		if (!user_param->sweep[SWEEP_TX_DEPTH].count)
+			fill_doubling(&user_param->sweep[SWEEP_TX_DEPTH], (tx_depth < AUTOTUNE_MIN_TX) ? tx_depth : AUTOTUNE_MIN_TX, tx_depth);
+		if (!user_param->sweep[SWEEP_POST_LIST].count)
+			fill_doubling(&user_param->sweep[SWEEP_POST_LIST], 1, (user_param->post_list > 1) ? user_param->post_list :
+				((tx_depth < AUTOTUNE_MAX_POST_LIST) ? tx_depth : AUTOTUNE_MAX_POST_LIST));
+		if (!user_param->sweep[SWEEP_CQ_MOD].count)
+			fill_doubling(&user_param->sweep[SWEEP_CQ_MOD], 1, (user_param->cq_mod > tx_depth) ? tx_depth : user_param->cq_mod);
+
+		user_param->is_sweep = 1;
+		user_param->noPeak = ON;
+	}
+
+	/* The QPs, MRs and CQs of a sweep are created for its largest point. */
+	if (user_param->is_sweep) {
+		uint64_t cur[SWEEP_PARAMS],max[SWEEP_PARAMS];
+		const uint64_t min_val[SWEEP_PARAMS] = {1, MIN_QP_NUM, MIN_TX, 1, MIN_CQ_MOD};
+		const uint64_t max_val[SWEEP_PARAMS] = {UINT_MAX / 2, MAX_QP_NUM, MAX_TX, MAX_TX, MAX_CQ_MOD};
+		int p;
+
+		if (user_param->tst != BW || (user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex ||
+			user_param->test_method != RUN_REGULAR || user_param->test_type == DURATION || user_param->dualport ||
+			user_param->use_xrc || user_param->connection_type == DC || user_param->num_servers > 1 ||
+			user_param->working_set || user_param->num_sge > 1 || user_param->size_dist.type != SIZE_DIST_NONE ||
+			user_param->mix.total_weight) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Sweeps and autotune are supported in unidirectional write and read BW iteration tests without -a, -D, -O, XRC/DC,\n");
+			fprintf(stderr," fan-out, working set, multiple SGEs, size distribution or a verb mix\n");
+			exit(1);
+		}
+
+		cur[SWEEP_SIZE] = user_param->size;
+		cur[SWEEP_QPS] = user_param->num_of_qps;
+		cur[SWEEP_TX_DEPTH] = (user_param->tx_depth > user_param->iters) ? user_param->iters : user_param->tx_depth;
+		cur[SWEEP_POST_LIST] = user_param->post_list;
+		cur[SWEEP_CQ_MOD] = user_param->cq_mod;
+
+		for (p = 0; p < SWEEP_PARAMS; p++) {
+			/* A parameter that is not swept keeps its single value. */
+			if (!user_param->sweep[p].count) {
+				user_param->sweep[p].val[0] = cur[p];
+				user_param->sweep[p].count = 1;
+			}
+
+			max[p] = 0;
+			for (i = 0; i < user_param->sweep[p].count; i++) {
+				if (user_param->sweep[p].val[i] < min_val[p] || user_param->sweep[p].val[i] > max_val[p]) {
+					printf(RESULT_LINE);
+					fprintf(stderr," Sweep value %lu is out of range [%lu, %lu]\n",
+						user_param->sweep[p].val[i], min_val[p], max_val[p]);
+					exit(1);
+				}
+				if (user_param->sweep[p].val[i] > max[p])
+					max[p] = user_param->sweep[p].val[i];
+			}
+		}
+
+		if (max[SWEEP_TX_DEPTH] > user_param->iters) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Swept tx_depth values must not exceed the number of iterations\n");
+			exit(1);
+		}
+
+		user_param->size = max[SWEEP_SIZE];
+		user_param->num_of_qps = max[SWEEP_QPS];
+		user_param->tx_depth = max[SWEEP_TX_DEPTH];
+		user_param->post_list = max[SWEEP_POST_LIST];
+		user_param->cq_mod = max[SWEEP_CQ_MOD];
+	}
+
 	/*Additional configuration and assignments.*/
 	if (user_param->test_type == ITERATIONS) {
 
@@ -684,346 +1828,745 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		user_param->size = DEF_SIZE_ATOMIC;
 	}
 
-	if (user_param->use_srq && user_param->verb != SEND) {
-		printf(RESULT_LINE);
-		printf(" Using SRQ only avavilible in SEND tests.\n");
-		exit (1);
+	if (user_param->use_srq && user_param->verb != SEND) {
+		printf(RESULT_LINE);
+		printf(" Using SRQ only avavilible in SEND tests.\n");
+		exit (1);
+	}
+
+	if (user_param->dualport == ON) {
+
+		user_param->num_of_qps *= 2;
+		if (user_param->tst != BW) {
+			printf(" Dual-port mode only supports BW tests.\n");
+			exit (1);
+		}
+
+		if (user_param->use_mcg){
+			printf(" Dual-port mode not supported in multicast feature\n");
+			exit (1);
+		}
+	}
+
+	if (user_param->post_list > 1) {
+		user_param->cq_mod = user_param->post_list;
+		printf(RESULT_LINE);
+		printf("Post List requested - CQ moderation will be the size of the post list\n");
+	}
+
+	if (user_param->test_type==DURATION) {
+
+		/* When working with Duration, iters=0 helps us to satisfy loop cond. in run_iter_bw.
+		We also use it for "global" counter of packets.
+		*/
+		user_param->iters = 0;
+		user_param->noPeak = ON;
+
+		if (user_param->use_event) {
+			printf(RESULT_LINE);
+			fprintf(stderr,"Duration mode doesn't work with events.\n");
+			exit(1);
+		}
+
+		if (user_param->test_method == RUN_ALL) {
+			printf(RESULT_LINE);
+			fprintf(stderr, "Duration mode currently doesn't support running on all sizes.\n");
+			exit(1);
+		}
+		if (user_param->cpu_util) {
+			user_param->cpu_util_data.enable = 1;
+		}
+	}
+
+	if ( (user_param->test_type != DURATION) && user_param->cpu_util ) {
+		printf(RESULT_LINE);
+		fprintf(stderr, " CPU Utilization works only with Duration mode.\n");
+	}
+
+	if (user_param->use_mcg &&  user_param->gid_index == -1) {
+		user_param->gid_index = 0;
+	}
+
+
+	if (user_param->verb == ATOMIC && user_param->connection_type == DC) {
+		printf(RESULT_LINE);
+		fprintf(stderr, " ATOMIC tests don't support DC transport\n");
+		exit(1);
+	}
+
+	if (user_param->work_rdma_cm) {
+
+		if (user_param->connection_type == UC) {
+			printf(RESULT_LINE);
+			printf(" UC is not supported in librdmacm\n");
+			exit(1);
+		}
+
+		if (user_param->use_mcg) {
+			printf(RESULT_LINE);
+			printf(" Perftest still doesn't support Multicast with rdma_cm\n");
+			exit(1);
+		}
+
+		if (user_param->dualport) {
+			printf(RESULT_LINE);
+			printf(" Perftest still doesn't support Dual Port with rdma_cm\n");
+			exit(1);
+		}
+
+		if (user_param->num_of_qps > 1) {
+			printf(RESULT_LINE);
+			fprintf(stdout," Perftest only supports 1 rmda_cm QP for now\n");
+			exit(1);
+		}
+		user_param->use_rdma_cm = ON;
+
+	} else if (user_param->tos != DEF_TOS && user_param->connection_type != RawEth) {
+		fprintf(stdout," TOS only valid for rdma_cm based QP and RawEth QP \n");
+		exit(1);
+	}
+
+	if (user_param->use_mcg) {
+
+		if (user_param->connection_type != UD)
+			user_param->connection_type = UD;
+
+		if (user_param->duplex) {
+			fprintf(stdout,"Bidirectional mode not supported in multicast\n");
+			exit (1);
+		}
+
+		if (user_param->num_of_qps > 1) {
+			fprintf(stdout,"Only 1 QP supported in multicast\n");
+			exit(1);
+		}
+	}
+
+	if(user_param->verb == ATOMIC && user_param->use_odp) {
+		printf(RESULT_LINE);
+		fprintf(stderr," ODP does not support ATOMICS for now\n");
+		exit(1);
+	}
+	if (user_param->connection_type == RawEth) {
+
+		if (user_param->test_method == RUN_ALL) {
+			fprintf(stderr, "Raw Ethernet tests do not support -a / --all flag.\n");
+			exit(1);
+		}
+
+		if (user_param->num_of_qps > 1 && !user_param->use_rss) {
+			printf(RESULT_LINE);
+			fprintf(stdout," Raw Ethernet test supports only 1 QP for now\n");
+			exit(1);
+		}
+
+		if(user_param->machine == UNCHOSEN) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Invalid Command line.\n you must choose test side --client or --server\n");
+			exit(1);
+		}
+
+		if(user_param->machine == CLIENT && user_param->is_dest_mac == OFF && !user_param->raw_mcast) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Invalid Command line.\n you must enter dest mac by this format -E XX:XX:XX:XX:XX:XX\n");
+			exit(1);
+		}
+
+		if((user_param->is_server_port == ON && user_param->is_client_port == OFF) || (user_param->is_server_port == OFF && user_param->is_client_port == ON)) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Invalid Command line.\n if you would like to send UDP header,\n you must enter server&client port --server_port X --client_port X\n");
+			exit(1);
+		}
+
+		if ((user_param->is_server_port == ON) && (user_param->is_server_ip == OFF || user_param->is_client_ip == OFF)) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Invalid Command line.\nPlease provide source_ip and/or dest_ip when using UDP\n");
+			exit(1);
+		}
+		//UDP packet is ok by now. check tcp flag
+		if (user_param->tcp == ON && user_param->is_server_port == OFF) {
+			printf(RESULT_LINE);
+			fprintf(stderr,"Invalid Command line.\nPlease provide UDP information (IP & UDP Port src/dest) in order to use TCP\n");
+			exit(1);
+		}
+
+		/* Mac forwarding dependencies */
+		if (user_param->duplex == OFF && user_param->mac_fwd == ON) {
+			printf("mac_fwd should run in duplex mode only. changing to duplex mode.\n");
+			user_param->duplex = ON;
+		}
+		if (user_param->mac_fwd == ON && user_param->cq_mod >= user_param->rx_depth) {
+			fprintf(stderr," CQ moderation can't be grater than rx depth.\n");
+			user_param->cq_mod = user_param->rx_depth < user_param->tx_depth ? user_param->rx_depth : user_param->tx_depth;
+			fprintf(stderr," Changing CQ moderation to min( rx depth , tx depth) = %d.\n",user_param->cq_mod);
+		}
+
+		if (user_param->raw_mcast && user_param->duplex) {
+			printf(" Multicast feature works on unidirectional traffic only\n");
+			exit(1);
+		}
+
+	}
+
+	if (user_param->verb == SEND && user_param->tst == BW && user_param->machine == SERVER && !user_param->duplex )
+		user_param->noPeak = ON;
+
+	/* Run infinitely dependencies */
+	if (user_param->test_method == RUN_INFINITELY) {
+		user_param->noPeak = ON;
+		user_param->test_type = DURATION;
+		if (user_param->use_event) {
+			printf(RESULT_LINE);
+			fprintf(stderr," run_infinitely does not support events feature yet.\n");
+			exit(1);
+		}
+
+		if (user_param->tst == LAT) {
+			printf(RESULT_LINE);
+			fprintf(stderr," run_infinitely exists only in BW tests for now.\n");
+			exit(1);
+
+		}
+
+		if (user_param->duplex && user_param->verb == SEND) {
+			printf(RESULT_LINE);
+			fprintf(stderr," run_infinitely not supported in SEND Bidirectional BW test\n");
+			exit(1);
+		}
+	}
+
+	/*raw ethernet send latency
+	client and server must enter the destination mac
+	*/
+	if (user_param->connection_type == RawEth && user_param->tst == LAT && user_param->verb == SEND) {
+
+		if (user_param-> is_dest_mac == OFF) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Invalid Command line.\n you must enter dest mac by this format -E XX:XX:XX:XX:XX:XX\n");
+			exit(1);
+		}
+
 	}
 
-	if (user_param->dualport == ON) {
+	if (user_param->connection_type == DC && !user_param->use_srq)
+		user_param->use_srq = 1;
 
-		user_param->num_of_qps *= 2;
-		if (user_param->tst != BW) {
-			printf(" Dual-port mode only supports BW tests.\n");
-			exit (1);
+	/* XRC Part */
+	if (user_param->connection_type == XRC) {
+		if (user_param->work_rdma_cm == ON) {
+			printf(RESULT_LINE);
+			fprintf(stderr," XRC does not support RDMA_CM\n");
+			exit(1);
 		}
 
-		if (user_param->use_mcg){
-			printf(" Dual-port mode not supported in multicast feature\n");
-			exit (1);
+		user_param->use_xrc = ON;
+		user_param->use_srq = ON;
+	}
+
+	if(user_param->connection_type == DC) {
+		if (user_param->work_rdma_cm == ON) {
+			printf(RESULT_LINE);
+			fprintf(stderr," DC does not support RDMA_CM\n");
+			exit(1);
 		}
 	}
 
-	if (user_param->post_list > 1) {
-		user_param->cq_mod = user_param->post_list;
+	#ifndef HAVE_RSS_EXP
+	if (user_param->use_rss) {
 		printf(RESULT_LINE);
-		printf("Post List requested - CQ moderation will be the size of the post list\n");
+		fprintf(stderr," RSS feature is not available in libibverbs\n");
+		exit(1);
 	}
+	#endif
 
-	if (user_param->test_type==DURATION) {
+	if ((user_param->use_srq && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex == ON)) || user_param->use_xrc)
+		user_param->srq_exists = 1;
 
-		/* When working with Duration, iters=0 helps us to satisfy loop cond. in run_iter_bw.
-		We also use it for "global" counter of packets.
-		*/
-		user_param->iters = 0;
-		user_param->noPeak = ON;
+	if (user_param->burst_size > 0) {
+		if (user_param->is_rate_limiting == 0) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Can't enable burst mode when rate limiter is off\n");
+			exit(1);
+		}
+	}
 
-		if (user_param->use_event) {
+	if (user_param->is_rate_limiting == 1) {
+		if (user_param->tst != BW || user_param->verb == ATOMIC || (user_param->verb == SEND && user_param->duplex)) {
 			printf(RESULT_LINE);
-			fprintf(stderr,"Duration mode doesn't work with events.\n");
+			fprintf(stderr," Rate limiter cann't be executed on non-BW, ATOMIC or bidirectional SEND tests\n");
 			exit(1);
 		}
 
-		if (user_param->test_method == RUN_ALL) {
+		if (user_param->burst_size <= 0) {
 			printf(RESULT_LINE);
-			fprintf(stderr, "Duration mode currently doesn't support running on all sizes.\n");
+			fprintf(stderr," Setting burst size to tx depth = %d\n",user_param->tx_depth);
+			user_param->burst_size = user_param->tx_depth;
+		}
+	}
+
+	if (user_param->output != -1) {
+		if (user_param->tst == BW && !(user_param->output == OUTPUT_BW || user_param->output == OUTPUT_MR)) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Output verbosity level for BW can be: bandwidth, message_rate\n");
 			exit(1);
 		}
-		if (user_param->cpu_util) {
-			user_param->cpu_util_data.enable = 1;
+
+		if (user_param->tst == LAT && !(user_param->output == OUTPUT_LAT)) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Output verbosity level for LAT can be: latency\n");
+			exit(1);
 		}
 	}
 
-	if ( (user_param->test_type != DURATION) && user_param->cpu_util ) {
+	if ( (user_param->latency_gap > 0) && user_param->tst != LAT ) {
 		printf(RESULT_LINE);
-		fprintf(stderr, " CPU Utilization works only with Duration mode.\n");
+		fprintf(stderr," Latency gap feature is only for latency tests\n");
+		exit(1);
 	}
 
-	if (user_param->use_mcg &&  user_param->gid_index == -1) {
-		user_param->gid_index = 0;
+	if ( user_param->test_type == DURATION && user_param->margin == DEF_INIT_MARGIN) {
+		user_param->margin = user_param->duration / 4;
+	}
+
+	#if defined(HAVE_VERBS_EXP) && defined(HAVE_DC)
+	if (user_param->connection_type == DC) {
+		user_param->use_exp = 1;
 	}
+	#endif
 
+	#ifdef HAVE_CUDA
+	if (user_param->use_cuda) {
+		if (user_param->tst != BW) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Perftest supports CUDA only in BW tests\n");
+			exit(1);
+		}
+	}
 
-	if (user_param->verb == ATOMIC && user_param->connection_type == DC) {
+	if (user_param->use_cuda && user_param->mmap_file != NULL) {
 		printf(RESULT_LINE);
-		fprintf(stderr, " ATOMIC tests don't support DC transport\n");
+		fprintf(stderr,"You cannot use CUDA and an mmap'd file at the same time\n");
 		exit(1);
 	}
 
-	if (user_param->work_rdma_cm) {
+	if (user_param->use_cuda && user_param->use_hugepages != HUGEPAGE_OFF) {
+		printf(RESULT_LINE);
+		fprintf(stderr,"You cannot use CUDA and hugepages at the same time\n");
+		exit(1);
+	}
+	#endif
 
-		if (user_param->connection_type == UC) {
+	if (user_param->working_set) {
+		if (user_param->tst != BW || user_param->connection_type == RawEth || user_param->mac_fwd) {
 			printf(RESULT_LINE);
-			printf(" UC is not supported in librdmacm\n");
+			fprintf(stderr," Working set is supported only in BW tests (not Raw Ethernet)\n");
 			exit(1);
 		}
 
-		if (user_param->use_mcg) {
+		if (user_param->post_list > 1 || user_param->test_method == RUN_INFINITELY) {
 			printf(RESULT_LINE);
-			printf(" Perftest still doesn't support Multicast with rdma_cm\n");
+			fprintf(stderr," Working set is not supported with post list or run_infinitely\n");
 			exit(1);
 		}
 
-		if (user_param->dualport) {
+		if (user_param->working_set_max && (user_param->test_method == RUN_ALL || user_param->duplex)) {
 			printf(RESULT_LINE);
-			printf(" Perftest still doesn't support Dual Port with rdma_cm\n");
+			fprintf(stderr," Working set sweep is not supported with -a or bidirectional tests\n");
 			exit(1);
 		}
 
-		if (user_param->num_of_qps > 1) {
+		if (user_param->working_set_max && user_param->verb != WRITE && user_param->verb != READ) {
 			printf(RESULT_LINE);
-			fprintf(stdout," Perftest only supports 1 rmda_cm QP for now\n");
+			fprintf(stderr," Working set sweep is supported only in write and read BW tests\n");
 			exit(1);
 		}
-		user_param->use_rdma_cm = ON;
 
-	} else if (user_param->tos != DEF_TOS && user_param->connection_type != RawEth) {
-		fprintf(stdout," TOS only valid for rdma_cm based QP and RawEth QP \n");
-		exit(1);
+		if (user_param->working_set < user_param->size && user_param->test_method != RUN_ALL) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Working set must be at least the message size\n");
+			exit(1);
+		}
 	}
 
-	if (user_param->use_mcg) {
-
-		if (user_param->connection_type != UD)
-			user_param->connection_type = UD;
-
-		if (user_param->duplex) {
-			fprintf(stdout,"Bidirectional mode not supported in multicast\n");
-			exit (1);
+	if (user_param->size_dist.type != SIZE_DIST_NONE) {
+		if (user_param->test_method == RUN_ALL || user_param->verb == ATOMIC ||
+			user_param->connection_type == RawEth || user_param->mac_fwd) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Size distribution is not supported with -a, atomics or Raw Ethernet\n");
+			exit(1);
 		}
 
-		if (user_param->num_of_qps > 1) {
-			fprintf(stdout,"Only 1 QP supported in multicast\n");
+		/* The write latency test polls on the last byte of a fixed size message. */
+		if (user_param->tst == LAT && user_param->verb == WRITE) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Size distribution is not supported in write latency test\n");
 			exit(1);
 		}
-	}
 
-	if(user_param->verb == ATOMIC && user_param->use_odp) {
-		printf(RESULT_LINE);
-		fprintf(stderr," ODP does not support ATOMICS for now\n");
-		exit(1);
+		/* Buffers and inline decisions are made for the largest message. */
+		user_param->size = user_param->size_dist.max_size;
 	}
-	if (user_param->connection_type == RawEth) {
 
-		if (user_param->test_method == RUN_ALL) {
-			fprintf(stderr, "Raw Ethernet tests do not support -a / --all flag.\n");
+	if (user_param->sge_layout_entries) {
+		if (user_param->num_sge > 1 && user_param->num_sge != user_param->sge_layout_entries) {
+			printf(RESULT_LINE);
+			fprintf(stderr," --sge and the number of entries in --sge_layout differ\n");
 			exit(1);
 		}
 
-		if (user_param->num_of_qps > 1 && !user_param->use_rss) {
+		if (user_param->num_sge_max) {
 			printf(RESULT_LINE);
-			fprintf(stdout," Raw Ethernet test supports only 1 QP for now\n");
+			fprintf(stderr," SGE sweep splits the message evenly, --sge_layout cannot be used\n");
 			exit(1);
 		}
 
-		if(user_param->machine == UNCHOSEN) {
+		user_param->num_sge = user_param->sge_layout_entries;
+		user_param->size = 0;
+		for (i = 0; i < user_param->sge_layout_entries; i++)
+			user_param->size += user_param->sge_layout[i];
+	}
+
+	if (user_param->num_sge > 1 || user_param->num_sge_max) {
+		if (user_param->tst != BW || user_param->verb == ATOMIC ||
+			(user_param->connection_type != RC && user_param->connection_type != UC)) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Invalid Command line.\n you must choose test side --client or --server\n");
+			fprintf(stderr," Multiple SGEs are supported in send, write and read BW tests over RC/UC\n");
 			exit(1);
 		}
 
-		if(user_param->machine == CLIENT && user_param->is_dest_mac == OFF && !user_param->raw_mcast) {
+		/* Each QP has a single WR with its own gather list, which stays in place. */
+		if (user_param->post_list > 1 || user_param->test_method == RUN_ALL || user_param->working_set ||
+			user_param->size_dist.type != SIZE_DIST_NONE || user_param->verb_type != NORMAL_INTF) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Invalid Command line.\n you must enter dest mac by this format -E XX:XX:XX:XX:XX:XX\n");
+			fprintf(stderr," Multiple SGEs are not supported with post list, -a, working set, size distribution or accelerated verbs\n");
 			exit(1);
 		}
 
-		if((user_param->is_server_port == ON && user_param->is_client_port == OFF) || (user_param->is_server_port == OFF && user_param->is_client_port == ON)) {
+		if (user_param->num_sge_max && (user_param->verb == SEND || user_param->duplex)) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Invalid Command line.\n if you would like to send UDP header,\n you must enter server&client port --server_port X --client_port X\n");
+			fprintf(stderr," SGE sweep is supported only in unidirectional write and read tests\n");
 			exit(1);
 		}
 
-		if ((user_param->is_server_port == ON) && (user_param->is_server_ip == OFF || user_param->is_client_ip == OFF)) {
+		if ((uint64_t)(user_param->num_sge_max ? user_param->num_sge_max : user_param->num_sge) > user_param->size) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Invalid Command line.\nPlease provide source_ip and/or dest_ip when using UDP\n");
+			fprintf(stderr," Message size must be at least the number of SGEs\n");
 			exit(1);
 		}
-		//UDP packet is ok by now. check tcp flag
-		if (user_param->tcp == ON && user_param->is_server_port == OFF) {
+	}
+
+	/* QP caps and gather lists are sized for the largest SGE count. */
+	if (!user_param->num_sge_max)
+		user_param->num_sge_max = user_param->num_sge;
+
+	if (user_param->event_spin >= 0) {
+		if (user_param->duplex || (user_param->tst == LAT && user_param->verb == WRITE) ||
+			user_param->verb_type != NORMAL_INTF || user_param->connection_type == RawEth) {
 			printf(RESULT_LINE);
-			fprintf(stderr,"Invalid Command line.\nPlease provide UDP information (IP & UDP Port src/dest) in order to use TCP\n");
+			fprintf(stderr," Hybrid event mode is not supported in bidirectional, write latency, Raw Ethernet or accelerated verbs tests\n");
 			exit(1);
 		}
+	}
 
-		/* Mac forwarding dependencies */
-		if (user_param->duplex == OFF && user_param->mac_fwd == ON) {
-			printf("mac_fwd should run in duplex mode only. changing to duplex mode.\n");
-			user_param->duplex = ON;
+	if (user_param->mix.total_weight) {
+		if (user_param->verb != SEND || user_param->tst != BW) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Verb mix is supported only in ib_send_bw\n");
+			exit(1);
 		}
-		if (user_param->mac_fwd == ON && user_param->cq_mod >= user_param->rx_depth) {
-			fprintf(stderr," CQ moderation can't be grater than rx depth.\n");
-			user_param->cq_mod = user_param->rx_depth < user_param->tx_depth ? user_param->rx_depth : user_param->tx_depth;
-			fprintf(stderr," Changing CQ moderation to min( rx depth , tx depth) = %d.\n",user_param->cq_mod);
+
+		if (user_param->connection_type != RC) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Verb mix requires RC QPs\n");
+			exit(1);
 		}
 
-		if (user_param->raw_mcast && user_param->duplex) {
-			printf(" Multicast feature works on unidirectional traffic only\n");
+		/* The verb of a message slot is set on a single reused WR. */
+		if (user_param->duplex || user_param->test_method != RUN_REGULAR || user_param->post_list != 1 ||
+			user_param->use_exp || user_param->verb_type != NORMAL_INTF || user_param->use_res_domain) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Verb mix is not supported with duplex, -a, run_infinitely, post_list or exp verbs\n");
 			exit(1);
 		}
 
+		/* The server only sees the sends; count the ones among the client's iterations. */
+		if (user_param->machine == SERVER) {
+			if (user_param->test_type == ITERATIONS) {
+				for (i = 0; i < MIX_RING_LEN; i++) {
+					if (user_param->mix.ring[i] == SEND)
+						user_param->mix.msgs[SEND] += user_param->iters / MIX_RING_LEN +
+							((uint64_t)i < user_param->iters % MIX_RING_LEN);
+				}
+
+				if (user_param->mix.msgs[SEND])
+					user_param->iters = user_param->mix.msgs[SEND];
+			} else {
+				user_param->mix.msgs[SEND] = user_param->mix.weights[SEND];
+			}
+		}
+	}
+
+	if (user_param->mmap_file != NULL && user_param->use_hugepages != HUGEPAGE_OFF) {
+		printf(RESULT_LINE);
+		fprintf(stderr,"You cannot use an mmap'd file and hugepages at the same time\n");
+		exit(1);
 	}
 
-	if (user_param->verb == SEND && user_param->tst == BW && user_param->machine == SERVER && !user_param->duplex )
-		user_param->noPeak = ON;
+	#ifdef HAVE_ODP
+	if (user_param->use_odp && user_param->use_hugepages != HUGEPAGE_OFF) {
+		printf(RESULT_LINE);
+		fprintf(stderr," Hugepages are not supported with ODP\n");
+		exit(1);
+	}
+	#endif
 
-	/* Run infinitely dependencies */
-	if (user_param->test_method == RUN_INFINITELY) {
+	if ( (user_param->connection_type == UD) && (user_param->inline_size > MAX_INLINE_UD) ) {
+		printf(RESULT_LINE);
+		fprintf(stderr, "Setting inline size to %d (Max inline size in UD)\n",MAX_INLINE_UD);
+		user_param->inline_size = MAX_INLINE_UD;
+	}
+
+	if (user_param->report_per_port && (user_param->test_type != DURATION || !user_param->dualport)) {
+		printf(RESULT_LINE);
+		fprintf(stderr, "report per port feature work only with Duration and Dualport\n");
+		exit(1);
+	}
+
+	/* WA for a bug when rx_depth is odd in SEND */
+	if (user_param->verb == SEND && (user_param->rx_depth % 2 == 1) && user_param->test_method == RUN_REGULAR)
+		user_param->rx_depth += 1;
+
+	if (user_param->test_type == ITERATIONS && user_param->iters > 20000 && user_param->noPeak == OFF && user_param->tst == BW)
 		user_param->noPeak = ON;
-		user_param->test_type = DURATION;
-		if (user_param->use_event) {
+
+	if (user_param->num_devices > 1) {
+		if (user_param->tst != BW || user_param->test_method == RUN_INFINITELY || user_param->dualport ||
+			user_param->use_rdma_cm || user_param->work_rdma_cm || user_param->output != FULL_VERBOSITY) {
 			printf(RESULT_LINE);
-			fprintf(stderr," run_infinitely does not support events feature yet.\n");
+			fprintf(stderr," Multiple devices are supported only in BW tests without run_infinitely, dualport, rdma_cm or --output\n");
 			exit(1);
 		}
-
-		if (user_param->tst == LAT) {
+		/* Every device process would write the same results file. */
+		if (user_param->results.file || user_param->results.baseline) {
 			printf(RESULT_LINE);
-			fprintf(stderr," run_infinitely exists only in BW tests for now.\n");
+			fprintf(stderr," --results and --compare are not supported with --devices\n");
 			exit(1);
+		}
+	}
 
+	if (user_param->incast > 1) {
+		if (user_param->servername) {
+			printf(RESULT_LINE);
+			fprintf(stderr," --incast is a server side option, clients connect as usual\n");
+			exit(1);
+		}
+		if (user_param->tst != BW || user_param->test_method == RUN_INFINITELY || user_param->num_devices > 1 ||
+			user_param->use_rdma_cm || user_param->work_rdma_cm || user_param->output != FULL_VERBOSITY) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Incast is supported only in BW tests without run_infinitely, --devices, rdma_cm or --output\n");
+			exit(1);
 		}
+		/* Every client process would write the same results file. */
+		if (user_param->results.file || user_param->results.baseline) {
+			printf(RESULT_LINE);
+			fprintf(stderr," --results and --compare are not supported with --incast\n");
+			exit(1);
+		}
+	}
 
-		if (user_param->duplex && user_param->verb == SEND) {
+	if (user_param->num_servers > 1) {
+		if (user_param->servername != user_param->fanout[0].host) {
 			printf(RESULT_LINE);
-			fprintf(stderr," run_infinitely not supported in SEND Bidirectional BW test\n");
+			fprintf(stderr," Don't give a server name together with --fanout\n");
+			exit(1);
+		}
+		if (user_param->verb != WRITE || user_param->tst != BW || user_param->duplex || user_param->dualport ||
+			user_param->test_method == RUN_INFINITELY || user_param->use_rdma_cm || user_param->work_rdma_cm ||
+			user_param->use_xrc || user_param->connection_type == DC || user_param->mix.total_weight) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Fan-out is supported only in unidirectional ib_write_bw without run_infinitely, dualport, rdma_cm, XRC/DC or a verb mix\n");
 			exit(1);
 		}
 	}
 
-	/*raw ethernet send latency
-	client and server must enter the destination mac
-	*/
-	if (user_param->connection_type == RawEth && user_param->tst == LAT && user_param->verb == SEND) {
+	if (user_param->fanout_same_buf && (user_param->num_servers < 2 || user_param->mr_per_qp)) {
+		printf(RESULT_LINE);
+		fprintf(stderr," --fanout_same_buf needs --fanout with 2 servers or more and no --mr_per_qp\n");
+		exit(1);
+	}
 
-		if (user_param-> is_dest_mac == OFF) {
+	if (user_param->is_collective) {
+		if (!user_param->ring_size || user_param->ring_rank < 0 || user_param->ring_rank >= user_param->ring_size) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Please give all the ranks with --ring and this rank with --rank\n");
+			exit(1);
+		}
+		if (user_param->servername != NULL || user_param->use_rdma_cm || user_param->work_rdma_cm || user_param->duplex ||
+			user_param->dualport || user_param->connection_type != RC || user_param->test_type == DURATION ||
+			user_param->test_method == RUN_INFINITELY || user_param->mr_per_qp || user_param->use_srq) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Invalid Command line.\n you must enter dest mac by this format -E XX:XX:XX:XX:XX:XX\n");
+			fprintf(stderr," ib_allreduce_bw runs iterations over RC, without a server name, rdma_cm, -b, -O, -D, --run_infinitely, --mr_per_qp or --use_srq\n");
 			exit(1);
 		}
-
+		if (user_param->results.file || user_param->results.baseline) {
+			printf(RESULT_LINE);
+			fprintf(stderr," ib_allreduce_bw prints its own rows, --results and --compare are not supported\n");
+			exit(1);
+		}
+		if (user_param->size < 4 * user_param->ring_size || user_param->size % 4) {
+			printf(RESULT_LINE);
+			fprintf(stderr," The message size is a vector of floats and needs at least one float per rank\n");
+			exit(1);
+		}
+	} else if (user_param->ring_size || user_param->ring_send) {
+		printf(RESULT_LINE);
+		fprintf(stderr," --ring, --rank and --ring_send are supported only in ib_allreduce_bw\n");
+		exit(1);
 	}
 
-	if (user_param->connection_type == DC && !user_param->use_srq)
-		user_param->use_srq = 1;
-
-	/* XRC Part */
-	if (user_param->connection_type == XRC) {
-		if (user_param->work_rdma_cm == ON) {
+	if (user_param->target_time_ms || user_param->target_ci > 0) {
+		if (user_param->tst != BW || (user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex ||
+			user_param->test_type == DURATION || user_param->test_method == RUN_INFINITELY || user_param->working_set_max ||
+			user_param->num_sge_max > user_param->num_sge || user_param->size_dist.type != SIZE_DIST_NONE ||
+			user_param->mix.total_weight || user_param->num_servers > 1) {
 			printf(RESULT_LINE);
-			fprintf(stderr," XRC does not support RDMA_CM\n");
+			fprintf(stderr," Adaptive iterations are supported in unidirectional write and read BW tests without -D, run_infinitely,\n");
+			fprintf(stderr," working set or SGE sweeps, size distribution, a verb mix or fan-out\n");
 			exit(1);
 		}
 
-		user_param->use_xrc = ON;
-		user_param->use_srq = ON;
+		/* Chunks are timed as a whole, a peak over one chunk means little. */
+		user_param->adaptive = ON;
+		user_param->noPeak = ON;
 	}
 
-	if(user_param->connection_type == DC) {
-		if (user_param->work_rdma_cm == ON) {
+	if (user_param->repeat > 1) {
+		if ((user_param->tst == BW && ((user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex)) ||
+			(user_param->tst == LAT && user_param->verb == ATOMIC) || user_param->connection_type == RawEth ||
+			user_param->test_method != RUN_REGULAR || user_param->test_type == DURATION || user_param->is_sweep ||
+			user_param->working_set_max || user_param->num_sge_max > user_param->num_sge) {
 			printf(RESULT_LINE);
-			fprintf(stderr," DC does not support RDMA_CM\n");
+			fprintf(stderr," Trials are supported in unidirectional write and read BW tests and in send, write and read latency\n");
+			fprintf(stderr," tests, with iterations on a single size and no sweeps\n");
 			exit(1);
 		}
-	}
-
-	#ifndef HAVE_RSS_EXP
-	if (user_param->use_rss) {
+	} else if (user_param->repeat_ci > 0) {
 		printf(RESULT_LINE);
-		fprintf(stderr," RSS feature is not available in libibverbs\n");
+		fprintf(stderr," --repeat_ci needs --repeat\n");
 		exit(1);
 	}
-	#endif
-
-	if ((user_param->use_srq && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex == ON)) || user_param->use_xrc)
-		user_param->srq_exists = 1;
 
-	if (user_param->burst_size > 0) {
-		if (user_param->is_rate_limiting == 0) {
+	if (user_param->warmup_tol > 0) {
+		if (user_param->tst != BW || user_param->verb == SEND || user_param->mix.weights[SEND] ||
+			user_param->test_method == RUN_INFINITELY ||
+			(user_param->connection_type != RC && user_param->connection_type != UC)) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Can't enable burst mode when rate limiter is off\n");
+			fprintf(stderr," Steady state warm-up is supported in write, read and atomic BW tests over RC/UC without run_infinitely\n");
 			exit(1);
 		}
 	}
 
-	if (user_param->is_rate_limiting == 1) {
-		if (user_param->tst != BW || user_param->verb == ATOMIC || (user_param->verb == SEND && user_param->duplex)) {
+	if (user_param->qd > 1) {
+		if (user_param->tst != LAT || user_param->connection_type != RC || user_param->test_type == DURATION ||
+			user_param->num_of_qps > 1 || user_param->use_event || user_param->event_spin >= 0 ||
+			user_param->latency_gap || user_param->size_dist.type != SIZE_DIST_NONE || user_param->recv_batch > 1 ||
+			user_param->num_sge_max > 1 || user_param->working_set) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Rate limiter cann't be executed on non-BW, ATOMIC or bidirectional SEND tests\n");
+			fprintf(stderr," Queue depth above 1 runs in RC latency iteration tests over one QP, without -D, events, latency gap,\n");
+			fprintf(stderr," size distribution, receive batching, scatter/gather lists or a working set\n");
 			exit(1);
 		}
 
-		if (user_param->burst_size <= 0) {
-			printf(RESULT_LINE);
-			fprintf(stderr," Setting burst size to tx depth = %d\n",user_param->tx_depth);
-			user_param->burst_size = user_param->tx_depth;
-		}
-	}
-
-	if (user_param->output != -1) {
-		if (user_param->tst == BW && !(user_param->output == OUTPUT_BW || user_param->output == OUTPUT_MR)) {
+		/* Every write slot is a region of the message size, -a would make them 8MB each. */
+		if (user_param->verb == WRITE && user_param->test_method == RUN_ALL) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Output verbosity level for BW can be: bandwidth, message_rate\n");
+			fprintf(stderr," Queue depth above 1 in write latency runs at one message size, without -a\n");
 			exit(1);
 		}
 
-		if (user_param->tst == LAT && !(user_param->output == OUTPUT_LAT)) {
+		if (user_param->qd >= user_param->iters) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Output verbosity level for LAT can be: latency\n");
+			fprintf(stderr," Queue depth (%d) must be below the number of iterations (%d)\n", user_param->qd, user_param->iters);
 			exit(1);
 		}
+
+		/* Every slot needs its own send WQE, and in SEND its own receive. */
+		if (user_param->tx_depth < user_param->qd)
+			user_param->tx_depth = user_param->qd;
+		if (user_param->verb == SEND && user_param->rx_depth < user_param->qd)
+			user_param->rx_depth = user_param->qd;
 	}
 
-	if ( (user_param->latency_gap > 0) && user_param->tst != LAT ) {
+	if (user_param->cas_retry && (!user_param->contention_levels || user_param->atomicType != CMP_AND_SWAP)) {
 		printf(RESULT_LINE);
-		fprintf(stderr," Latency gap feature is only for latency tests\n");
+		fprintf(stderr," --cas_retry needs --contention and -A CMP_AND_SWAP\n");
 		exit(1);
 	}
 
-	if ( user_param->test_type == DURATION && user_param->margin == DEF_INIT_MARGIN) {
-		user_param->margin = user_param->duration / 4;
-	}
-
-	#if defined(HAVE_VERBS_EXP) && defined(HAVE_DC)
-	if (user_param->connection_type == DC) {
-		user_param->use_exp = 1;
+	if (user_param->ud_dests) {
+		if (user_param->tst != BW || user_param->verb != SEND || user_param->connection_type != UD || user_param->duplex ||
+			user_param->test_type != DURATION || user_param->test_method == RUN_ALL || user_param->use_exp ||
+			user_param->work_rdma_cm || user_param->use_mcg || user_param->use_rss || user_param->verb_type != NORMAL_INTF ||
+			user_param->mix.total_weight || user_param->num_servers > 1) {
+			printf(RESULT_LINE);
+			fprintf(stderr," UD destination tables run in unidirectional UD send BW tests with -D, without -a, rdma_cm,\n");
+			fprintf(stderr," multicast, RSS, a verb mix, fan-out or the experimental or accelerated verbs\n");
+			exit(1);
+		}
 	}
-	#endif
 
-	#ifdef HAVE_CUDA
-	if (user_param->use_cuda) {
-		if (user_param->tst != BW) {
+	if (user_param->contention_levels) {
+		if (user_param->tst != BW || user_param->verb != ATOMIC || user_param->duplex ||
+			user_param->connection_type != RC || user_param->test_method != RUN_REGULAR || user_param->test_type == DURATION ||
+			user_param->post_list > 1 || user_param->is_rate_limiting || user_param->use_exp || user_param->work_rdma_cm) {
 			printf(RESULT_LINE);
-			fprintf(stderr," Perftest supports CUDA only in BW tests\n");
+			fprintf(stderr," Atomic contention runs in unidirectional RC iteration tests, without -D, run_infinitely,\n");
+			fprintf(stderr," rdma_cm, post lists, a rate limit or the experimental verbs\n");
 			exit(1);
 		}
-	}
 
-	if (user_param->use_cuda && user_param->mmap_file != NULL) {
-		printf(RESULT_LINE);
-		fprintf(stderr,"You cannot use CUDA and an mmap'd file at the same time\n");
-		exit(1);
+		/* Every operation is timed on its own. */
+		user_param->cq_mod = 1;
 	}
-	#endif
 
-	if ( (user_param->connection_type == UD) && (user_param->inline_size > MAX_INLINE_UD) ) {
-		printf(RESULT_LINE);
-		fprintf(stderr, "Setting inline size to %d (Max inline size in UD)\n",MAX_INLINE_UD);
-		user_param->inline_size = MAX_INLINE_UD;
+	if (user_param->load_lat_steps) {
+		if (user_param->tst != BW || (user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex ||
+			user_param->connection_type != RC || user_param->test_method != RUN_REGULAR || user_param->test_type == DURATION ||
+			user_param->is_sweep || user_param->repeat > 1 || user_param->adaptive || user_param->is_rate_limiting ||
+			user_param->num_servers > 1 || user_param->mix.total_weight || user_param->work_rdma_cm) {
+			printf(RESULT_LINE);
+			fprintf(stderr," The load-latency curve runs in unidirectional RC write and read BW iteration tests, without\n");
+			fprintf(stderr," -a, -D, rdma_cm, sweeps, trials, adaptive iterations, fan-out, a verb mix or a user rate limit\n");
+			exit(1);
+		}
+
+		/* The steps are timed as a whole, the probe gives the latency. */
+		user_param->noPeak = ON;
 	}
 
-	if (user_param->report_per_port && (user_param->test_type != DURATION || !user_param->dualport)) {
+	if (user_param->results.baseline && (user_param->is_sweep || user_param->test_method == RUN_INFINITELY)) {
 		printf(RESULT_LINE);
-		fprintf(stderr, "report per port feature work only with Duration and Dualport\n");
+		fprintf(stderr," --compare matches rows by message size, it can't be used with sweeps, autotune or run_infinitely\n");
 		exit(1);
 	}
 
-	/* WA for a bug when rx_depth is odd in SEND */
-	if (user_param->verb == SEND && (user_param->rx_depth % 2 == 1) && user_param->test_method == RUN_REGULAR)
-		user_param->rx_depth += 1;
+	if (user_param->recv_batch > 1) {
+		int rx_per_qp = user_param->use_srq ? user_param->rx_depth / user_param->num_of_qps : user_param->rx_depth;
 
-	if (user_param->test_type == ITERATIONS && user_param->iters > 20000 && user_param->noPeak == OFF && user_param->tst == BW)
-		user_param->noPeak = ON;
+		if (user_param->verb != SEND || user_param->test_method == RUN_INFINITELY ||
+			user_param->verb_type != NORMAL_INTF || user_param->mac_fwd) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Receive batching is supported only in SEND tests without run_infinitely, mac_fwd or accelerated verbs\n");
+			exit(1);
+		}
+
+		if (user_param->recv_batch > rx_per_qp / 2) {
+			printf(RESULT_LINE);
+			fprintf(stderr," Receive batch (%d) must be at most half of the receive depth per QP (%d)\n",
+				user_param->recv_batch, rx_per_qp);
+			exit(1);
+		}
+	}
 
 	if (!(user_param->duration > 2*user_param->margin)) {
 		printf(RESULT_LINE);
@@ -1112,6 +2655,19 @@ const char *link_layer_str(uint8_t link_layer)
 	}
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+double get_thread_cpu_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return 0;
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1308,7 +2864,7 @@ static void ctx_set_max_inline(struct ibv_context *context,struct perftest_param
  ******************************************************************************/
 int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 {
-	int c,size_len;
+	int c,size_len,i;
 	int size_factor = 1;
 	static int run_inf_flag = 0;
 	static int report_fmt_flag = 0;
@@ -1339,6 +2895,41 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 	static int use_res_domain_flag = 0;
 	static int mr_per_qp_flag = 0;
 	static int dlid_flag = 0;
+	static int use_hugepages_flag = 0;
+	static int numa_flag = 0;
+	static int working_set_flag = 0;
+	static int access_flag = 0;
+	static int size_dist_flag = 0;
+	static int mix_flag = 0;
+	static int sge_flag = 0;
+	static int sge_layout_flag = 0;
+	static int sge_spread_flag = 0;
+	static int recv_batch_flag = 0;
+	static int devices_flag = 0;
+	static int incast_flag = 0;
+	static int start_fds_flag = 0;
+	static int fanout_flag = 0;
+	static int fanout_same_buf_flag = 0;
+	static int ring_flag = 0;
+	static int rank_flag = 0;
+	static int ring_send_flag = 0;
+	static int sweep_flag = 0;
+	static int autotune_flag = 0;
+	static int results_flag = 0;
+	static int load_lat_flag = 0;
+	static int qd_flag = 0;
+	static int contention_flag = 0;
+	static int cas_retry_flag = 0;
+	static int ud_dests_flag = 0;
+	static int compare_flag = 0;
+	static int compare_tol_flag = 0;
+	static int target_time_flag = 0;
+	static int target_ci_flag = 0;
+	static int repeat_flag = 0;
+	static int repeat_ci_flag = 0;
+	static int steady_warmup_flag = 0;
+	static int event_spin_flag = 0;
+	static int cq_moderation_flag = 0;
 
 	init_perftest_params(user_param);
 
@@ -1429,6 +3020,41 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 			#endif
 			{ .name = "mr_per_qp",		.has_arg = 0, .flag = &mr_per_qp_flag, .val = 1},
 			{ .name = "dlid",		.has_arg = 1, .flag = &dlid_flag, .val = 1},
+			{ .name = "use_hugepages",	.has_arg = 1, .flag = &use_hugepages_flag, .val = 1},
+			{ .name = "numa",		.has_arg = 1, .flag = &numa_flag, .val = 1},
+			{ .name = "working_set",	.has_arg = 1, .flag = &working_set_flag, .val = 1},
+			{ .name = "access",		.has_arg = 1, .flag = &access_flag, .val = 1},
+			{ .name = "size_dist",		.has_arg = 1, .flag = &size_dist_flag, .val = 1},
+			{ .name = "mix",		.has_arg = 1, .flag = &mix_flag, .val = 1},
+			{ .name = "sge",		.has_arg = 1, .flag = &sge_flag, .val = 1},
+			{ .name = "sge_layout",		.has_arg = 1, .flag = &sge_layout_flag, .val = 1},
+			{ .name = "sge_spread",		.has_arg = 1, .flag = &sge_spread_flag, .val = 1},
+			{ .name = "recv_batch",		.has_arg = 1, .flag = &recv_batch_flag, .val = 1},
+			{ .name = "devices",		.has_arg = 1, .flag = &devices_flag, .val = 1},
+			{ .name = "incast",		.has_arg = 1, .flag = &incast_flag, .val = 1},
+			{ .name = "start_fds",		.has_arg = 1, .flag = &start_fds_flag, .val = 1},
+			{ .name = "fanout",		.has_arg = 1, .flag = &fanout_flag, .val = 1},
+			{ .name = "fanout_same_buf",	.has_arg = 0, .flag = &fanout_same_buf_flag, .val = 1},
+			{ .name = "ring",		.has_arg = 1, .flag = &ring_flag, .val = 1},
+			{ .name = "rank",		.has_arg = 1, .flag = &rank_flag, .val = 1},
+			{ .name = "ring_send",		.has_arg = 0, .flag = &ring_send_flag, .val = 1},
+			{ .name = "sweep",		.has_arg = 1, .flag = &sweep_flag, .val = 1},
+			{ .name = "autotune",		.has_arg = 1, .flag = &autotune_flag, .val = 1},
+			{ .name = "results",		.has_arg = 1, .flag = &results_flag, .val = 1},
+			{ .name = "load_lat",		.has_arg = 1, .flag = &load_lat_flag, .val = 1},
+			{ .name = "qd",			.has_arg = 1, .flag = &qd_flag, .val = 1},
+			{ .name = "contention",		.has_arg = 1, .flag = &contention_flag, .val = 1},
+			{ .name = "cas_retry",		.has_arg = 0, .flag = &cas_retry_flag, .val = 1},
+			{ .name = "ud_dests",		.has_arg = 1, .flag = &ud_dests_flag, .val = 1},
+			{ .name = "compare",		.has_arg = 1, .flag = &compare_flag, .val = 1},
+			{ .name = "compare_tol",	.has_arg = 1, .flag = &compare_tol_flag, .val = 1},
+			{ .name = "target_time",	.has_arg = 1, .flag = &target_time_flag, .val = 1},
+			{ .name = "target_ci",		.has_arg = 1, .flag = &target_ci_flag, .val = 1},
+			{ .name = "repeat",		.has_arg = 1, .flag = &repeat_flag, .val = 1},
+			{ .name = "repeat_ci",		.has_arg = 1, .flag = &repeat_ci_flag, .val = 1},
+			{ .name = "steady_warmup",	.has_arg = 1, .flag = &steady_warmup_flag, .val = 1},
+			{ .name = "event_spin",		.has_arg = 1, .flag = &event_spin_flag, .val = 1},
+			{ .name = "cq_moderation",	.has_arg = 1, .flag = &cq_moderation_flag, .val = 1},
 			{ 0 }
 		};
 		c = getopt_long(argc,argv,"w:y:p:d:i:m:s:n:t:u:S:x:c:q:I:o:M:r:Q:A:l:D:f:B:T:E:J:j:K:k:aFegzRvhbNVCHUOZP",long_options,NULL);
@@ -1500,15 +3126,13 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 				  }
 				  break;
 			case 'l': user_param->post_list = strtol(optarg, NULL, 0); break;
-			case 'D': user_param->duration = strtol(optarg, NULL, 0);
-				  if (user_param->duration <= 0) {
+			case 'D': if (parse_time_ms(optarg, &user_param->duration) || user_param->duration <= 0) {
 					  fprintf(stderr," Duration period must be greater than 0\n");
 					  return 1;
 				  }
 				  user_param->test_type = DURATION;
 				  break;
-			case 'f': user_param->margin = strtol(optarg, NULL, 0);
-				  if (user_param->margin < 0) {
+			case 'f': if (parse_time_ms(optarg, &user_param->margin)) {
 					  fprintf(stderr," margin must be positive.\n");
 					  return 1;
 				  } break;
@@ -1520,7 +3144,7 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 			case 'a': user_param->test_method = RUN_ALL; break;
 			case 'F': user_param->cpu_freq_f = ON; break;
 			case 'V': printf("Version: %s\n",user_param->version); return VERSION_EXIT;
-			case 'h': usage(argv[0], user_param->verb, user_param->tst, user_param->connection_type);
+			case 'h': usage(argv[0], user_param->verb, user_param->tst, user_param->connection_type, user_param->is_collective);
 				  if(user_param->connection_type == RawEth) {
 					  usage_raw_ethernet();
 				  }
@@ -1645,108 +3269,406 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 					  fprintf(stderr, " Invalid Minimum msgRate Limit\n");
 					  return FAILURE;
 				  }
-				  break;
-			case 'P': user_param->machine = CLIENT; break;
-			case 'Z': user_param->machine = SERVER; break;
-			case 'v': user_param->mac_fwd = ON; break;
-			case 'G': user_param->use_rss = ON; break;
-			case 0: /* required for long options to work. */
-				  if (pkey_flag) {
-					  user_param->pkey_index = strtol(optarg,NULL,0);
-					  pkey_flag = 0;
+				  break;
+			case 'P': user_param->machine = CLIENT; break;
+			case 'Z': user_param->machine = SERVER; break;
+			case 'v': user_param->mac_fwd = ON; break;
+			case 'G': user_param->use_rss = ON; break;
+			case 0: /* required for long options to work. */
+				  if (pkey_flag) {
+					  user_param->pkey_index = strtol(optarg,NULL,0);
+					  pkey_flag = 0;
+				  }
+				  if (inline_recv_flag) {
+					  user_param->inline_recv_size = strtol(optarg,NULL,0);
+					  inline_recv_flag = 0;
+				  }
+				  if (rate_limit_flag) {
+					  user_param->is_rate_limiting = 1;
+					  user_param->rate_limit = strtol(optarg,NULL,0);
+					  if (user_param->rate_limit < 0) {
+						  fprintf(stderr, " Rate limit must be non-negative\n");
+						  return FAILURE;
+					  }
+					  rate_limit_flag = 0;
+				  }
+				  if (burst_size_flag) {
+					  user_param->burst_size = strtol(optarg,NULL,0);
+					  if (user_param->burst_size < 0) {
+						  fprintf(stderr, " Burst size must be non-negative\n");
+						  return FAILURE;
+					  }
+					  burst_size_flag = 0;
+				  }
+				  if (rate_units_flag) {
+					  if (strcmp("M",optarg) == 0) {
+						  user_param->rate_units = MEGA_BYTE_PS;
+					  } else if (strcmp("g",optarg) == 0) {
+						  user_param->rate_units = GIGA_BIT_PS;
+					  } else if (strcmp("p",optarg) == 0) {
+						  user_param->rate_units = PACKET_PS;
+					  } else {
+						  fprintf(stderr, " Invalid rate limit units. Please use M,g or p\n");
+						  return FAILURE;
+					  }
+					  rate_units_flag = 0;
+				  }
+				  if (verbosity_output_flag) {
+					  if (strcmp("bandwidth",optarg) == 0) {
+						  user_param->output = OUTPUT_BW;
+					  } else if (strcmp("message_rate",optarg) == 0) {
+						  user_param->output = OUTPUT_MR;
+					  } else if (strcmp("latency",optarg) == 0) {
+						  user_param->output = OUTPUT_LAT;
+					  } else {
+						  fprintf(stderr, " Invalid verbosity level output flag. Please use bandwidth, latency, message_rate\n");
+						  return FAILURE;
+					  }
+					  verbosity_output_flag = 0;
+				  }
+				  if (latency_gap_flag) {
+					  user_param->latency_gap = strtol(optarg,NULL,0);
+					  if (user_param->latency_gap < 0) {
+						  fprintf(stderr, " Latency gap time must be non-negative\n");
+						  return FAILURE;
+					  }
+					  latency_gap_flag = 0;
+				  }
+				  if (retry_count_flag) {
+					  user_param->retry_count = strtol(optarg,NULL,0);
+					  if (user_param->retry_count < 0) {
+						  fprintf(stderr, " Retry Count value must be positive\n");
+						  return FAILURE;
+					  }
+					  retry_count_flag = 0;
+				  }
+				  if (verb_type_flag) {
+					  if (strcmp("normal",optarg) == 0) {
+						  user_param->verb_type = NORMAL_INTF;
+					  } else if (strcmp("accl",optarg) == 0) {
+						  user_param->verb_type = ACCL_INTF;
+					  } else {
+						  fprintf(stderr, " Invalid verb type. Please choose normal/accl.\n");
+						  return FAILURE;
+					  }
+					  verb_type_flag = 0;
+				  }
+				  if (mmap_file_flag) {
+					  user_param->mmap_file = strdup(optarg);
+					  mmap_file_flag = 0;
+				  }
+				  if (mmap_offset_flag) {
+					  user_param->mmap_offset = strtol(optarg, NULL, 0);
+					  mmap_offset_flag = 0;
+				  }
+				  if (dlid_flag) {
+					  user_param->dlid = (uint16_t)strtol(optarg, NULL, 0);
+					  dlid_flag = 0;
+				  }
+				  if (use_hugepages_flag) {
+					  if (strcmp("2M",optarg) == 0) {
+						  user_param->use_hugepages = HUGEPAGE_2M;
+					  } else if (strcmp("1G",optarg) == 0) {
+						  user_param->use_hugepages = HUGEPAGE_1G;
+					  } else if (strcmp("thp",optarg) == 0) {
+						  user_param->use_hugepages = HUGEPAGE_THP;
+					  } else {
+						  fprintf(stderr, " Invalid hugepages type. Please choose 2M, 1G or thp.\n");
+						  return FAILURE;
+					  }
+					  use_hugepages_flag = 0;
+				  }
+				  if (numa_flag) {
+					  if (strcmp("auto",optarg) == 0) {
+						  user_param->numa_mode = NUMA_AUTO;
+					  } else if (strcmp("off",optarg) == 0) {
+						  user_param->numa_mode = NUMA_OFF;
+					  } else if (isdigit(optarg[0])) {
+						  user_param->numa_mode = NUMA_USER;
+						  user_param->numa_node = strtol(optarg,NULL,0);
+					  } else {
+						  fprintf(stderr, " Invalid NUMA option. Please choose auto, off or a node number.\n");
+						  return FAILURE;
+					  }
+					  numa_flag = 0;
+				  }
+				  if (working_set_flag) {
+					  char *end;
+					  user_param->working_set = parse_size_with_suffix(optarg, &end);
+					  if (*end == ':')
+						  user_param->working_set_max = parse_size_with_suffix(end + 1, &end);
+
+					  if (*end != '\0' || user_param->working_set == 0 ||
+						  (user_param->working_set_max && user_param->working_set_max < user_param->working_set)) {
+						  fprintf(stderr, " Invalid working set. Please use <size>[:<max>], e.g. 64K:1G\n");
+						  return FAILURE;
+					  }
+					  working_set_flag = 0;
+				  }
+				  if (access_flag) {
+					  if (strcmp("seq",optarg) == 0) {
+						  user_param->access_pattern = ACCESS_SEQ;
+					  } else if (strcmp("random",optarg) == 0) {
+						  user_param->access_pattern = ACCESS_RANDOM;
+					  } else if (strncmp("stride:",optarg,7) == 0) {
+						  user_param->access_pattern = ACCESS_STRIDE;
+						  user_param->access_stride = strtol(optarg + 7,NULL,0);
+						  if (user_param->access_stride < 1) {
+							  fprintf(stderr, " Access stride must be positive\n");
+							  return FAILURE;
+						  }
+					  } else {
+						  fprintf(stderr, " Invalid access pattern. Please choose seq, stride:<n> or random.\n");
+						  return FAILURE;
+					  }
+					  access_flag = 0;
+				  }
+				  if (size_dist_flag) {
+					  if (parse_size_dist(optarg, &user_param->size_dist))
+						  return FAILURE;
+					  size_dist_flag = 0;
+				  }
+				  if (mix_flag) {
+					  if (parse_verb_mix(optarg, &user_param->mix))
+						  return FAILURE;
+					  mix_flag = 0;
+				  }
+				  if (sge_flag) {
+					  char *end;
+					  user_param->num_sge = strtol(optarg, &end, 10);
+					  if (*end == ':')
+						  user_param->num_sge_max = strtol(end + 1, &end, 10);
+
+					  if (*end != '\0' || user_param->num_sge < 1 || user_param->num_sge > MAX_SGE ||
+						  (user_param->num_sge_max && (user_param->num_sge_max <= user_param->num_sge ||
+							  user_param->num_sge_max > MAX_SGE))) {
+						  fprintf(stderr, " Invalid SGE count. Please use <n>[:<max>] with 1 <= n < max <= %d\n", MAX_SGE);
+						  return FAILURE;
+					  }
+					  sge_flag = 0;
+				  }
+				  if (sge_layout_flag) {
+					  char *ptr = optarg, *end;
+					  do {
+						  if (user_param->sge_layout_entries == MAX_SGE) {
+							  fprintf(stderr, " Too many entries in SGE layout (max %d)\n", MAX_SGE);
+							  return FAILURE;
+						  }
+						  user_param->sge_layout[user_param->sge_layout_entries] = parse_size_with_suffix(ptr, &end);
+						  if (end == ptr || user_param->sge_layout[user_param->sge_layout_entries] == 0) {
+							  fprintf(stderr, " Invalid SGE layout. Please use <s1>,<s2>,... e.g. 64,4K\n");
+							  return FAILURE;
+						  }
+						  user_param->sge_layout_entries++;
+						  ptr = end + 1;
+					  } while (*end == ',');
+
+					  if (*end != '\0') {
+						  fprintf(stderr, " Invalid SGE layout. Please use <s1>,<s2>,... e.g. 64,4K\n");
+						  return FAILURE;
+					  }
+					  sge_layout_flag = 0;
+				  }
+				  if (sge_spread_flag) {
+					  if (strcmp("line",optarg) == 0) {
+						  user_param->sge_spread = SGE_SPREAD_LINE;
+					  } else if (strcmp("page",optarg) == 0) {
+						  user_param->sge_spread = SGE_SPREAD_PAGE;
+					  } else if (strcmp("mr",optarg) == 0) {
+						  user_param->sge_spread = SGE_SPREAD_MR;
+					  } else {
+						  fprintf(stderr, " Invalid SGE spread. Please choose line, page or mr.\n");
+						  return FAILURE;
+					  }
+					  sge_spread_flag = 0;
+				  }
+				  if (devices_flag) {
+					  if (parse_devices(optarg, user_param)) {
+						  fprintf(stderr, " Invalid device list. Please use <dev>[:<port>],... with up to %d devices\n", MAX_DEVICES);
+						  return FAILURE;
+					  }
+					  devices_flag = 0;
+				  }
+				  if (incast_flag) {
+					  user_param->incast = strtol(optarg, NULL, 0);
+					  if (user_param->incast < 1 || user_param->incast > MAX_INCAST_CLIENTS) {
+						  fprintf(stderr, " Number of incast clients should be between 1 and %d\n", MAX_INCAST_CLIENTS);
+						  return FAILURE;
+					  }
+					  incast_flag = 0;
+				  }
+				  /* Internal: the start barrier pipes run_multi_device hands to each device. */
+				  if (start_fds_flag) {
+					  if (sscanf(optarg, "%d,%d", &user_param->incast_ready_fd, &user_param->incast_go_fd) != 2 ||
+						  user_param->incast_ready_fd < 0 || user_param->incast_go_fd < 0) {
+						  fprintf(stderr, " Invalid start barrier descriptors\n");
+						  return FAILURE;
+					  }
+					  start_fds_flag = 0;
+				  }
+				  if (fanout_flag) {
+					  if (parse_fanout(optarg, user_param)) {
+						  fprintf(stderr, " Invalid server list. Please use <host>[:<port>],... with up to %d servers\n", MAX_FANOUT);
+						  return FAILURE;
+					  }
+					  fanout_flag = 0;
+				  }
+				  if (ring_flag) {
+					  if (parse_ring(optarg, user_param)) {
+						  fprintf(stderr, " Invalid ring. Please use <host0>,<host1>,... with 2 to %d ranks\n", MAX_RING_RANKS);
+						  return FAILURE;
+					  }
+					  ring_flag = 0;
+				  }
+				  if (rank_flag) {
+					  user_param->ring_rank = strtol(optarg, NULL, 0);
+					  rank_flag = 0;
+				  }
+				  if (sweep_flag) {
+					  if (parse_sweep(optarg, user_param)) {
+						  fprintf(stderr, " Invalid sweep. Please use <param>=<n>|<min>:<max>,... once per parameter, up to %d values each\n", MAX_SWEEP_VALUES);
+						  return FAILURE;
+					  }
+					  sweep_flag = 0;
+				  }
+				  if (autotune_flag) {
+					  if (strcmp(optarg, "rate") == 0)
+						  user_param->autotune = AUTOTUNE_RATE;
+					  else if (strcmp(optarg, "p99") == 0)
+						  user_param->autotune = AUTOTUNE_P99;
+					  else {
+						  fprintf(stderr, " Invalid autotune goal. Please use rate or p99\n");
+						  return FAILURE;
+					  }
+					  autotune_flag = 0;
+				  }
+				  if (load_lat_flag) {
+					  if (parse_load_lat(optarg, user_param)) {
+						  fprintf(stderr, " Invalid load steps. Please give up to %d percentages in 1..100, separated by commas\n", MAX_LOAD_STEPS);
+						  return FAILURE;
+					  }
+					  load_lat_flag = 0;
+				  }
+				  if (qd_flag) {
+					  user_param->qd = strtol(optarg, NULL, 0);
+					  if (user_param->qd < 1 || user_param->qd > MAX_QD) {
+						  fprintf(stderr, " Queue depth should be between 1 and %d\n", MAX_QD);
+						  return FAILURE;
+					  }
+					  qd_flag = 0;
 				  }
-				  if (inline_recv_flag) {
-					  user_param->inline_recv_size = strtol(optarg,NULL,0);
-					  inline_recv_flag = 0;
+				  if (contention_flag) {
+					  if (parse_contention(optarg, user_param)) {
+						  fprintf(stderr, " Invalid contention levels. Please give up to %d of hot, <K> or zipf:<K>:<s>, K up to %d\n",
+							  MAX_CONTENTION_LEVELS, MAX_CONTENTION_ADDRS);
+						  return FAILURE;
+					  }
+					  contention_flag = 0;
 				  }
-				  if (rate_limit_flag) {
-					  user_param->is_rate_limiting = 1;
-					  user_param->rate_limit = strtol(optarg,NULL,0);
-					  if (user_param->rate_limit < 0) {
-						  fprintf(stderr, " Rate limit must be non-negative\n");
+				  if (ud_dests_flag) {
+					  char *end;
+
+					  user_param->ud_dests = strtol(optarg, &end, 0);
+					  if (strcmp(end, ",random") == 0)
+						  user_param->ud_dest_random = 1;
+					  else if (*end != '\0')
+						  user_param->ud_dests = 0;
+					  if (user_param->ud_dests < 1 || user_param->ud_dests > MAX_UD_DESTS) {
+						  fprintf(stderr, " Invalid UD destinations. Please use <M>[,random] with M between 1 and %d\n", MAX_UD_DESTS);
 						  return FAILURE;
 					  }
-					  rate_limit_flag = 0;
+					  ud_dests_flag = 0;
 				  }
-				  if (burst_size_flag) {
-					  user_param->burst_size = strtol(optarg,NULL,0);
-					  if (user_param->burst_size < 0) {
-						  fprintf(stderr, " Burst size must be non-negative\n");
+				  if (results_flag) {
+					  user_param->results.file = strdup(optarg);
+					  results_flag = 0;
+				  }
+				  if (compare_flag) {
+					  user_param->results.baseline = strdup(optarg);
+					  compare_flag = 0;
+				  }
+				  if (compare_tol_flag) {
+					  if (parse_compare_tol(optarg, user_param)) {
+						  fprintf(stderr, " Invalid compare tolerance. Please use <percent> or <metric>=<percent>,... with bw, msg_rate, lat or p99\n");
 						  return FAILURE;
 					  }
-					  burst_size_flag = 0;
+					  compare_tol_flag = 0;
 				  }
-				  if (rate_units_flag) {
-					  if (strcmp("M",optarg) == 0) {
-						  user_param->rate_units = MEGA_BYTE_PS;
-					  } else if (strcmp("g",optarg) == 0) {
-						  user_param->rate_units = GIGA_BIT_PS;
-					  } else if (strcmp("p",optarg) == 0) {
-						  user_param->rate_units = PACKET_PS;
-					  } else {
-						  fprintf(stderr, " Invalid rate limit units. Please use M,g or p\n");
+				  if (target_time_flag) {
+					  if (parse_time_ms(optarg, &user_param->target_time_ms) || user_param->target_time_ms <= 0) {
+						  fprintf(stderr, " Invalid target time. Please use seconds or an ms suffix\n");
 						  return FAILURE;
 					  }
-					  rate_units_flag = 0;
+					  target_time_flag = 0;
 				  }
-				  if (verbosity_output_flag) {
-					  if (strcmp("bandwidth",optarg) == 0) {
-						  user_param->output = OUTPUT_BW;
-					  } else if (strcmp("message_rate",optarg) == 0) {
-						  user_param->output = OUTPUT_MR;
-					  } else if (strcmp("latency",optarg) == 0) {
-						  user_param->output = OUTPUT_LAT;
-					  } else {
-						  fprintf(stderr, " Invalid verbosity level output flag. Please use bandwidth, latency, message_rate\n");
+				  if (target_ci_flag) {
+					  user_param->target_ci = strtod(optarg, NULL);
+					  if (user_param->target_ci <= 0 || user_param->target_ci >= 100) {
+						  fprintf(stderr, " Invalid target confidence interval. Please give a percentage between 0 and 100\n");
 						  return FAILURE;
 					  }
-					  verbosity_output_flag = 0;
+					  target_ci_flag = 0;
 				  }
-				  if (latency_gap_flag) {
-					  user_param->latency_gap = strtol(optarg,NULL,0);
-					  if (user_param->latency_gap < 0) {
-						  fprintf(stderr, " Latency gap time must be non-negative\n");
+				  if (repeat_flag) {
+					  user_param->repeat = strtol(optarg, NULL, 0);
+					  if (user_param->repeat < 2 || user_param->repeat > MAX_REPEAT) {
+						  fprintf(stderr, " Number of trials should be between 2 and %d\n", MAX_REPEAT);
 						  return FAILURE;
 					  }
-					  latency_gap_flag = 0;
+					  repeat_flag = 0;
 				  }
-				  if (retry_count_flag) {
-					  user_param->retry_count = strtol(optarg,NULL,0);
-					  if (user_param->retry_count < 0) {
-						  fprintf(stderr, " Retry Count value must be positive\n");
+				  if (repeat_ci_flag) {
+					  user_param->repeat_ci = strtod(optarg, NULL);
+					  if (user_param->repeat_ci <= 0 || user_param->repeat_ci >= 100) {
+						  fprintf(stderr, " Invalid trials confidence interval. Please give a percentage between 0 and 100\n");
 						  return FAILURE;
 					  }
-					  retry_count_flag = 0;
+					  repeat_ci_flag = 0;
 				  }
-				  if (verb_type_flag) {
-					  if (strcmp("normal",optarg) == 0) {
-						  user_param->verb_type = NORMAL_INTF;
-					  } else if (strcmp("accl",optarg) == 0) {
-						  user_param->verb_type = ACCL_INTF;
-					  } else {
-						  fprintf(stderr, " Invalid verb type. Please choose normal/accl.\n");
+				  if (steady_warmup_flag) {
+					  user_param->warmup_tol = strtod(optarg, NULL);
+					  if (user_param->warmup_tol <= 0 || user_param->warmup_tol >= 100) {
+						  fprintf(stderr, " Invalid warm-up tolerance. Please give a percentage between 0 and 100\n");
 						  return FAILURE;
 					  }
-					  verb_type_flag = 0;
+					  steady_warmup_flag = 0;
 				  }
-				  if (mmap_file_flag) {
-					  user_param->mmap_file = strdup(optarg);
-					  mmap_file_flag = 0;
+				  if (recv_batch_flag) {
+					  user_param->recv_batch = strtol(optarg, NULL, 0);
+					  if (user_param->recv_batch < 1) {
+						  fprintf(stderr, " Receive batch must be at least 1\n");
+						  return FAILURE;
+					  }
+					  recv_batch_flag = 0;
 				  }
-				  if (mmap_offset_flag) {
-					  user_param->mmap_offset = strtol(optarg, NULL, 0);
-					  mmap_offset_flag = 0;
+				  if (event_spin_flag) {
+					  user_param->event_spin = strtol(optarg, NULL, 0);
+					  if (user_param->event_spin < 0) {
+						  fprintf(stderr, " Event spin budget must be non-negative\n");
+						  return FAILURE;
+					  }
+					  user_param->use_event = ON;
+					  event_spin_flag = 0;
 				  }
-				  if (dlid_flag) {
-					  user_param->dlid = (uint16_t)strtol(optarg, NULL, 0);
-					  dlid_flag = 0;
+				  if (cq_moderation_flag) {
+					  char *end;
+					  user_param->cq_moderation_count = strtol(optarg, &end, 0);
+					  if (*end == ':')
+						  user_param->cq_moderation_period = strtol(end + 1, &end, 0);
+
+					  if (*end != '\0' || user_param->cq_moderation_count < 1 || user_param->cq_moderation_count > 0xffff ||
+						  user_param->cq_moderation_period < 0 || user_param->cq_moderation_period > 0xffff) {
+						  fprintf(stderr, " Invalid CQ moderation. Please use <count>[:<usec>], up to 65535 each\n");
+						  return FAILURE;
+					  }
+					  cq_moderation_flag = 0;
 				  }
 				  break;
 
 			default:
 				  fprintf(stderr," Invalid Command or flag.\n");
 				  fprintf(stderr," Please check command line and run again.\n\n");
-				  usage(argv[0], user_param->verb, user_param->tst, user_param->connection_type);
+				  usage(argv[0], user_param->verb, user_param->tst, user_param->connection_type, user_param->is_collective);
 				  if(user_param->connection_type == RawEth) {
 					  usage_raw_ethernet();
 				  }
@@ -1820,6 +3742,18 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 		user_param->mr_per_qp = 1;
 	}
 
+	if (fanout_same_buf_flag) {
+		user_param->fanout_same_buf = 1;
+	}
+
+	if (ring_send_flag) {
+		user_param->ring_send = 1;
+	}
+
+	if (cas_retry_flag) {
+		user_param->cas_retry = 1;
+	}
+
 	if (optind == argc - 1) {
 		GET_STRING(user_param->servername,strdupa(argv[optind]));
 
@@ -1839,6 +3773,21 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 			user_param->machine = SERVER;
 	}
 
+	/* The results file records how the test was run. */
+	if (user_param->results.file) {
+		size_t len = 1;
+
+		for (i = 0; i < argc; i++)
+			len += strlen(argv[i]) + 1;
+		ALLOCATE(user_param->results.cmdline, char, len);
+		user_param->results.cmdline[0] = '\0';
+		for (i = 0; i < argc; i++) {
+			strcat(user_param->results.cmdline, argv[i]);
+			if (i < argc - 1)
+				strcat(user_param->results.cmdline, " ");
+		}
+	}
+
 	force_dependecies(user_param);
 	return 0;
 }
@@ -1890,7 +3839,7 @@ int check_link_and_mtu(struct ibv_context *context,struct perftest_parameters *u
 	/* Compute Max inline size with pre found statistics values */
 	ctx_set_max_inline(context,user_param);
 
-	if (user_param->verb == READ || user_param->verb == ATOMIC)
+	if (user_param->verb == READ || user_param->verb == ATOMIC || user_param->mix.weights[READ])
 		user_param->out_reads = ctx_set_out_reads(context,user_param->out_reads);
 	else
 		user_param->out_reads = 1;
@@ -1921,6 +3870,8 @@ int check_link_and_mtu(struct ibv_context *context,struct perftest_parameters *u
 	if (user_param->pkey_index > 0)
 		user_param->pkey_index = ctx_chk_pkey_index(context, user_param->pkey_index);
 
+	results_set_device(context,user_param);
+
 	return SUCCESS;
 }
 
@@ -1965,7 +3916,7 @@ int check_link(struct ibv_context *context,struct perftest_parameters *user_para
 	/* Compute Max inline size with pre found statistics values */
 	ctx_set_max_inline(context,user_param);
 
-	if (user_param->verb == READ || user_param->verb == ATOMIC)
+	if (user_param->verb == READ || user_param->verb == ATOMIC || user_param->mix.weights[READ])
 		user_param->out_reads = ctx_set_out_reads(context,user_param->out_reads);
 	else
 		user_param->out_reads = 1;
@@ -1977,6 +3928,8 @@ int check_link(struct ibv_context *context,struct perftest_parameters *user_para
 	if (user_param->pkey_index > 0)
 		user_param->pkey_index = ctx_chk_pkey_index(context, user_param->pkey_index);
 
+	results_set_device(context,user_param);
+
 	return SUCCESS;
 }
 
@@ -1987,6 +3940,7 @@ int check_link(struct ibv_context *context,struct perftest_parameters *user_para
 void ctx_print_test_info(struct perftest_parameters *user_param)
 {
 	int temp = 0;
+	int i;
 
 	if (user_param->output != FULL_VERBOSITY)
 		return;
@@ -2029,6 +3983,12 @@ void ctx_print_test_info(struct perftest_parameters *user_param)
 
 	}
 
+	if (user_param->event_spin >= 0)
+		printf(" Event spin      : %d[usec]\n" ,user_param->event_spin);
+
+	if (user_param->cq_moderation_count)
+		printf(" CQ event mod.   : %d/%d[usec]\n" ,user_param->cq_moderation_count ,user_param->cq_moderation_period);
+
 	if (user_param->use_mcg)
 		printf(" MultiCast runs on UD!\n");
 
@@ -2045,6 +4005,8 @@ void ctx_print_test_info(struct perftest_parameters *user_param)
 
 	if (user_param->verb == SEND && (user_param->machine == SERVER || user_param->duplex)) {
 		printf(" RX depth        : %d\n",user_param->rx_depth);
+		if (user_param->recv_batch > 1)
+			printf(" RX batch        : %d\n",user_param->recv_batch);
 	}
 
 	if (user_param->tst == BW) {
@@ -2058,6 +4020,95 @@ void ctx_print_test_info(struct perftest_parameters *user_param)
 	if (user_param->mac_fwd == ON)
 		printf(" Buffer size     : %d[B]\n" ,user_param->buff_size/2);
 
+	if (user_param->use_hugepages != HUGEPAGE_OFF)
+		printf(" Buffer pages    : %s\n" ,hugepageStr[user_param->use_hugepages]);
+
+	if (user_param->num_sge_max > 1) {
+		printf(" SGEs per WR     : %d" ,user_param->num_sge);
+		if (user_param->num_sge_max > user_param->num_sge)
+			printf(" - %d" ,user_param->num_sge_max);
+		for (i = 0; i < user_param->sge_layout_entries; i++)
+			printf("%c%u" ,i ? ',' : ' ' ,user_param->sge_layout[i]);
+		if (user_param->sge_layout_entries)
+			printf("[B]");
+		printf("\t\tSGE spread     : %s\n" ,sgeSpreadStr[user_param->sge_spread]);
+	}
+
+	if (user_param->working_set) {
+		printf(" Working set     : %lu[B]" ,user_param->working_set);
+		if (user_param->working_set_max)
+			printf(" - %lu[B]" ,user_param->working_set_max);
+		printf("\tAccess pattern : %s" ,accessStr[user_param->access_pattern]);
+		if (user_param->access_pattern == ACCESS_STRIDE)
+			printf(":%d" ,user_param->access_stride);
+		putchar('\n');
+	}
+
+	if (user_param->size_dist.type != SIZE_DIST_NONE)
+		printf(" Size dist.      : avg %.1f[B]\t\tRange          : %lu-%lu[B]\n",
+			user_param->size_dist.avg_size, user_param->size_dist.min_size, user_param->size_dist.max_size);
+
+	if (user_param->mix.total_weight) {
+		printf(" Verb mix        :");
+		for (i = 0; i < MIX_NUM_OF_VERBS; i++) {
+			if (user_param->mix.weights[i])
+				printf(" %s %.1f%%", mix_verb_str[i], 100.0 * user_param->mix.weights[i] / user_param->mix.total_weight);
+		}
+		putchar('\n');
+	}
+
+	if (user_param->ring_size)
+		printf(" Ring            : rank %d of %d\t\tTransport      : %s\n", user_param->ring_rank, user_param->ring_size,
+			user_param->ring_send ? "SEND" : "WRITE with immediate");
+
+	if (user_param->adaptive) {
+		printf(" Iterations      : adaptive");
+		if (user_param->target_time_ms)
+			printf(", %d[ms] per size", user_param->target_time_ms);
+		if (user_param->target_ci > 0)
+			printf(", CI95 within %.2f%%", user_param->target_ci);
+		putchar('\n');
+	}
+
+	if (user_param->is_sweep) {
+		int p,points = 1;
+
+		for (p = 0; p < SWEEP_PARAMS; p++)
+			points *= user_param->sweep[p].count;
+		if (user_param->autotune)
+			printf(" Autotune        : %s, %d points\tAllocated for  : %lu[B] x %d QPs\n",
+				user_param->autotune == AUTOTUNE_P99 ? "min p99 latency" : "max message rate",
+				points, user_param->size, user_param->num_of_qps);
+		else
+			printf(" Sweep           : %d points\t\tAllocated for  : %lu[B] x %d QPs\n",
+				points, user_param->size, user_param->num_of_qps);
+	}
+
+	if (user_param->load_lat_steps) {
+		printf(" Load steps      :");
+		for (i = 0; i < user_param->load_lat_steps; i++)
+			printf(" %d%%", user_param->load_lat[i]);
+		printf("\t\tProbe QP       : #%d\n", user_param->num_of_qps - 1);
+	}
+
+	if (user_param->qd > 1)
+		printf(" Queue depth     : %d operations in flight\n", user_param->qd);
+
+	if (user_param->ud_dests)
+		printf(" UD destinations : %d AHs over %d remote QPs, %s\n", user_param->ud_dests, user_param->num_of_qps,
+			user_param->ud_dest_random ? "random" : "round robin");
+
+	if (user_param->contention_levels)
+		printf(" Contention      : %d levels over %d QPs%s\n", user_param->contention_levels, user_param->num_of_qps,
+			user_param->cas_retry ? ", CAS retry loops" : "");
+
+	if (user_param->num_servers > 1)
+		printf(" Fan-out         : %d servers, %d QPs each%s\n", user_param->num_servers,
+			user_param->num_of_qps / user_param->num_servers, user_param->fanout_same_buf ? ", same buffer" : "");
+
+	if (user_param->numa_mode != NUMA_OFF && user_param->numa_node >= 0)
+		printf(" NUMA placement  : node %d\t\tPolling CPU    : %d\n" ,user_param->numa_node ,user_param->numa_cpu);
+
 	if (user_param->gid_index != DEF_GID_INDEX)
 		printf(" Gid index       : %d\n" ,user_param->gid_index);
 	if ((user_param->dualport==ON) && (user_param->gid_index2 != DEF_GID_INDEX))
@@ -2107,6 +4158,117 @@ static float calc_cpu_util (struct perftest_parameters *user_param)
 		return 0;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void print_mix_verbs(struct perftest_parameters *user_param, struct bw_report_data *my_bw_rep, double cycles_to_units)
+{
+	struct verb_mix *mix = &user_param->mix;
+	uint64_t tot_msgs = 0;
+	double share, cycles_to_usec = cycles_to_units / 1000000;
+	int v;
+
+	for (v = 0; v < MIX_NUM_OF_VERBS; v++)
+		tot_msgs += mix->msgs[v];
+
+	if (!tot_msgs)
+		return;
+
+	printf(RESULT_FMT_MIX);
+	for (v = 0; v < MIX_NUM_OF_VERBS; v++) {
+		if (!mix->msgs[v])
+			continue;
+
+		share = (double)mix->msgs[v] / tot_msgs;
+		printf(REPORT_FMT_MIX, mix_verb_str[v], share * 100, my_bw_rep->bw_avg * share,
+			my_bw_rep->msgRate_avg * share,
+			mix->lat_samples[v] ? mix->lat_sum[v] / mix->lat_samples[v] / cycles_to_usec : 0,
+			mix->lat_min[v] / cycles_to_usec, mix->lat_max[v] / cycles_to_usec);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void print_fanout_dests(struct perftest_parameters *user_param, struct bw_report_data *my_bw_rep, double cycles_to_units)
+{
+	struct fanout_dest *dest;
+	uint64_t tot_msgs = 0;
+	double share, cycles_to_usec = cycles_to_units / 1000000;
+	char name[64];
+	int k;
+
+	for (k = 0; k < user_param->num_servers; k++)
+		tot_msgs += user_param->fanout[k].msgs;
+
+	if (!tot_msgs)
+		return;
+
+	printf(RESULT_FMT_FANOUT);
+	for (k = 0; k < user_param->num_servers; k++) {
+		dest = &user_param->fanout[k];
+		share = (double)dest->msgs / tot_msgs;
+		snprintf(name, sizeof(name), "%s:%d", dest->host, dest->port ? dest->port : user_param->port);
+		printf(REPORT_FMT_FANOUT, name, share * 100, my_bw_rep->bw_avg * share,
+			my_bw_rep->msgRate_avg * share,
+			dest->lat_samples ? dest->lat_sum / dest->lat_samples / cycles_to_usec : 0,
+			dest->lat_min / cycles_to_usec, dest->lat_max / cycles_to_usec);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void print_size_dist_classes(struct perftest_parameters *user_param, struct bw_report_data *my_bw_rep)
+{
+	struct size_dist *dist = &user_param->size_dist;
+	uint64_t msgs = 0,bytes = 0;
+	int c;
+
+	for (c = 0; c < SIZE_DIST_CLASSES; c++) {
+		msgs += dist->posted_msgs[c];
+		bytes += dist->posted_bytes[c];
+	}
+
+	/* Only the side that posted the messages counted them. */
+	if (msgs) {
+		printf(RESULT_FMT_SIZE_CLASS);
+		for (c = 0; c < SIZE_DIST_CLASSES; c++) {
+			if (!dist->posted_msgs[c])
+				continue;
+
+			printf(REPORT_FMT_SIZE_CLASS, 1UL << c, (double)dist->posted_msgs[c] * 100 / msgs,
+				my_bw_rep->bw_avg * dist->posted_bytes[c] / bytes,
+				my_bw_rep->msgRate_avg * dist->posted_msgs[c] / msgs);
+		}
+	}
+
+	/* The next run (e.g. the next point of a sweep) counts anew. */
+	memset(dist->posted_msgs, 0, sizeof(dist->posted_msgs));
+	memset(dist->posted_bytes, 0, sizeof(dist->posted_bytes));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void print_event_stats(struct perftest_parameters *user_param)
+{
+	double elapsed;
+
+	if (!user_param->event_start)
+		return;
+
+	elapsed = (get_cycles() - user_param->event_start) / (get_cpu_mhz(user_param->cpu_freq_f) * 1000000);
+	if (elapsed > 0)
+		printf(" Events          : wakeups %.1f[/sec]\tpolling CPU %.1f[%%]\n",
+			user_param->event_wakeups / elapsed,
+			(get_thread_cpu_time() - user_param->event_cpu_start) * 100 / elapsed);
+
+	/* The next run (e.g. the next size of -a) opens a new window. */
+	user_param->event_start = 0;
+	user_param->event_wakeups = 0;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2152,6 +4314,10 @@ void print_report_bw (struct perftest_parameters *user_param, struct bw_report_d
 
 	run_inf_bi_factor = (user_param->duplex && user_param->test_method == RUN_INFINITELY) ? (user_param->verb == SEND ? 1 : 2) : 1 ;
 	tsize = run_inf_bi_factor * user_param->size;
+
+	/* With a size distribution, BW is weighted by the average message size. */
+	if (user_param->size_dist.type != SIZE_DIST_NONE)
+		tsize = run_inf_bi_factor * (cycles_t)(user_param->size_dist.avg_size + 0.5);
 	num_of_calculated_iters *= (user_param->test_type == DURATION) ? 1 : num_of_qps;
 	location_arr = (user_param->noPeak) ? 0 : user_param->iters*num_of_qps - 1;
 	/* support in GBS format */
@@ -2177,7 +4343,7 @@ void print_report_bw (struct perftest_parameters *user_param, struct bw_report_d
 		memset(my_bw_rep, 0, sizeof(struct bw_report_data));
 	}
 
-	my_bw_rep->size = (unsigned long)user_param->size;
+	my_bw_rep->size = (unsigned long)tsize / run_inf_bi_factor;
 	my_bw_rep->iters = user_param->iters;
 	my_bw_rep->bw_peak = (double)peak_up/peak_down;
 	my_bw_rep->bw_avg = bw_avg;
@@ -2189,9 +4355,22 @@ void print_report_bw (struct perftest_parameters *user_param, struct bw_report_d
 	my_bw_rep->sl = user_param->sl;
 
 	if (!user_param->duplex || (user_param->verb == SEND && user_param->test_type == DURATION) 
-			|| user_param->test_method == RUN_INFINITELY || user_param->connection_type == RawEth)
+			|| user_param->test_method == RUN_INFINITELY || user_param->connection_type == RawEth) {
 		print_full_bw_report(user_param, my_bw_rep, NULL);
 
+		if (user_param->size_dist.type != SIZE_DIST_NONE && user_param->output == FULL_VERBOSITY)
+			print_size_dist_classes(user_param, my_bw_rep);
+
+		if (user_param->mix.total_weight && user_param->machine == CLIENT && user_param->output == FULL_VERBOSITY)
+			print_mix_verbs(user_param, my_bw_rep, cycles_to_units);
+
+		if (user_param->num_servers > 1 && user_param->machine == CLIENT && user_param->output == FULL_VERBOSITY)
+			print_fanout_dests(user_param, my_bw_rep, cycles_to_units);
+
+		if (user_param->event_spin >= 0 && user_param->output == FULL_VERBOSITY)
+			print_event_stats(user_param);
+	}
+
 	if (free_my_bw_rep == 1) {
 		free(my_bw_rep);
 	}
@@ -2234,6 +4413,14 @@ void print_full_bw_report (struct perftest_parameters *user_param, struct bw_rep
 			user_param->is_msgrate_limit_passed |= 0;
 		else
 			user_param->is_msgrate_limit_passed |= 1;
+
+		if (user_param->results.file || user_param->results.baseline)
+			results_add_bw(user_param, my_bw_rep->size, my_bw_rep->iters, bw_peak, bw_avg, msgRate_avg);
+	}
+
+	if (user_param->repeat > 1 && user_param->repeat_stats.trials < MAX_REPEAT) {
+		user_param->repeat_stats.sample[0][user_param->repeat_stats.trials] = bw_avg;
+		user_param->repeat_stats.sample[1][user_param->repeat_stats.trials++] = msgRate_avg;
 	}
 
 	if (user_param->output == OUTPUT_BW)
@@ -2246,6 +4433,20 @@ void print_full_bw_report (struct perftest_parameters *user_param, struct bw_rep
 		printf(REPORT_FMT_PER_PORT, my_bw_rep->size, my_bw_rep->iters, bw_peak, bw_avg, msgRate_avg, bw_avg_p1, msgRate_avg_p1, bw_avg_p2, msgRate_avg_p2);
 	else
 		printf( inc_accuracy ? REPORT_FMT_EXT : REPORT_FMT, my_bw_rep->size, my_bw_rep->iters, bw_peak, bw_avg, msgRate_avg);
+	if (user_param->output == FULL_VERBOSITY && user_param->working_set)
+		printf(REPORT_EXT_WS, (unsigned long)user_param->working_set);
+	if (user_param->output == FULL_VERBOSITY && user_param->num_sge_max > 1)
+		printf(REPORT_EXT_SGE, user_param->num_sge);
+	if (user_param->output == FULL_VERBOSITY && user_param->is_sweep && user_param->machine == CLIENT)
+		printf(REPORT_EXT_SWEEP, user_param->num_of_qps, user_param->tx_depth, user_param->post_list, user_param->cq_mod);
+	if (user_param->output == FULL_VERBOSITY && user_param->autotune && user_param->machine == CLIENT)
+		printf(REPORT_EXT_INLINE, user_param->inline_size);
+	if (user_param->output == FULL_VERBOSITY && user_param->autotune == AUTOTUNE_P99 && user_param->machine == CLIENT)
+		printf(REPORT_EXT_P99, user_param->tune_p99);
+	if (user_param->output == FULL_VERBOSITY && user_param->adaptive && user_param->machine == CLIENT)
+		printf(REPORT_EXT_CI, user_param->achieved_ci);
+	if (user_param->output == FULL_VERBOSITY && user_param->warmup_tol > 0 && (user_param->machine == CLIENT || user_param->duplex))
+		printf(REPORT_EXT_WARMUP, user_param->warmup_ms);
 	if (user_param->output == FULL_VERBOSITY)
 		printf( user_param->cpu_util_data.enable ? REPORT_EXT_CPU_UTIL : REPORT_EXT , calc_cpu_util(user_param));
 }
@@ -2263,7 +4464,7 @@ static inline cycles_t get_median(int n, cycles_t delta[])
 /******************************************************************************
  *
  ******************************************************************************/
-static int cycles_compare(const void *aptr, const void *bptr)
+int cycles_compare(const void *aptr, const void *bptr)
 {
 	const cycles_t *a = aptr;
 	const cycles_t *b = bptr;
@@ -2273,6 +4474,22 @@ static int cycles_compare(const void *aptr, const void *bptr)
 	return 0;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_hist_buckets(FILE *fp, const cycles_t *s, uint64_t n, double scale)
+{
+	double bound;
+	uint64_t i,count;
+
+	for (i = 0, bound = RESULTS_HIST_MIN; i < n; bound *= 2) {
+		for (count = 0; i < n && s[i] / scale <= bound; i++)
+			count++;
+		if (count)
+			fprintf(fp, " %g:%lu", bound, (unsigned long)count);
+	}
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2280,6 +4497,7 @@ void print_report_lat (struct perftest_parameters *user_param)
 {
 
 	int i;
+	int samples;
 	int rtt_factor;
 	double cycles_to_units;
 	cycles_t median;
@@ -2288,10 +4506,18 @@ void print_report_lat (struct perftest_parameters *user_param)
 	double latency;
 
 	rtt_factor = (user_param->verb == READ || user_param->verb == ATOMIC) ? 1 : 2;
-	ALLOCATE(delta,cycles_t,user_param->iters - 1);
 
-	for (i = 0; i < user_param->iters - 1; ++i)
-		delta[i] = user_param->tposted[i + 1] - user_param->tposted[i];
+	/* At a queue depth above 1 the loop has already timed each operation from its slot. */
+	if (user_param->qd > 1) {
+		samples = user_param->qd_samples;
+		ALLOCATE(delta,cycles_t,samples);
+		memcpy(delta, user_param->tcompleted, samples * sizeof(cycles_t));
+	} else {
+		samples = user_param->iters - 1;
+		ALLOCATE(delta,cycles_t,samples);
+		for (i = 0; i < samples; ++i)
+			delta[i] = user_param->tposted[i + 1] - user_param->tposted[i];
+	}
 
 	if (user_param->r_flag->cycles) {
 		cycles_to_units = 1;
@@ -2304,22 +4530,31 @@ void print_report_lat (struct perftest_parameters *user_param)
 
 	if (user_param->r_flag->unsorted) {
 		printf("#, %s\n", units);
-		for (i = 0; i < user_param->iters - 1; ++i)
+		for (i = 0; i < samples; ++i)
 			printf("%d, %g\n", i + 1, delta[i] / cycles_to_units / rtt_factor);
 	}
 
-	qsort(delta, user_param->iters - 1, sizeof *delta, cycles_compare);
+	qsort(delta, samples, sizeof *delta, cycles_compare);
 
 	if (user_param->r_flag->histogram) {
 		printf("#, %s\n", units);
-		for (i = 0; i < user_param->iters - 1; ++i)
+		for (i = 0; i < samples; ++i)
 			printf("%d, %g\n", i + 1, delta[i] / cycles_to_units / rtt_factor);
 	}
 
-	median = get_median(user_param->iters - 1, delta);
+	median = get_median(samples, delta);
 
 	latency = median / cycles_to_units / rtt_factor;
 
+	if (user_param->results.file || user_param->results.baseline)
+		results_add_lat(user_param, delta, samples, median, cycles_to_units * rtt_factor);
+
+	if (user_param->repeat > 1 && user_param->repeat_stats.trials < MAX_REPEAT) {
+		user_param->repeat_stats.sample[0][user_param->repeat_stats.trials] = latency;
+		user_param->repeat_stats.sample[1][user_param->repeat_stats.trials++] =
+			delta[(samples - 1) * 99 / 100] / cycles_to_units / rtt_factor;
+	}
+
 	if (user_param->output == OUTPUT_LAT) {
 		printf("%lf\n",latency);
 	}
@@ -2328,9 +4563,12 @@ void print_report_lat (struct perftest_parameters *user_param)
 				(unsigned long)user_param->size,
 				user_param->iters,
 				delta[0] / cycles_to_units / rtt_factor,
-				delta[user_param->iters - 2] / cycles_to_units / rtt_factor,
+				delta[samples - 1] / cycles_to_units / rtt_factor,
 				latency);
 		printf( user_param->cpu_util_data.enable ? REPORT_EXT_CPU_UTIL : REPORT_EXT , calc_cpu_util(user_param));
+
+		if (user_param->event_spin >= 0)
+			print_event_stats(user_param);
 	}
 	free(delta);
 }
@@ -2362,6 +4600,152 @@ void print_report_lat_duration (struct perftest_parameters *user_param)
 		printf( user_param->cpu_util_data.enable ? REPORT_EXT_CPU_UTIL : REPORT_EXT , calc_cpu_util(user_param));
 	}
 }
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+double student_t95(int dof)
+{
+	static const double quantile[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+
+	if (dof < 1)
+		return 0;
+
+	return (dof <= 30) ? quantile[dof - 1] : 1.960;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int double_compare(const void *aptr, const void *bptr)
+{
+	const double *a = aptr;
+	const double *b = bptr;
+	if (*a < *b) return -1;
+	if (*a > *b) return 1;
+
+	return 0;
+}
+
+/******************************************************************************
+ * Flags the trials whose metric 0 is more than 3 scaled MADs from the median.
+ ******************************************************************************/
+static int repeat_outliers(struct repeat_stats *stats, int *outlier)
+{
+	double	sorted[MAX_REPEAT],median,mad;
+	int	i,n = stats->trials,num = 0;
+
+	memset(outlier, 0, n * sizeof(int));
+	if (n < REPEAT_MIN_TRIALS)
+		return 0;
+
+	memcpy(sorted, stats->sample[0], n * sizeof(double));
+	qsort(sorted, n, sizeof(double), double_compare);
+	median = (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+	for (i = 0; i < n; i++)
+		sorted[i] = fabs(stats->sample[0][i] - median);
+	qsort(sorted, n, sizeof(double), double_compare);
+	mad = 1.4826 * ((n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2);
+
+	if (mad == 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		if (fabs(stats->sample[0][i] - median) > 3 * mad) {
+			outlier[i] = 1;
+			num++;
+		}
+	}
+	return num;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void repeat_summary(struct repeat_stats *stats, int metric, const int *outlier,
+		double *mean, double *stddev, double *ci)
+{
+	double	delta,m2 = 0;
+	int	i,n = 0;
+
+	*mean = 0;
+	for (i = 0; i < stats->trials; i++) {
+		if (outlier[i])
+			continue;
+		delta = stats->sample[metric][i] - *mean;
+		*mean += delta / ++n;
+		m2 += delta * (stats->sample[metric][i] - *mean);
+	}
+
+	*stddev = (n > 1) ? sqrt(m2 / (n - 1)) : 0;
+	*ci = (n > 1) ? student_t95(n - 1) * *stddev / sqrt(n) : 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int repeat_more_trials(struct perftest_parameters *user_param)
+{
+	struct repeat_stats	*stats = &user_param->repeat_stats;
+	int			outlier[MAX_REPEAT];
+	double			mean,stddev,ci;
+
+	if (stats->trials >= user_param->repeat)
+		return 0;
+
+	if (user_param->repeat_ci > 0 && stats->trials >= REPEAT_MIN_TRIALS) {
+		repeat_outliers(stats, outlier);
+		repeat_summary(stats, 0, outlier, &mean, &stddev, &ci);
+		if (mean > 0 && 100 * ci / mean <= user_param->repeat_ci)
+			return 0;
+	}
+	return 1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_repeat_stats(struct perftest_parameters *user_param)
+{
+	struct repeat_stats	*stats = &user_param->repeat_stats;
+	int			outlier[MAX_REPEAT];
+	char			name[REPEAT_METRICS][32];
+	const char		*units = user_param->r_flag->cycles ? "cycles" : "usec";
+	double			mean,stddev,ci;
+	int			i,m,num;
+
+	if (user_param->tst == BW) {
+		snprintf(name[0], sizeof(name[0]), "BW average[%s]", user_param->report_fmt == MBS ? "MB/sec" : "Gb/sec");
+		snprintf(name[1], sizeof(name[1]), "MsgRate[Mpps]");
+	} else {
+		snprintf(name[0], sizeof(name[0]), "t_typical[%s]", units);
+		snprintf(name[1], sizeof(name[1]), "t_99%%[%s]", units);
+	}
+
+	num = repeat_outliers(stats, outlier);
+
+	printf(RESULT_LINE);
+	printf(" Trials          : %d of %d", stats->trials, user_param->repeat);
+	if (num) {
+		printf("\t\tOutliers       :");
+		for (i = 0; i < stats->trials; i++) {
+			if (outlier[i])
+				printf(" #%d", i + 1);
+		}
+	}
+	putchar('\n');
+
+	printf(RESULT_FMT_REPEAT);
+	for (m = 0; m < REPEAT_METRICS; m++) {
+		repeat_summary(stats, m, outlier, &mean, &stddev, &ci);
+		printf(REPORT_FMT_REPEAT, name[m], mean, stddev, ci, mean > 0 ? 100 * ci / mean : 0);
+	}
+}
 /******************************************************************************
  * End
  ******************************************************************************/
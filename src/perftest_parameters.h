@@ -113,8 +113,9 @@
 #define DEF_CQ_MOD    (100)
 #define DEF_SIZE_ATOMIC (8)
 #define DEF_QKEY      0x11111111
-#define DEF_DURATION  (5)
-#define	DEF_MARGIN    (2)
+/* Durations and margins are kept in milliseconds. */
+#define DEF_DURATION  (5000)
+#define	DEF_MARGIN    (2000)
 #define DEF_INIT_MARGIN (-1)
 #define DEF_INLINE    (-1)
 #define DEF_TOS       (-1)
@@ -122,6 +123,69 @@
 #define DEF_CACHE_LINE_SIZE (64)
 #define DEF_PAGE_SIZE (4096)
 
+/* Message size distribution */
+#define SIZE_RING_LEN		(4096)
+#define SIZE_DIST_CLASSES	(24)
+#define MAX_SIZE_DIST_ENTRIES	(1024)
+#define MIX_RING_LEN		(1000)
+#define MIX_NUM_OF_VERBS	(3)
+#define MAX_SGE			(32)
+#define MAX_DEVICES		(16)
+#define MAX_DEV_REPORT_ROWS	(64)
+#define MAX_INCAST_CLIENTS	(64)
+#define MAX_FANOUT		(16)
+#define MAX_RING_RANKS		(32)
+#define MAX_SWEEP_VALUES	(64)
+
+/* Autotune: time of each point, descent passes, default ranges and p99 samples. */
+#define AUTOTUNE_POINT_MS	(100)
+#define AUTOTUNE_MAX_PASSES	(4)
+#define AUTOTUNE_MIN_TX		(16)
+#define AUTOTUNE_MAX_POST_LIST	(32)
+#define AUTOTUNE_LAT_SAMPLES	(65536)
+
+/* Load-latency curve: steps, time per step, probe size, spacing and samples. */
+#define MAX_LOAD_STEPS		(16)
+#define LOAD_LAT_STEP_MS	(1000)
+#define LOAD_LAT_PROBE_SIZE	(8)
+#define LOAD_LAT_PROBE_GAP_US	(10)
+#define LOAD_LAT_BURSTS_PER_SEC	(10000)
+#define LOAD_LAT_SAMPLES	(1 << 20)
+#define LOAD_LAT_REAP_MS	(1000)
+
+/* Pipelined latency: largest number of outstanding operations. */
+#define MAX_QD			(1024)
+
+/* Atomic contention: levels, addresses per level and the per QP address ring. */
+#define MAX_CONTENTION_LEVELS	(16)
+#define MAX_CONTENTION_ADDRS	(65536)
+#define CONTENTION_RING_LEN	(65536)
+
+/* UD destination table: largest number of AHs and the per QP pick ring (a power of 2). */
+#define MAX_UD_DESTS		(65536)
+#define UD_DEST_RING_LEN	(65536)
+
+/* Adaptive iterations: chunk count and length, and the cap per point. */
+#define ADAPTIVE_MIN_CHUNKS	(5)
+#define ADAPTIVE_TIME_CHUNKS	(10)
+#define ADAPTIVE_CHUNK_MS	(20)
+#define ADAPTIVE_MAX_MS		(10000)
+
+/* Repeated trials: the cap, the trials before the CI may stop them, and metrics kept per trial. */
+#define MAX_REPEAT		(100)
+#define REPEAT_MIN_TRIALS	(3)
+#define REPEAT_METRICS		(2)
+
+/* Results file: rows kept for --compare, default tolerance and first histogram bucket. */
+#define RESULTS_MAX_ROWS	(4096)
+#define RESULTS_DEF_TOL		(5.0)
+#define RESULTS_HIST_MIN	(0.0625)
+
+/* Steady state warm-up: rolling windows of this length, and the cap. */
+#define WARMUP_WINDOWS		(5)
+#define WARMUP_WINDOW_MS	(2)
+#define WARMUP_MAX_MS		(2000)
+
 /* Optimal Values for Inline */
 #define DEF_INLINE_WRITE (220)
 #define DEF_INLINE_SEND_RC_UC (236)
@@ -185,6 +249,10 @@
 
 #define RESULT_EXT_CPU_UTIL "    CPU_Util[%%]\n"
 
+#define RESULT_EXT_WS "   Working set[B]"
+
+#define RESULT_EXT_SGE "   SGEs"
+
 /* Result print format */
 #define REPORT_FMT     " %-7lu    %-10lu       %-7.2lf            %-7.2lf		   %-7.6lf"
 
@@ -196,6 +264,72 @@
 
 #define REPORT_EXT_CPU_UTIL	"	    %-3.2f\n"
 
+#define REPORT_EXT_WS	"	   %-12lu"
+
+#define REPORT_EXT_SGE	"	   %-4d"
+
+#define RESULT_EXT_SWEEP "   QPs    tx_depth    post_list    cq_mod"
+
+#define REPORT_EXT_SWEEP	"	   %-6d %-11d %-12d %-6d"
+
+#define RESULT_EXT_INLINE "   Inline"
+
+#define REPORT_EXT_INLINE	"	   %-6d"
+
+#define RESULT_EXT_P99	"   p99[usec]"
+
+#define REPORT_EXT_P99	"	   %-9.2lf"
+
+#define RESULT_EXT_CI	"   CI95[%%]"
+
+#define RESULT_EXT_WARMUP "   Warm-up[ms]"
+
+#define REPORT_EXT_WARMUP	"	   %-9.2lf"
+
+#define REPORT_EXT_CI	"	   %-7.2lf"
+
+#define RESULT_FMT_SIZE_CLASS	" Size class[B]    Msgs[%%]    BW average         MsgRate[Mpps]\n"
+
+#define REPORT_FMT_SIZE_CLASS	" <= %-10lu    %-7.2lf    %-7.2lf            %-7.6lf\n"
+
+#define RESULT_FMT_MIX	" Verb       Msgs[%%]    BW average         MsgRate[Mpps]    t_avg[usec]    t_min[usec]    t_max[usec]\n"
+
+#define REPORT_FMT_MIX	" %-8s   %-7.2lf    %-7.2lf            %-7.6lf         %-7.2lf        %-7.2lf        %-7.2lf\n"
+
+#define RESULT_FMT_ALLREDUCE	" #bytes     #iterations    t_avg[usec]    algbw[MB/sec]    busbw[MB/sec]    step avg[usec]    step max[usec]\n"
+
+#define RESULT_FMT_G_ALLREDUCE	" #bytes     #iterations    t_avg[usec]    algbw[Gb/sec]    busbw[Gb/sec]    step avg[usec]    step max[usec]\n"
+
+#define REPORT_FMT_ALLREDUCE	" %-7lu    %-10d       %-7.2lf        %-7.2lf          %-7.2lf          %-7.2lf           %-7.2lf\n"
+
+#define RESULT_FMT_FANOUT	" Destination            Msgs[%%]    BW average         MsgRate[Mpps]    t_avg[usec]    t_min[usec]    t_max[usec]\n"
+
+#define REPORT_FMT_FANOUT	" %-20s   %-7.2lf    %-7.2lf            %-7.6lf         %-7.2lf        %-7.2lf        %-7.2lf\n"
+
+#define RESULT_FMT_COMPARE	" #bytes     Metric      Baseline        Current         Change[%%]    Rows      Verdict\n"
+
+#define REPORT_FMT_COMPARE	" %-10lu %-11s %-15.4lf %-15.4lf %-+12.2lf %d/%-7d %s\n"
+
+#define REPORT_FMT_COMPARE_NONE	" %-10lu %-11s -               %-15.4lf -            -         no baseline\n"
+
+#define RESULT_FMT_LOAD_LAT	" Load[%%]   Offered[Mpps]   MsgRate[Mpps]   BW average     Probes     t_min[usec]   t_typical[usec]   t_99%%[usec]   t_99.9%%[usec]   t_max[usec]\n"
+
+#define REPORT_FMT_LOAD_LAT	" %-9d %-15.3lf %-15.3lf %-14.2lf %-10d %-13.2lf %-17.2lf %-13.2lf %-15.2lf %-7.2lf\n"
+
+#define RESULT_FMT_CONTENTION	" Addresses  Distribution   MsgRate[Mpps]   Ops        t_min[usec]   t_typical[usec]   t_99%%[usec]   t_99.9%%[usec]   t_max[usec]"
+
+#define RESULT_EXT_CONTENTION_CAS "   CAS success[%%]   Retries/inc\n"
+
+#define REPORT_FMT_CONTENTION	" %-10d %-14s %-15.3lf %-10lu %-13.2lf %-17.2lf %-13.2lf %-15.2lf %-13.2lf"
+
+#define REPORT_EXT_CONTENTION_CAS " %-16.2lf %-7.2lf\n"
+
+#define REPORT_FMT_LOAD_LAT_NONE " %-9d %-15.3lf %-15.3lf %-14.2lf 0\n"
+
+#define RESULT_FMT_REPEAT	" Metric                 Mean           Stddev         CI95[+-]       CI95[%%]\n"
+
+#define REPORT_FMT_REPEAT	" %-20s   %-12.4lf   %-12.4lf   %-12.4lf   %-7.2lf\n"
+
 #define REPORT_FMT_QOS " %-7lu    %d           %lu           %-7.2lf            %-7.2lf                  %-7.6lf\n"
 
 /* Result print format for latency tests. */
@@ -267,6 +401,21 @@ enum ctx_device {
 /* Units for rate limiter */
 enum rate_limiter_units {MEGA_BYTE_PS, GIGA_BIT_PS, PACKET_PS};
 
+/* Page type backing the data buffers */
+enum hugepage_type {HUGEPAGE_OFF, HUGEPAGE_2M, HUGEPAGE_1G, HUGEPAGE_THP};
+
+/* NUMA placement of memory and polling thread */
+enum numa_mode {NUMA_OFF, NUMA_AUTO, NUMA_USER};
+
+/* Address pattern over the working set */
+enum access_pattern {ACCESS_SEQ, ACCESS_STRIDE, ACCESS_RANDOM};
+
+/* Message size distribution type */
+enum size_dist_type {SIZE_DIST_NONE, SIZE_DIST_UNIFORM, SIZE_DIST_WEIGHTED};
+
+/* Placement of the SGEs of a WR */
+enum sge_spread {SGE_SPREAD_LINE, SGE_SPREAD_PAGE, SGE_SPREAD_MR};
+
 /* Verbosity Levels for test report */
 enum verbosity_level {FULL_VERBOSITY=-1, OUTPUT_BW=0, OUTPUT_MR, OUTPUT_LAT };
 
@@ -282,12 +431,123 @@ struct cpu_util_data {
 	long long idle[2];
 };
 
+/* Deadline of a timer that is not armed. */
+#define TIMER_NEVER (~(cycles_t)0)
+
 struct check_alive_data {
 	int current_totrcnt;
 	int last_totrcnt;
 	int g_total_iters;
 	int to_exit;
-	int is_events;
+	cycles_t deadline;
+};
+
+/* Message size distribution. Weighted covers fixed, bimodal, list and CDF
+ * file inputs. posted_msgs/posted_bytes count what the client posted in each
+ * power of 2 size class (class c holds sizes in (2^(c-1), 2^c]).
+ */
+struct size_dist {
+	enum size_dist_type	type;
+	int			num_of_entries;
+	uint64_t		sizes[MAX_SIZE_DIST_ENTRIES];
+	double			weights[MAX_SIZE_DIST_ENTRIES];
+	double			total_weight;
+	uint64_t		min_size;
+	uint64_t		max_size;
+	double			avg_size;
+	uint64_t		posted_msgs[SIZE_DIST_CLASSES];
+	uint64_t		posted_bytes[SIZE_DIST_CLASSES];
+};
+
+/* Verb mix on a shared QP set (indexed by VerbType, SEND..READ). ring holds
+ * the verb of each message slot; the msgs and lat_* counters are filled by
+ * the client during the run (latency is post to completion of signaled WRs).
+ */
+struct verb_mix {
+	int			weights[MIX_NUM_OF_VERBS];
+	int			total_weight;
+	uint8_t			ring[MIX_RING_LEN];
+	uint64_t		msgs[MIX_NUM_OF_VERBS];
+	uint64_t		lat_samples[MIX_NUM_OF_VERBS];
+	cycles_t		lat_sum[MIX_NUM_OF_VERBS];
+	cycles_t		lat_min[MIX_NUM_OF_VERBS];
+	cycles_t		lat_max[MIX_NUM_OF_VERBS];
+};
+
+/* The parameters a sweep can vary between points over one connection. */
+enum sweep_param {
+	SWEEP_SIZE,
+	SWEEP_QPS,
+	SWEEP_TX_DEPTH,
+	SWEEP_POST_LIST,
+	SWEEP_CQ_MOD,
+	SWEEP_PARAMS
+};
+
+/* What --autotune optimizes. */
+enum autotune_goal {
+	AUTOTUNE_OFF,
+	AUTOTUNE_RATE,
+	AUTOTUNE_P99
+};
+
+struct sweep_dim {
+	int			count;
+	uint64_t		val[MAX_SWEEP_VALUES];
+};
+
+/* The metrics --compare checks, two per row: BW rows, then latency rows. */
+enum results_metric {
+	RESULTS_BW,
+	RESULTS_MSG_RATE,
+	RESULTS_LAT,
+	RESULTS_P99,
+	RESULTS_METRICS
+};
+
+/* val holds BW and msg rate, or median and p99 latency. */
+struct results_row {
+	uint64_t		size;
+	int			is_lat;
+	double			val[2];
+};
+
+/* One level of --contention: addrs remote 8 byte words, picked uniformly or with Zipf skew zipf. */
+struct contention_level {
+	int			addrs;
+	double			zipf;
+};
+
+/* --results output and the --compare baseline. */
+struct results_data {
+	char			*file;
+	FILE			*fp;
+	char			*baseline;
+	double			tol[RESULTS_METRICS];
+	struct results_row	*rows;
+	int			num_rows;
+	char			*cmdline;
+	char			fw_ver[64];
+	char			kernel[65];
+};
+
+/*
+ * One sample per trial of --repeat. Metric 0 (BW average or median latency)
+ * drives the outlier rejection and the early stop.
+ */
+struct repeat_stats {
+	int			trials;
+	double			sample[REPEAT_METRICS][MAX_REPEAT];
+};
+
+struct fanout_dest {
+	char			*host;
+	int			port;
+	uint64_t		msgs;
+	uint64_t		lat_samples;
+	cycles_t		lat_sum;
+	cycles_t		lat_min;
+	cycles_t		lat_max;
 };
 
 struct perftest_parameters {
@@ -409,7 +669,7 @@ struct perftest_parameters {
 	int				check_alive_exited;
 	int				raw_mcast;
 	int				masked_atomics;
-	int				cycle_buffer;
+	uint64_t			cycle_buffer;
 	int				cache_line_size;
 	enum verbs_intf			verb_type;
 	int				is_exp_cq;
@@ -417,6 +677,71 @@ struct perftest_parameters {
 	int				use_res_domain;
 	int				mr_per_qp;
 	uint16_t			dlid;
+	enum hugepage_type		use_hugepages;
+	enum numa_mode			numa_mode;
+	int				numa_node;
+	int				numa_cpu;
+	uint64_t			working_set;
+	uint64_t			working_set_max;
+	enum access_pattern		access_pattern;
+	int				access_stride;
+	struct size_dist		size_dist;
+	struct verb_mix			mix;
+	int				num_sge;
+	int				num_sge_max;
+	enum sge_spread			sge_spread;
+	int				sge_layout_entries;
+	uint32_t			sge_layout[MAX_SGE];
+	int				recv_batch;
+	int				num_devices;
+	char				*devices[MAX_DEVICES];
+	int				device_ports[MAX_DEVICES];
+	int				incast;
+	int				incast_sockfd;
+	int				incast_ready_fd;
+	int				incast_go_fd;
+	int				num_servers;
+	int				fanout_same_buf;
+	struct fanout_dest		fanout[MAX_FANOUT];
+	int				is_collective;
+	int				ring_size;
+	int				ring_rank;
+	int				ring_send;
+	char				*ring_hosts[MAX_RING_RANKS];
+	int				is_sweep;
+	struct sweep_dim		sweep[SWEEP_PARAMS];
+	int				autotune;
+	double				tune_p99;
+	struct results_data		results;
+	int				load_lat_steps;
+	int				load_lat[MAX_LOAD_STEPS];
+	int				qd;
+	int				qd_samples;
+	int				contention_levels;
+	struct contention_level		contention[MAX_CONTENTION_LEVELS];
+	int				cas_retry;
+	int				ud_dests;
+	int				ud_dest_random;
+	int				adaptive;
+	int				target_time_ms;
+	double				target_ci;
+	double				achieved_ci;
+	int				repeat;
+	double				repeat_ci;
+	struct repeat_stats		repeat_stats;
+	double				warmup_tol;
+	double				warmup_ms;
+	int				warmup_stable;
+	double				cycles_per_sec;
+	cycles_t			timer_deadline;
+	struct check_alive_data		alive;
+	int				event_spin;
+	cycles_t			event_spin_cycles;
+	int				cq_moderation_count;
+	int				cq_moderation_period;
+	uint64_t			event_wakeups;
+	cycles_t			event_start;
+	double				event_cpu_start;
 };
 
 struct report_options {
@@ -552,6 +877,94 @@ void print_report_lat (struct perftest_parameters *user_param);
  */
 void print_report_lat_duration (struct perftest_parameters *user_param);
 
+/* student_t95
+ *
+ * Description : Two sided 95% quantile of the Student t distribution.
+ *
+ * Parameters :
+ *
+ *   dof  - degrees of freedom, the number of samples minus one.
+ *
+ * Return Value : The quantile, the normal one above 30 degrees of freedom.
+ */
+double student_t95(int dof);
+
+/* repeat_more_trials
+ *
+ * Description : Decides on the client whether --repeat runs another trial.
+ *				 It stops at the trial count, or once the confidence interval of
+ *				 metric 0 is within --repeat_ci after REPEAT_MIN_TRIALS trials.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *
+ * Return Value : 1 for another trial, 0 to stop.
+ */
+int repeat_more_trials(struct perftest_parameters *user_param);
+
+/* print_repeat_stats
+ *
+ * Description : Prints the mean, stddev and 95% confidence interval of the
+ *				 trials of --repeat. Trials whose metric 0 is more than 3 scaled
+ *				 MADs away from the median are flagged and left out.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *
+ */
+void print_repeat_stats(struct perftest_parameters *user_param);
+
+/* results_finish
+ *
+ * Description : Closes the --results file, then with --compare checks the rows
+ *				 of this run against the baseline file. A metric regresses when
+ *				 it is worse by more than its tolerance and, with several rows
+ *				 per size on both sides, Welch's t-test finds the change at 95%.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *
+ * Return Value : SUCCESS, FAILURE on a regression or a baseline that can't be used.
+ */
+int results_finish(struct perftest_parameters *user_param);
+
+/* size_dist_class
+ *
+ * Description : The power of 2 size class of a message size.
+ *
+ * Parameters :
+ *
+ *   size  - the message size.
+ *
+ * Return Value : c, such that size is in (2^(c-1), 2^c].
+ */
+int size_dist_class(uint64_t size);
+
+/* cycles_compare
+ *
+ * Description : qsort comparator of cycles_t samples, in ascending order.
+ *
+ */
+int cycles_compare(const void *aptr, const void *bptr);
+
+/* print_hist_buckets
+ *
+ * Description : Prints " <bound>:<count>" for the log2 buckets of sorted
+ *				 samples, doubling from RESULTS_HIST_MIN, only the non empty ones.
+ *
+ * Parameters :
+ *
+ *   fp     - where to print.
+ *   s      - the samples, sorted in ascending order.
+ *   n      - number of samples.
+ *   scale  - divides a sample into the units of the buckets.
+ *
+ */
+void print_hist_buckets(FILE *fp, const cycles_t *s, uint64_t n, double scale);
+
 /* set_mtu
  *
  * Description : set MTU from the port or user
@@ -583,4 +996,13 @@ int set_eth_mtu(struct perftest_parameters *user_param);
  ******************************************************************************/
 enum ctx_device ib_dev_name(struct ibv_context *context);
 
+/* get_thread_cpu_time
+ *
+ * Description : CPU time consumed so far by the calling thread.
+ *	Used to report the polling cost of the hybrid event mode.
+ *
+ * Return Value : CPU time in seconds.
+ */
+double get_thread_cpu_time(void);
+
 #endif /* PERFTEST_RESOURCES_H */
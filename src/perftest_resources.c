@@ -10,6 +10,13 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
 
 #include "perftest_resources.h"
 #include "config.h"
@@ -23,8 +30,13 @@ static enum ibv_wr_opcode opcode_atomic_array[] = {IBV_WR_ATOMIC_CMP_AND_SWP,IBV
 
 #define CPU_UTILITY "/proc/stat"
 
-struct perftest_parameters* duration_param;
-struct check_alive_data check_alive_data;
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED (1)
+#endif
+#define NUMA_MAX_NODES (1024)
+/* Bounds the working set address table, larger sets use coarser steps. */
+#define MAX_WS_ENTRIES (1 << 20)
+
 
 /******************************************************************************
  * Beginning
@@ -157,6 +169,74 @@ static int pp_free_mmap(struct pingpong_context *ctx)
 	return 0;
 }
 
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define HUGEPAGE_2M_SIZE (1UL << 21)
+#define HUGEPAGE_1G_SIZE (1UL << 30)
+
+/* Huge pages are always mapped in full pages, so the length handed to
+ * mmap/munmap is the buffer size rounded up to the page size.
+ */
+static size_t hugepage_alloc_size(size_t size, enum hugepage_type type)
+{
+	size_t page = (type == HUGEPAGE_1G) ? HUGEPAGE_1G_SIZE : HUGEPAGE_2M_SIZE;
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+static void *pp_init_hugepages(size_t size, enum hugepage_type type)
+{
+	void *buf;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t alloc_size = hugepage_alloc_size(size, type);
+
+	if (type == HUGEPAGE_THP) {
+		buf = memalign(HUGEPAGE_2M_SIZE, alloc_size);
+		if (!buf) {
+			fprintf(stderr, "Unable to allocate THP buffer of size %zd\n", alloc_size);
+			return NULL;
+		}
+		#ifdef MADV_HUGEPAGE
+		if (madvise(buf, alloc_size, MADV_HUGEPAGE))
+			fprintf(stderr, "madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+		#else
+		fprintf(stderr, "MADV_HUGEPAGE is not supported, using regular pages\n");
+		#endif
+		return buf;
+	}
+
+	#ifdef MAP_HUGETLB
+	flags |= MAP_HUGETLB | ((type == HUGEPAGE_1G) ? MAP_HUGE_1GB : MAP_HUGE_2MB);
+	buf = mmap(NULL, alloc_size, PROT_WRITE | PROT_READ, flags, -1, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "Unable to mmap %zd bytes of %s hugepages: %s\n", alloc_size,
+			(type == HUGEPAGE_1G) ? "1G" : "2M", strerror(errno));
+		fprintf(stderr, "Please check /sys/kernel/mm/hugepages/ for free pages\n");
+		return NULL;
+	}
+	return buf;
+	#else
+	fprintf(stderr, "MAP_HUGETLB is not supported on this system\n");
+	return NULL;
+	#endif
+}
+
+static void pp_free_hugepages(void *buf, size_t size, enum hugepage_type type)
+{
+	if (type == HUGEPAGE_THP)
+		free(buf);
+	else
+		munmap(buf, hugepage_alloc_size(size, type));
+}
+
 #ifdef HAVE_VERBS_EXP
 static void get_verbs_pointers(struct pingpong_context *ctx)
 {
@@ -625,6 +705,126 @@ struct ibv_device* ctx_find_dev(const char *ib_devname)
 	return ib_dev;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int read_sysfs_int(const char *path)
+{
+	FILE *file;
+	int value = -1;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	if (fscanf(file, "%d", &value) != 1)
+		value = -1;
+
+	fclose(file);
+	return value;
+}
+
+/******************************************************************************
+ * Parses a sysfs cpulist (e.g. "0-7,16-23") and returns the first CPU in it
+ * that the process is allowed to run on (respecting taskset), or -1.
+ ******************************************************************************/
+static int first_allowed_cpu(const char *path)
+{
+	FILE *file;
+	char list[4096];
+	char *ptr;
+	cpu_set_t allowed;
+	int start, end, cpu;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	if (!fgets(list, sizeof(list), file)) {
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	ptr = list;
+	while (isdigit(*ptr)) {
+		start = strtol(ptr, &ptr, 10);
+		end = start;
+		if (*ptr == '-')
+			end = strtol(ptr + 1, &ptr, 10);
+
+		for (cpu = start; cpu <= end && cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed))
+				return cpu;
+		}
+
+		if (*ptr != ',')
+			break;
+		ptr++;
+	}
+
+	return -1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_set_numa_placement(struct ibv_device *ib_dev, struct perftest_parameters *user_param)
+{
+	char path[256];
+	unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	int bits_per_long = 8 * sizeof(unsigned long);
+	cpu_set_t cpu_set;
+	int cpu;
+
+	if (user_param->numa_mode == NUMA_OFF)
+		return SUCCESS;
+
+	if (user_param->numa_mode == NUMA_AUTO) {
+		snprintf(path, sizeof(path), "/sys/class/infiniband/%s/device/numa_node", ibv_get_device_name(ib_dev));
+		user_param->numa_node = read_sysfs_int(path);
+
+		if (user_param->numa_node < 0) {
+			fprintf(stderr, " Device %s reports no NUMA affinity, skipping NUMA placement\n", ibv_get_device_name(ib_dev));
+			return SUCCESS;
+		}
+	}
+
+	if (user_param->numa_node < 0 || user_param->numa_node >= NUMA_MAX_NODES) {
+		fprintf(stderr, " Invalid NUMA node %d\n", user_param->numa_node);
+		return FAILURE;
+	}
+
+	/* Everything allocated from now on (buffers, CQ/QP rings, measurement arrays) prefers the node. */
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[user_param->numa_node / bits_per_long] |= 1UL << (user_param->numa_node % bits_per_long);
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, NUMA_MAX_NODES + 1)) {
+		fprintf(stderr, " Couldn't bind memory to NUMA node %d: %s\n", user_param->numa_node, strerror(errno));
+		return FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", user_param->numa_node);
+	cpu = first_allowed_cpu(path);
+	if (cpu < 0) {
+		fprintf(stderr, " No allowed CPU found on NUMA node %d\n", user_param->numa_node);
+		return FAILURE;
+	}
+
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set)) {
+		fprintf(stderr, " Couldn't pin polling thread to CPU %d: %s\n", cpu, strerror(errno));
+		return FAILURE;
+	}
+
+	user_param->numa_cpu = cpu;
+	return SUCCESS;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -645,6 +845,12 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 	if (user_param->tst == LAT && user_param->test_type == DURATION)
 		ALLOCATE(user_param->tcompleted, cycles_t, 1);
 
+	/* Pipelined latency keeps one timestamp per slot and one sample per operation. */
+	if (user_param->tst == LAT && user_param->qd > 1) {
+		ALLOCATE(user_param->tcompleted, cycles_t, user_param->iters);
+		ALLOCATE(ctx->qd_slot, cycles_t, user_param->qd);
+	}
+
 	ALLOCATE(ctx->qp, struct ibv_qp*, user_param->num_of_qps);
 	ALLOCATE(ctx->mr, struct ibv_mr*, user_param->num_of_qps);
 	ALLOCATE(ctx->buf, void* , user_param->num_of_qps);
@@ -675,6 +881,12 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 		memset(ctx->scnt, 0, user_param->num_of_qps * sizeof (uint64_t));
 		memset(ctx->ccnt, 0, user_param->num_of_qps * sizeof (uint64_t));
 
+		if (user_param->mix.total_weight || user_param->num_servers > 1 || user_param->autotune == AUTOTUNE_P99)
+			ALLOCATE(ctx->mix_tposted,cycles_t,user_param->num_of_qps * user_param->tx_depth);
+
+		if (user_param->autotune == AUTOTUNE_P99)
+			ALLOCATE(ctx->tune_lat,cycles_t,AUTOTUNE_LAT_SAMPLES);
+
 	} else if ((user_param->tst == BW ) && user_param->verb == SEND && user_param->machine == SERVER) {
 
 		ALLOCATE(ctx->my_addr,uint64_t,user_param->num_of_qps);
@@ -684,6 +896,8 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 	if (user_param->machine == CLIENT || user_param->tst == LAT || user_param->duplex) {
 
 		ALLOCATE(ctx->sge_list,struct ibv_sge,user_param->num_of_qps*user_param->post_list);
+		if (user_param->num_sge_max > 1)
+			ALLOCATE(ctx->sge_gather,struct ibv_sge,user_param->num_of_qps*user_param->num_sge_max);
 		#ifdef HAVE_VERBS_EXP
 		ALLOCATE(ctx->exp_wr,struct ibv_exp_send_wr,user_param->num_of_qps*user_param->post_list);
 		#endif
@@ -696,12 +910,51 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 	if (user_param->verb == SEND && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex)) {
 
 		ALLOCATE(ctx->recv_sge_list,struct ibv_sge,user_param->num_of_qps);
+		if (user_param->num_sge_max > 1)
+			ALLOCATE(ctx->recv_sge_gather,struct ibv_sge,user_param->num_of_qps*user_param->num_sge_max);
 		ALLOCATE(ctx->rwr,struct ibv_recv_wr,user_param->num_of_qps);
 		ALLOCATE(ctx->rx_buffer_addr,uint64_t,user_param->num_of_qps);
+
+		if (user_param->recv_batch > 1) {
+			ALLOCATE(ctx->rx_batch_wr,struct ibv_recv_wr,user_param->num_of_qps*user_param->recv_batch);
+			ALLOCATE(ctx->rx_batch_sge,struct ibv_sge,user_param->num_of_qps*user_param->recv_batch*user_param->num_sge_max);
+			ALLOCATE(ctx->rx_batch_pending,int,user_param->num_of_qps);
+			memset(ctx->rx_batch_pending,0,sizeof(int)*user_param->num_of_qps);
+		}
 	}
 	if (user_param->mac_fwd == ON )
 		ctx->cycle_buffer = user_param->size * user_param->rx_depth;
 
+	/* Each QP region holds the largest gather list, with every SGE on its own page. */
+	if (user_param->num_sge_max > 1) {
+		uint64_t span = user_param->size + user_param->num_sge_max * sysconf(_SC_PAGESIZE);
+		ctx->cycle_buffer = ((span + user_param->cycle_buffer - 1) / user_param->cycle_buffer) * user_param->cycle_buffer;
+	}
+
+	/* Each slot of a pipelined write latency test polls a region of its own. */
+	if (user_param->tst == LAT && user_param->verb == WRITE && user_param->qd > 1) {
+		uint64_t span = (uint64_t)user_param->qd * INC(user_param->size, user_param->cache_line_size);
+		ctx->cycle_buffer = ((span + user_param->cycle_buffer - 1) / user_param->cycle_buffer) * user_param->cycle_buffer;
+	}
+
+	/* Contention words sit one cache line apart, and each send slot fetches into a word of its own. */
+	if (user_param->contention_levels) {
+		uint64_t span = user_param->tx_depth * sizeof(uint64_t);
+		int k;
+
+		for (k = 0; k < user_param->contention_levels; k++) {
+			if ((uint64_t)user_param->contention[k].addrs * user_param->cache_line_size > span)
+				span = (uint64_t)user_param->contention[k].addrs * user_param->cache_line_size;
+		}
+		ctx->cycle_buffer = ((span + user_param->cycle_buffer - 1) / user_param->cycle_buffer) * user_param->cycle_buffer;
+	}
+
+	/* Each QP region spans the largest working set, rounded to full pages. */
+	if (user_param->working_set) {
+		uint64_t ws = (user_param->working_set_max) ? user_param->working_set_max : user_param->working_set;
+		ctx->cycle_buffer = ((ws + user_param->cycle_buffer - 1) / user_param->cycle_buffer) * user_param->cycle_buffer;
+	}
+
 	ctx->size = user_param->size;
 
 	num_of_qps_factor = (user_param->mr_per_qp) ? 1 : user_param->num_of_qps;
@@ -727,6 +980,18 @@ int destroy_ctx(struct pingpong_context *ctx,
 	if (user_param->work_rdma_cm == ON)
 		rdma_disconnect(ctx->cm_id);
 
+	if (ctx->ud_ah) {
+		for (i = 0; i < user_param->ud_dests; i++) {
+			if (ctx->ud_ah[i] && ibv_destroy_ah(ctx->ud_ah[i])) {
+				fprintf(stderr, "failed to destroy AH\n");
+				test_result = 1;
+			}
+		}
+		free(ctx->ud_ah);
+		free(ctx->ud_qpn);
+		free(ctx->ud_ring);
+	}
+
 	/* in dc with bidirectional,
 	 * there are send qps and recv qps. the actual number of send/recv qps
 	 * is num_of_qps / 2.
@@ -808,6 +1073,11 @@ int destroy_ctx(struct pingpong_context *ctx,
 		test_result = 1;
 	}
 
+	if (ctx->probe_cq && ibv_destroy_cq(ctx->probe_cq)) {
+		fprintf(stderr, "failed to destroy the probe CQ\n");
+		test_result = 1;
+	}
+
 	if (user_param->verb == SEND && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex || (ctx->channel)) ) {
 		if (!(user_param->connection_type == DC && user_param->machine == SERVER)) {
 			if (ibv_destroy_cq(ctx->recv_cq)) {
@@ -824,6 +1094,18 @@ int destroy_ctx(struct pingpong_context *ctx,
 		}
 	}
 
+	if (ctx->sge_mr) {
+		for (i = 0; i < user_param->num_sge_max - 1; i++) {
+			if (ibv_dereg_mr(ctx->sge_mr[i])) {
+				fprintf(stderr, "failed to deregister SGE MR #%d\n", i+1);
+				test_result = 1;
+			}
+			free(ctx->sge_buf[i]);
+		}
+		free(ctx->sge_mr);
+		free(ctx->sge_buf);
+	}
+
 	if (user_param->verb == SEND && user_param->work_rdma_cm == ON && ctx->send_rcredit) {
 		if (ibv_dereg_mr(ctx->credit_mr)) {
 			fprintf(stderr, "Failed to deregister send credit MR\n");
@@ -861,6 +1143,10 @@ int destroy_ctx(struct pingpong_context *ctx,
 	#endif
 	if (user_param->mmap_file != NULL) {
 		pp_free_mmap(ctx);
+	} else if (user_param->use_hugepages != HUGEPAGE_OFF) {
+		for (i = 0; i < dereg_counter; i++) {
+			pp_free_hugepages(ctx->buf[i], ctx->buff_size, user_param->use_hugepages);
+		}
 	} else if (ctx->is_contig_supported == FAILURE) {
 		for (i = 0; i < dereg_counter; i++) {
 			free(ctx->buf[i]);
@@ -868,6 +1154,35 @@ int destroy_ctx(struct pingpong_context *ctx,
 	}
 	free(ctx->qp);
 
+	if (ctx->ws_offsets)
+		free(ctx->ws_offsets);
+
+	if (ctx->size_ring)
+		free(ctx->size_ring);
+
+	if (ctx->mix_tposted)
+		free(ctx->mix_tposted);
+
+	if (ctx->tune_lat)
+		free(ctx->tune_lat);
+
+	if (ctx->qd_slot) {
+		free(ctx->qd_slot);
+		free(user_param->tcompleted);
+	}
+
+	if (ctx->sge_gather)
+		free(ctx->sge_gather);
+
+	if (ctx->recv_sge_gather)
+		free(ctx->recv_sge_gather);
+
+	if (ctx->rx_batch_wr) {
+		free(ctx->rx_batch_wr);
+		free(ctx->rx_batch_sge);
+		free(ctx->rx_batch_pending);
+	}
+
 	if ((user_param->tst == BW ) && (user_param->machine == CLIENT || user_param->duplex)) {
 
 		free(user_param->tposted);
@@ -1047,6 +1362,43 @@ int create_exp_cqs(struct pingpong_context *ctx,
 }
 #endif
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ctx_set_cq_moderation(struct ibv_cq *cq, struct perftest_parameters *user_param)
+{
+	#if defined(HAVE_MODIFY_CQ)
+	struct ibv_modify_cq_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+	attr.moderate.cq_count = user_param->cq_moderation_count;
+	attr.moderate.cq_period = user_param->cq_moderation_period;
+
+	if (ibv_modify_cq(cq, &attr)) {
+		fprintf(stderr, "Couldn't set CQ moderation\n");
+		return FAILURE;
+	}
+	#elif defined(HAVE_EXP_CQ_MODERATION)
+	struct ibv_exp_cq_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.comp_mask = IBV_EXP_CQ_ATTR_MODERATION;
+	attr.moderation.cq_count = user_param->cq_moderation_count;
+	attr.moderation.cq_period = user_param->cq_moderation_period;
+
+	if (ibv_exp_modify_cq(cq, &attr, IBV_EXP_CQ_MODERATION)) {
+		fprintf(stderr, "Couldn't set CQ moderation\n");
+		return FAILURE;
+	}
+	#else
+	fprintf(stderr, "CQ moderation is not supported by this build\n");
+	return FAILURE;
+	#endif
+
+	return SUCCESS;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1073,6 +1425,20 @@ int create_cqs(struct pingpong_context *ctx, struct perftest_parameters *user_pa
 	#endif
 		ret = create_reg_cqs(ctx, user_param, tx_buffer_depth, need_recv_cq);
 
+	if (ret == SUCCESS && user_param->cq_moderation_count) {
+		ret = ctx_set_cq_moderation(ctx->send_cq, user_param);
+		if (ret == SUCCESS && need_recv_cq)
+			ret = ctx_set_cq_moderation(ctx->recv_cq, user_param);
+	}
+
+	if (ret == SUCCESS && user_param->load_lat_steps) {
+		ctx->probe_cq = ibv_create_cq(ctx->context,user_param->tx_depth,NULL,NULL,0);
+		if (!ctx->probe_cq) {
+			fprintf(stderr, "Couldn't create the probe CQ\n");
+			ret = FAILURE;
+		}
+	}
+
 	return ret;
 }
 
@@ -1120,6 +1486,7 @@ struct ibv_exp_res_domain* create_res_domain(struct pingpong_context *ctx, struc
 int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *user_param, int qp_index)
 {
 	int flags = IBV_ACCESS_LOCAL_WRITE;
+	cycles_t reg_start;
 
 	#ifdef HAVE_VERBS_EXP
 	struct ibv_exp_reg_mr_in reg_mr_exp_in;
@@ -1157,6 +1524,16 @@ int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *u
 			return 1;
 		}
 
+	} else if (user_param->use_hugepages != HUGEPAGE_OFF) {
+		/* Hugepages are allocated by us, so contig pages are not used. */
+		ctx->is_contig_supported = FAILURE;
+		ctx->buf[qp_index] = pp_init_hugepages(ctx->buff_size, user_param->use_hugepages);
+		if (!ctx->buf[qp_index]) {
+			fprintf(stderr, "Couldn't allocate work buf.\n");
+			return 1;
+		}
+
+		memset(ctx->buf[qp_index], 0, ctx->buff_size);
 	} else {
 		/* Allocating buffer for data, in case driver not support contig pages. */
 		if (ctx->is_contig_supported == FAILURE) {
@@ -1199,7 +1576,16 @@ int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *u
 		#endif
 	}
 
+	/* A verb mix registers one MR with the union of the access flags. */
+	if (user_param->mix.total_weight) {
+		flags |= IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ;
+		#ifdef HAVE_VERBS_EXP
+		exp_flags |= IBV_EXP_ACCESS_REMOTE_WRITE | IBV_EXP_ACCESS_REMOTE_READ;
+		#endif
+	}
+
 	/* Allocating Memory region and assigning our buffer to it. */
+	reg_start = get_cycles();
 	#ifdef HAVE_VERBS_EXP
 	if (ctx->is_contig_supported == SUCCESS || user_param->use_odp) {
 		reg_mr_exp_in.pd = ctx->pd;
@@ -1220,6 +1606,7 @@ int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *u
 		fprintf(stderr, "Couldn't allocate MR\n");
 		return 1;
 	}
+	ctx->mr_reg_cycles += get_cycles() - reg_start;
 
 	if (ctx->is_contig_supported == SUCCESS)
 		ctx->buf[qp_index] = ctx->mr[qp_index]->addr;
@@ -1233,6 +1620,9 @@ int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *u
 int create_mr(struct pingpong_context *ctx, struct perftest_parameters *user_param)
 {
 	int i;
+	int num_of_mrs = 1;
+
+	ctx->mr_reg_cycles = 0;
 
 	/* create first MR */
 	if (create_single_mr(ctx, user_param, 0)) {
@@ -1247,14 +1637,46 @@ int create_mr(struct pingpong_context *ctx, struct perftest_parameters *user_par
 				fprintf(stderr, "failed to create mr\n");
 				return 1;
 			}
+			num_of_mrs++;
 		} else {
 			ALLOCATE(ctx->mr[i], struct ibv_mr, 1);
 			memset(ctx->mr[i], 0, sizeof(struct ibv_mr));
 			ctx->mr[i] = ctx->mr[0];
 			ctx->buf[i] = ctx->buf[0] + (i*BUFF_SIZE(ctx->size, ctx->cycle_buffer));
+
+			/* Every fan-out group sends from the buffers of the first group. */
+			if (user_param->fanout_same_buf)
+				ctx->buf[i] = ctx->buf[i % (user_param->num_of_qps / user_param->num_servers)];
+		}
+	}
+
+	/* With --sge_spread=mr, SGE k > 0 of every WR lives in MR k, shared by the QPs. */
+	if (user_param->num_sge_max > 1 && user_param->sge_spread == SGE_SPREAD_MR) {
+		ALLOCATE(ctx->sge_buf, void*, user_param->num_sge_max - 1);
+		ALLOCATE(ctx->sge_mr, struct ibv_mr*, user_param->num_sge_max - 1);
+
+		for (i = 0; i < user_param->num_sge_max - 1; i++) {
+			ctx->sge_buf[i] = memalign(sysconf(_SC_PAGESIZE), ctx->size);
+			if (!ctx->sge_buf[i]) {
+				fprintf(stderr, "Couldn't allocate SGE buf.\n");
+				return 1;
+			}
+			memset(ctx->sge_buf[i], 0, ctx->size);
+
+			ctx->sge_mr[i] = ibv_reg_mr(ctx->pd, ctx->sge_buf[i], ctx->size, IBV_ACCESS_LOCAL_WRITE);
+			if (!ctx->sge_mr[i]) {
+				fprintf(stderr, "Couldn't allocate SGE MR\n");
+				return 1;
+			}
 		}
 	}
 
+	if (user_param->output == FULL_VERBOSITY) {
+		printf(" MR registration : %.2f[usec] for %d MR(s) of %lu[B]\n",
+			ctx->mr_reg_cycles / get_cpu_mhz(user_param->cpu_freq_f), num_of_mrs, ctx->buff_size);
+		printf(RESULT_LINE);
+	}
+
 	return 0;
 }
 
@@ -1279,6 +1701,10 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 
 	ctx->is_contig_supported  = check_for_contig_pages_support(ctx->context);
 
+	/* Calibrate the test timers here rather than when the data path starts them. */
+	if (user_param->test_type == DURATION || user_param->verb == SEND)
+		user_param->cycles_per_sec = get_cpu_mhz(user_param->cpu_freq_f) * 1000000;
+
 	/* Allocating an event channel if requested. */
 	if (user_param->use_event) {
 		ctx->channel = ibv_create_comp_channel(ctx->context);
@@ -1286,6 +1712,17 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 			fprintf(stderr, "Couldn't create completion channel\n");
 			return FAILURE;
 		}
+
+		/* The hybrid mode sleeps in poll() and drains the channel without blocking. */
+		if (user_param->event_spin >= 0) {
+			int flags = fcntl(ctx->channel->fd, F_GETFL);
+
+			if (flags < 0 || fcntl(ctx->channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+				fprintf(stderr, "Couldn't set the completion channel to non blocking\n");
+				return FAILURE;
+			}
+			user_param->event_spin_cycles = (cycles_t)user_param->event_spin * get_cpu_mhz(user_param->cpu_freq_f);
+		}
 	}
 
 	/* Allocating the Protection domain. */
@@ -1503,6 +1940,7 @@ int create_qp_main(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param, int i, int num_of_qps)
 {
 	int ret, query;
+	struct ibv_cq *send_cq = NULL;
 
 	/* flag that indicates that we are going to use exp QP */
 	query = (user_param->connection_type == DC);
@@ -1516,6 +1954,12 @@ int create_qp_main(struct pingpong_context *ctx,
 	if (query == 1)
 		user_param->is_exp_qp = 1;
 
+	/* The load-latency probe QP, the last one, completes on its own CQ. */
+	if (ctx->probe_cq && i == user_param->num_of_qps - 1) {
+		send_cq = ctx->send_cq;
+		ctx->send_cq = ctx->probe_cq;
+	}
+
 	#ifdef HAVE_VERBS_EXP
 	if (user_param->is_exp_qp)
 		ret = create_exp_qp_main(ctx, user_param, i, num_of_qps);
@@ -1523,6 +1967,9 @@ int create_qp_main(struct pingpong_context *ctx,
 	#endif
 		ret = create_reg_qp_main(ctx, user_param, i, num_of_qps);
 
+	if (send_cq)
+		ctx->send_cq = send_cq;
+
 	return ret;
 }
 
@@ -1580,7 +2027,7 @@ struct ibv_qp* ctx_exp_qp_create(struct pingpong_context *ctx,
 	attr.send_cq = ctx->send_cq;
 	attr.recv_cq = (user_param->verb == SEND) ? ctx->recv_cq : ctx->send_cq;
 	attr.cap.max_send_wr  = user_param->tx_depth;
-	attr.cap.max_send_sge = MAX_SEND_SGE;
+	attr.cap.max_send_sge = user_param->num_sge_max;
 	attr.cap.max_inline_data = user_param->inline_size;
 
 	if (user_param->use_srq && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex == ON)) {
@@ -1590,7 +2037,7 @@ struct ibv_qp* ctx_exp_qp_create(struct pingpong_context *ctx,
 	} else {
 		attr.srq = NULL;
 		attr.cap.max_recv_wr  = user_param->rx_depth;
-		attr.cap.max_recv_sge = MAX_RECV_SGE;
+		attr.cap.max_recv_sge = user_param->num_sge_max;
 	}
 
 	switch (user_param->connection_type) {
@@ -1628,7 +2075,7 @@ struct ibv_qp* ctx_qp_create(struct pingpong_context *ctx,
 	attr.send_cq = ctx->send_cq;
 	attr.recv_cq = (user_param->verb == SEND) ? ctx->recv_cq : ctx->send_cq;
 	attr.cap.max_send_wr  = user_param->tx_depth;
-	attr.cap.max_send_sge = MAX_SEND_SGE;
+	attr.cap.max_send_sge = user_param->num_sge_max;
 	attr.cap.max_inline_data = user_param->inline_size;
 
 	if (user_param->use_srq && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex == ON)) {
@@ -1638,7 +2085,7 @@ struct ibv_qp* ctx_qp_create(struct pingpong_context *ctx,
 	} else {
 		attr.srq = NULL;
 		attr.cap.max_recv_wr  = user_param->rx_depth;
-		attr.cap.max_recv_sge = MAX_RECV_SGE;
+		attr.cap.max_recv_sge = user_param->num_sge_max;
 	}
 
 	switch (user_param->connection_type) {
@@ -1865,6 +2312,8 @@ int ctx_modify_qp_to_init(struct ibv_qp *qp,struct perftest_parameters *user_par
 			case WRITE : attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE; break;
 			case SEND  : attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_LOCAL_WRITE;
 		}
+		if (user_param->mix.total_weight)
+			attr.qp_access_flags |= IBV_ACCESS_REMOTE_READ;
 		flags |= IBV_QP_ACCESS_FLAGS;
 	}
 
@@ -2095,6 +2544,49 @@ static int ctx_modify_qp_to_rts(struct ibv_qp *qp,
 	return ibv_modify_qp(qp,attr,flags);
 }
 
+/******************************************************************************
+ * Creates the --ud_dests table: entry j is an AH of its own to remote QP
+ * j % num_of_qps. Fills the pick ring of every QP, round robin from a start
+ * of its own or at random, and prints what the AHs took to create.
+ ******************************************************************************/
+static int ctx_create_ud_dests(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *dest,struct ibv_ah_attr *ah_attr)
+{
+	double		mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	cycles_t	start,cycles;
+	int		i,j;
+
+	ALLOCATE(ctx->ud_ah,struct ibv_ah*,user_param->ud_dests);
+	memset(ctx->ud_ah,0,sizeof(struct ibv_ah*) * user_param->ud_dests);
+	ALLOCATE(ctx->ud_qpn,uint32_t,user_param->ud_dests);
+	ALLOCATE(ctx->ud_ring,uint32_t,user_param->num_of_qps * UD_DEST_RING_LEN);
+
+	start = get_cycles();
+	for (j = 0; j < user_param->ud_dests; j++) {
+		ctx->ud_ah[j] = ibv_create_ah(ctx->pd,ah_attr);
+		if (!ctx->ud_ah[j]) {
+			fprintf(stderr, "Failed to create AH %d of the UD destination table\n",j);
+			return FAILURE;
+		}
+		ctx->ud_qpn[j] = dest[j % user_param->num_of_qps].qpn;
+	}
+	cycles = get_cycles() - start;
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		for (j = 0; j < UD_DEST_RING_LEN; j++) {
+			ctx->ud_ring[i * UD_DEST_RING_LEN + j] = user_param->ud_dest_random ?
+				lrand48() % user_param->ud_dests :
+				((uint64_t)i * user_param->ud_dests / user_param->num_of_qps + j) % user_param->ud_dests;
+		}
+	}
+
+	if (user_param->output == FULL_VERBOSITY && mhz > 0)
+		printf(" AH creation     : %d AHs in %.2f usec, %.3f usec per AH\n",
+			user_param->ud_dests, cycles / mhz, cycles / mhz / user_param->ud_dests);
+
+	return SUCCESS;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2112,6 +2604,7 @@ int ctx_connect(struct pingpong_context *ctx,
 	#endif
 	#endif
 	struct ibv_qp_attr attr;
+	struct ibv_ah_attr ud_ah_attr;
 	int xrc_offset = 0;
 
 	if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT)) {
@@ -2178,70 +2671,247 @@ int ctx_connect(struct pingpong_context *ctx,
 				fprintf(stderr, "Failed to create AH for UD\n");
 				return FAILURE;
 			}
+
+			if (i == 0)
+				ud_ah_attr = attr.ah_attr;
 		}
 
 		if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT))
 			xrc_offset = user_param->num_of_qps / 2;
 
 	}
+
+	if (user_param->ud_dests && user_param->machine == CLIENT)
+		return ctx_create_ud_dests(ctx,user_param,dest,&ud_ah_attr);
+
 	return SUCCESS;
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-void ctx_set_send_wqes(struct pingpong_context *ctx,
-		struct perftest_parameters *user_param,
-		struct pingpong_dest *rem_dest)
+void ctx_set_working_set(struct pingpong_context *ctx, struct perftest_parameters *user_param)
 {
+	uint64_t step = INC(user_param->size,ctx->cache_line_size);
+	uint64_t i, j, start, tmp;
 
-	#ifdef HAVE_VERBS_EXP
-	if (user_param->use_exp == 1) {
-		ctx_set_send_exp_wqes(ctx,user_param,rem_dest);
+	if (user_param->working_set > MAX_WS_ENTRIES * step) {
+		step = user_param->working_set / MAX_WS_ENTRIES;
+		step = INC(step,ctx->cache_line_size);
 	}
-	else {
-	#endif
-		ctx_set_send_reg_wqes(ctx,user_param,rem_dest);
-	#ifdef HAVE_VERBS_EXP
+
+	ctx->ws_entries = (user_param->size < user_param->working_set) ?
+		(user_param->working_set - user_param->size) / step + 1 : 1;
+
+	if (ctx->ws_offsets)
+		free(ctx->ws_offsets);
+	ALLOCATE(ctx->ws_offsets,uint64_t,ctx->ws_entries);
+
+	switch (user_param->access_pattern) {
+		case ACCESS_STRIDE:
+			/* Jump <stride> slots at a time, then wrap to the next starting slot, so all slots are hit. */
+			j = 0;
+			for (start = 0; start < user_param->access_stride && start < ctx->ws_entries; start++) {
+				for (i = start; i < ctx->ws_entries; i += user_param->access_stride)
+					ctx->ws_offsets[j++] = i * step;
+			}
+			break;
+
+		case ACCESS_RANDOM:
+			for (i = 0; i < ctx->ws_entries; i++)
+				ctx->ws_offsets[i] = i * step;
+
+			/* Fisher-Yates, keeping offset 0 first. */
+			for (i = ctx->ws_entries - 1; i > 1; i--) {
+				j = 1 + lrand48() % i;
+				tmp = ctx->ws_offsets[i];
+				ctx->ws_offsets[i] = ctx->ws_offsets[j];
+				ctx->ws_offsets[j] = tmp;
+			}
+			break;
+
+		default:
+			for (i = 0; i < ctx->ws_entries; i++)
+				ctx->ws_offsets[i] = i * step;
 	}
-	#endif
 }
 
-#ifdef HAVE_VERBS_EXP
 /******************************************************************************
  *
  ******************************************************************************/
-void ctx_set_send_exp_wqes(struct pingpong_context *ctx,
-		struct perftest_parameters *user_param,
-		struct pingpong_dest *rem_dest)
+void ctx_set_size_dist(struct pingpong_context *ctx, struct perftest_parameters *user_param)
 {
-	int i,j;
-	int num_of_qps = user_param->num_of_qps;
-	int xrc_offset = 0;
-
-	if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT)) {
-		num_of_qps /= 2;
-		xrc_offset = num_of_qps;
-	}
+	struct size_dist *dist = &user_param->size_dist;
+	uint64_t size;
+	double point, sum;
+	int i, j, k;
 
-	for (i = 0; i < num_of_qps ; i++) {
-		memset(&ctx->exp_wr[i*user_param->post_list],0,sizeof(struct ibv_exp_send_wr));
-		ctx->sge_list[i*user_param->post_list].addr = (uintptr_t)ctx->buf[i];
+	if (!ctx->size_ring)
+		ALLOCATE(ctx->size_ring,uint32_t,user_param->num_of_qps * SIZE_RING_LEN);
 
-		if (user_param->mac_fwd) {
-			if (user_param->mr_per_qp) {
-				ctx->sge_list[i*user_param->post_list].addr = 
-					(uintptr_t)ctx->buf[0] + (num_of_qps + i)*BUFF_SIZE(ctx->size,ctx->cycle_buffer);
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		for (j = 0; j < SIZE_RING_LEN; j++) {
+			if (dist->type == SIZE_DIST_UNIFORM) {
+				size = dist->min_size + lrand48() % (dist->max_size - dist->min_size + 1);
 			} else {
-				ctx->sge_list[i*user_param->post_list].addr = (uintptr_t)ctx->buf[i];
+				point = drand48() * dist->total_weight;
+				sum = 0;
+				for (k = 0; k < dist->num_of_entries - 1; k++) {
+					sum += dist->weights[k];
+					if (point < sum)
+						break;
+				}
+				size = dist->sizes[k];
 			}
+
+			/* UD may have cut the message size down to the MTU. */
+			ctx->size_ring[i * SIZE_RING_LEN + j] = (size > user_param->size) ? user_param->size : size;
 		}
+	}
+}
 
-		if (user_param->verb == WRITE || user_param->verb == READ)
-			ctx->exp_wr[i*user_param->post_list].wr.rdma.remote_addr   = rem_dest[xrc_offset + i].vaddr;
+/******************************************************************************
+ * Adds the messages the QPs posted in this run to the size classes. Message
+ * n of a QP had the size of slot n of its ring (see set_dist_size).
+ ******************************************************************************/
+static void ctx_count_size_dist(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct size_dist *dist = &user_param->size_dist;
+	uint64_t laps,rem,n;
+	uint32_t size;
+	int i,j,c;
 
-		else if (user_param->verb == ATOMIC)
-			ctx->exp_wr[i*user_param->post_list].wr.atomic.remote_addr = rem_dest[xrc_offset + i].vaddr;
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		laps = ctx->scnt[i] / SIZE_RING_LEN;
+		rem = ctx->scnt[i] % SIZE_RING_LEN;
+		for (j = 0; j < SIZE_RING_LEN; j++) {
+			n = laps + ((uint64_t)j < rem);
+			if (!n)
+				break;
+			size = ctx->size_ring[i * SIZE_RING_LEN + j];
+			c = size_dist_class(size);
+			dist->posted_msgs[c] += n;
+			dist->posted_bytes[c] += n * size;
+		}
+	}
+}
+
+/******************************************************************************
+ * Splits the message described by first into user_param->num_sge SGEs,
+ * starting each one on its own cache line, page or MR (--sge_spread).
+ ******************************************************************************/
+static void ctx_set_sge_layout(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, struct ibv_sge *first, struct ibv_sge *sges)
+{
+	uint64_t offset = 0;
+	uint64_t align = (user_param->sge_spread == SGE_SPREAD_PAGE) ? sysconf(_SC_PAGESIZE) : ctx->cache_line_size;
+	int k, n = user_param->num_sge;
+
+	for (k = 0; k < n; k++) {
+		sges[k].length = (user_param->sge_layout_entries) ? user_param->sge_layout[k] :
+			user_param->size / n + ((uint64_t)k < user_param->size % n);
+
+		if (user_param->sge_spread == SGE_SPREAD_MR && k > 0) {
+			sges[k].addr = (uintptr_t)ctx->sge_buf[k - 1];
+			sges[k].lkey = ctx->sge_mr[k - 1]->lkey;
+		} else {
+			sges[k].addr = first->addr + offset;
+			sges[k].lkey = first->lkey;
+			offset = ((offset + sges[k].length + align - 1) / align) * align;
+		}
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_set_send_wqes(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest)
+{
+	int i;
+	struct ibv_sge *sge;
+
+	if (user_param->working_set && user_param->tst == BW)
+		ctx_set_working_set(ctx,user_param);
+
+	#ifdef HAVE_VERBS_EXP
+	if (user_param->use_exp == 1) {
+		ctx_set_send_exp_wqes(ctx,user_param,rem_dest);
+	}
+	else {
+	#endif
+		ctx_set_send_reg_wqes(ctx,user_param,rem_dest);
+	#ifdef HAVE_VERBS_EXP
+	}
+	#endif
+
+	if (user_param->size_dist.type != SIZE_DIST_NONE) {
+		ctx_set_size_dist(ctx,user_param);
+		for (i = 0; i < user_param->num_of_qps; i++)
+			set_dist_size(ctx,i,user_param->post_list,0);
+	}
+
+	if (ctx->ud_ring) {
+		for (i = 0; i < user_param->num_of_qps; i++)
+			set_ud_dest(ctx,i,user_param->post_list,0);
+	}
+
+	/* Post list is 1 here, so WR i gathers from the i-th block of sge_gather. */
+	if (user_param->num_sge_max > 1) {
+		for (i = 0; i < user_param->num_of_qps; i++) {
+			sge = &ctx->sge_gather[i * user_param->num_sge_max];
+			ctx_set_sge_layout(ctx,user_param,&ctx->sge_list[i],sge);
+
+			#ifdef HAVE_VERBS_EXP
+			if (user_param->use_exp == 1) {
+				ctx->exp_wr[i].sg_list = sge;
+				ctx->exp_wr[i].num_sge = user_param->num_sge;
+			} else
+			#endif
+			{
+				ctx->wr[i].sg_list = sge;
+				ctx->wr[i].num_sge = user_param->num_sge;
+			}
+		}
+	}
+}
+
+#ifdef HAVE_VERBS_EXP
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_set_send_exp_wqes(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest)
+{
+	int i,j;
+	int num_of_qps = user_param->num_of_qps;
+	int xrc_offset = 0;
+
+	if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT)) {
+		num_of_qps /= 2;
+		xrc_offset = num_of_qps;
+	}
+
+	for (i = 0; i < num_of_qps ; i++) {
+		memset(&ctx->exp_wr[i*user_param->post_list],0,sizeof(struct ibv_exp_send_wr));
+		ctx->sge_list[i*user_param->post_list].addr = (uintptr_t)ctx->buf[i];
+
+		if (user_param->mac_fwd) {
+			if (user_param->mr_per_qp) {
+				ctx->sge_list[i*user_param->post_list].addr = 
+					(uintptr_t)ctx->buf[0] + (num_of_qps + i)*BUFF_SIZE(ctx->size,ctx->cycle_buffer);
+			} else {
+				ctx->sge_list[i*user_param->post_list].addr = (uintptr_t)ctx->buf[i];
+			}
+		}
+
+		if (user_param->verb == WRITE || user_param->verb == READ)
+			ctx->exp_wr[i*user_param->post_list].wr.rdma.remote_addr   = rem_dest[xrc_offset + i].vaddr;
+
+		else if (user_param->verb == ATOMIC)
+			ctx->exp_wr[i*user_param->post_list].wr.atomic.remote_addr = rem_dest[xrc_offset + i].vaddr;
 
 		if (user_param->tst == BW ) {
 
@@ -2371,6 +3041,86 @@ void ctx_set_send_exp_wqes(struct pingpong_context *ctx,
 }
 #endif
 
+/******************************************************************************
+ * Sets the opcode of the QP's WR to the verb of message slot cnt in the mix.
+ * Reads are never posted inline.
+ ******************************************************************************/
+static inline void set_mix_verb(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, int index, uint64_t cnt)
+{
+	struct ibv_send_wr *wr = &ctx->wr[index];
+	VerbType verb = user_param->mix.ring[cnt % MIX_RING_LEN];
+
+	wr->opcode = opcode_verbs_array[verb];
+
+	if (verb != READ && user_param->size <= user_param->inline_size)
+		wr->send_flags |= IBV_SEND_INLINE;
+	else
+		wr->send_flags &= ~IBV_SEND_INLINE;
+}
+
+/******************************************************************************
+ * Accounts a send completion of the QP to the verb of the signaled slot.
+ ******************************************************************************/
+static inline void mix_lat_sample(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, int index, cycles_t now)
+{
+	struct verb_mix *mix = &user_param->mix;
+	uint64_t slot = ctx->ccnt[index] + user_param->cq_mod - 1;
+	cycles_t lat;
+	int verb;
+
+	if (slot >= ctx->scnt[index])
+		slot = ctx->scnt[index] - 1;
+
+	verb = mix->ring[slot % MIX_RING_LEN];
+	lat = now - ctx->mix_tposted[index * user_param->tx_depth + slot % user_param->tx_depth];
+
+	mix->lat_sum[verb] += lat;
+	if (!mix->lat_samples[verb] || lat < mix->lat_min[verb])
+		mix->lat_min[verb] = lat;
+	if (lat > mix->lat_max[verb])
+		mix->lat_max[verb] = lat;
+	mix->lat_samples[verb]++;
+}
+
+/******************************************************************************
+ * Records the latency of the oldest WR of a signaled batch for --autotune=p99.
+ * The samples wrap around, so a long point keeps its latest ones.
+ ******************************************************************************/
+static inline void tune_lat_sample(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, int index, cycles_t now)
+{
+	uint64_t slot = ctx->ccnt[index];
+
+	ctx->tune_lat[ctx->tune_lat_cnt++ % AUTOTUNE_LAT_SAMPLES] =
+		now - ctx->mix_tposted[index * user_param->tx_depth + slot % user_param->tx_depth];
+}
+
+/******************************************************************************
+ * Accounts a send completion of the QP to the fan-out server owning it.
+ ******************************************************************************/
+static inline void fanout_lat_sample(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, int index, cycles_t now)
+{
+	struct fanout_dest *dest = &user_param->fanout[index / (user_param->num_of_qps / user_param->num_servers)];
+	uint64_t slot = ctx->ccnt[index] + user_param->cq_mod - 1;
+	cycles_t lat;
+
+	if (slot >= ctx->scnt[index])
+		slot = ctx->scnt[index] - 1;
+
+	lat = now - ctx->mix_tposted[index * user_param->tx_depth + slot % user_param->tx_depth];
+
+	dest->msgs += user_param->cq_mod;
+	dest->lat_sum += lat;
+	if (!dest->lat_samples || lat < dest->lat_min)
+		dest->lat_min = lat;
+	if (lat > dest->lat_max)
+		dest->lat_max = lat;
+	dest->lat_samples++;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2400,7 +3150,7 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 			}
 		}
 
-		if (user_param->verb == WRITE || user_param->verb == READ)
+		if (user_param->verb == WRITE || user_param->verb == READ || user_param->mix.total_weight)
 			ctx->wr[i*user_param->post_list].wr.rdma.remote_addr   = rem_dest[xrc_offset + i].vaddr;
 
 		else if (user_param->verb == ATOMIC)
@@ -2411,7 +3161,7 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 			ctx->scnt[i] = 0;
 			ctx->ccnt[i] = 0;
 			ctx->my_addr[i] = (uintptr_t)ctx->buf[i];
-			if (user_param->verb != SEND)
+			if (user_param->verb != SEND || user_param->mix.total_weight)
 				ctx->rem_addr[i] = rem_dest[xrc_offset + i].vaddr;
 		}
 
@@ -2451,7 +3201,7 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 			else {
 				ctx->wr[i*user_param->post_list + j].opcode = opcode_verbs_array[user_param->verb];
 			}
-			if (user_param->verb == WRITE || user_param->verb == READ) {
+			if (user_param->verb == WRITE || user_param->verb == READ || user_param->mix.total_weight) {
 
 				ctx->wr[i*user_param->post_list + j].wr.rdma.rkey = rem_dest[xrc_offset + i].rkey;
 
@@ -2505,6 +3255,9 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 			if ((user_param->verb == SEND || user_param->verb == WRITE) && user_param->size <= user_param->inline_size)
 				ctx->wr[i*user_param->post_list + j].send_flags |= IBV_SEND_INLINE;
 
+			if (user_param->mix.total_weight)
+				set_mix_verb(ctx,user_param,i,0);
+
 			#ifdef HAVE_XRCD
 			if (user_param->use_xrc)
 				ctx->wr[i*user_param->post_list + j].qp_type.xrc.remote_srqn = rem_dest[xrc_offset + i].srqn;
@@ -2513,6 +3266,81 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 	}
 }
 
+/******************************************************************************
+ * Builds the chained receive list of a QP. Each slot continues the buffer
+ * cycling where the initial posting stopped, so batched reposts touch the
+ * same addresses as the one by one reposts would.
+ ******************************************************************************/
+static void ctx_set_recv_batch(struct pingpong_context *ctx,struct perftest_parameters *user_param,int qp_index)
+{
+	int			b,s;
+	int			batch = user_param->recv_batch;
+	struct ibv_recv_wr	*wr = &ctx->rx_batch_wr[qp_index*batch];
+	struct ibv_sge		*sge = &ctx->rx_batch_sge[qp_index*batch*user_param->num_sge_max];
+	uint64_t		inc = INC(user_param->size,ctx->cache_line_size);
+	uint64_t		slots = ctx->cycle_buffer / inc;
+	uint64_t		pos = 0;
+
+	if (RECV_BATCH_CYCLE(ctx,user_param))
+		pos = (ctx->rwr[qp_index].sg_list->addr - ctx->rx_buffer_addr[qp_index]) / inc;
+
+	for (b = 0; b < batch; b++) {
+		wr[b] = ctx->rwr[qp_index];
+		wr[b].sg_list = &sge[b*user_param->num_sge_max];
+		wr[b].next = (b < batch - 1) ? &wr[b + 1] : NULL;
+
+		for (s = 0; s < ctx->rwr[qp_index].num_sge; s++)
+			wr[b].sg_list[s] = ctx->rwr[qp_index].sg_list[s];
+
+		if (RECV_BATCH_CYCLE(ctx,user_param))
+			wr[b].sg_list->addr = ctx->rx_buffer_addr[qp_index] + ((pos + b) % slots) * inc;
+	}
+	ctx->rx_batch_pending[qp_index] = 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_post_recv_batch(struct pingpong_context *ctx,struct perftest_parameters *user_param,int qp_index,int flush)
+{
+	int			b;
+	int			batch = user_param->recv_batch;
+	int			pending = ++ctx->rx_batch_pending[qp_index];
+	struct ibv_recv_wr	*wr = &ctx->rx_batch_wr[qp_index*batch];
+	struct ibv_recv_wr	*bad_wr_recv;
+	uint64_t		inc,span;
+	int			err;
+
+	if (pending < batch && !flush)
+		return SUCCESS;
+
+	/* A final partial batch is posted by cutting the chain short. */
+	wr[pending - 1].next = NULL;
+	if (user_param->use_srq)
+		err = ibv_post_srq_recv(ctx->srq,wr,&bad_wr_recv);
+	else
+		err = ibv_post_recv(ctx->qp[qp_index],wr,&bad_wr_recv);
+	if (pending < batch)
+		wr[pending - 1].next = &wr[pending];
+
+	if (err) {
+		fprintf(stderr, "Couldn't post a batch of %d receives on QP %d\n",pending,qp_index);
+		return FAILURE;
+	}
+	ctx->rx_batch_pending[qp_index] = 0;
+
+	if (RECV_BATCH_CYCLE(ctx,user_param)) {
+		inc = INC(user_param->size,ctx->cache_line_size);
+		span = (ctx->cycle_buffer / inc) * inc;
+		for (b = 0; b < pending; b++) {
+			wr[b].sg_list->addr += pending * inc;
+			while (wr[b].sg_list->addr >= ctx->rx_buffer_addr[qp_index] + span)
+				wr[b].sg_list->addr -= span;
+		}
+	}
+	return SUCCESS;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2556,6 +3384,13 @@ int ctx_set_recv_wqes(struct pingpong_context *ctx,struct perftest_parameters *u
 		ctx->rwr[i].next    = NULL;
 		ctx->rwr[i].num_sge	= MAX_RECV_SGE;
 
+		if (user_param->num_sge_max > 1) {
+			ctx_set_sge_layout(ctx,user_param,&ctx->recv_sge_list[i],
+					&ctx->recv_sge_gather[i * user_param->num_sge_max]);
+			ctx->rwr[i].sg_list = &ctx->recv_sge_gather[i * user_param->num_sge_max];
+			ctx->rwr[i].num_sge = user_param->num_sge;
+		}
+
 		if (user_param->tst == BW)
 			ctx->rx_buffer_addr[i] = ctx->recv_sge_list[i].addr;
 
@@ -2576,7 +3411,7 @@ int ctx_set_recv_wqes(struct pingpong_context *ctx,struct perftest_parameters *u
 				}
 			}
 
-			if ((user_param->tst == BW) && user_param->size <= (ctx->cycle_buffer / 2)) {
+			if ((user_param->tst == BW) && user_param->num_sge_max == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
 
 				increase_loc_addr(&ctx->recv_sge_list[i],
 						user_param->size,
@@ -2585,6 +3420,9 @@ int ctx_set_recv_wqes(struct pingpong_context *ctx,struct perftest_parameters *u
 						user_param->connection_type,ctx->cache_line_size,ctx->cycle_buffer);
 			}
 		}
+
+		if (user_param->recv_batch > 1)
+			ctx_set_recv_batch(ctx,user_param,i);
 	}
 	return 0;
 }
@@ -2678,6 +3516,231 @@ cleaning:
 	return return_value;
 }
 
+/******************************************************************************
+ * Touches every page of each QP's buffer, locally and on the remote side,
+ * with one small signaled WR per page. All the QPs run concurrently.
+ ******************************************************************************/
+static int warm_up_touch_pages(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	struct ibv_send_wr	wr;
+	struct ibv_send_wr	*bad_wr = NULL;
+	struct ibv_sge		sge;
+	struct ibv_wc		*wc = NULL;
+	uint64_t		*posted = NULL;
+	uint64_t		*outstanding = NULL;
+	uint64_t		page = sysconf(_SC_PAGESIZE);
+	uint64_t		pages = (BUFF_SIZE(ctx->size,ctx->cycle_buffer) + page - 1) / page;
+	uint64_t		done = 0;
+	uint32_t		len = (user_param->verb == ATOMIC) ? 8 : 1;
+	int			num_of_qps = user_param->num_of_qps;
+	int			i,ne,index;
+	int			return_value = 0;
+
+	ALLOCATE(wc,struct ibv_wc,CTX_POLL_BATCH);
+	ALLOCATE(posted,uint64_t,num_of_qps);
+	ALLOCATE(outstanding,uint64_t,num_of_qps);
+	memset(posted,0,sizeof(uint64_t)*num_of_qps);
+	memset(outstanding,0,sizeof(uint64_t)*num_of_qps);
+
+	while (done < pages * num_of_qps) {
+
+		for (index = 0; index < num_of_qps; index++) {
+
+			while (posted[index] < pages && outstanding[index] < user_param->tx_depth) {
+
+				memset(&wr,0,sizeof(wr));
+				sge.addr = ctx->my_addr[index] + posted[index] * page;
+				sge.length = len;
+				sge.lkey = ctx->mr[index]->lkey;
+				wr.wr_id = index;
+				wr.sg_list = &sge;
+				wr.num_sge = 1;
+				wr.send_flags = IBV_SEND_SIGNALED;
+
+				if (user_param->verb == ATOMIC) {
+					wr.opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
+					wr.wr.atomic.remote_addr = ctx->rem_addr[index] + posted[index] * page;
+					wr.wr.atomic.compare_add = 0;
+					#ifdef HAVE_VERBS_EXP
+					if (user_param->use_exp == 1)
+						wr.wr.atomic.rkey = ctx->exp_wr[index*user_param->post_list].wr.atomic.rkey;
+					else
+					#endif
+						wr.wr.atomic.rkey = ctx->wr[index*user_param->post_list].wr.atomic.rkey;
+				} else {
+					wr.opcode = (user_param->verb == READ) ? IBV_WR_RDMA_READ : IBV_WR_RDMA_WRITE;
+					wr.wr.rdma.remote_addr = ctx->rem_addr[index] + posted[index] * page;
+					#ifdef HAVE_VERBS_EXP
+					if (user_param->use_exp == 1)
+						wr.wr.rdma.rkey = ctx->exp_wr[index*user_param->post_list].wr.rdma.rkey;
+					else
+					#endif
+						wr.wr.rdma.rkey = ctx->wr[index*user_param->post_list].wr.rdma.rkey;
+				}
+
+				if (ibv_post_send(ctx->qp[index],&wr,&bad_wr)) {
+					fprintf(stderr,"Couldn't post send during page warm up: qp %d page %lu\n",index,posted[index]);
+					return_value = 1;
+					goto cleaning;
+				}
+				posted[index]++;
+				outstanding[index]++;
+			}
+		}
+
+		ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
+		if (ne < 0) {
+			fprintf(stderr,"poll CQ failed during page warm up %d\n",ne);
+			return_value = 1;
+			goto cleaning;
+		}
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				fprintf(stderr,"Completion with error during page warm up: %s\n",ibv_wc_status_str(wc[i].status));
+				return_value = 1;
+				goto cleaning;
+			}
+			outstanding[wc[i].wr_id]--;
+			done++;
+		}
+	}
+
+cleaning:
+	free(wc);
+	free(posted);
+	free(outstanding);
+	return return_value;
+}
+
+/******************************************************************************
+ * Warm up until the message rate settles: touch the buffers, then run short
+ * iteration chunks on all the QPs until the last WARMUP_WINDOWS rates agree
+ * within warmup_tol percent, or WARMUP_MAX_MS passes. The WQEs and the
+ * counters are restored, so the measured run starts as after a plain warm up.
+ ******************************************************************************/
+static int perform_steady_warm_up(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	double			mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	double			rate[WARMUP_WINDOWS];
+	double			min,max,sum;
+	struct ibv_send_wr	*saved_wr = NULL;
+	struct ibv_sge		*saved_sge = NULL;
+	struct ibv_sge		*saved_gather = NULL;
+	#ifdef HAVE_VERBS_EXP
+	struct ibv_exp_send_wr	*saved_exp_wr = NULL;
+	#endif
+	int			num_of_qps = user_param->num_of_qps;
+	int			num_wr = num_of_qps * user_param->post_list;
+	int			orig_iters = user_param->iters;
+	int			orig_test_type = user_param->test_type;
+	int			cq_mod = user_param->cq_mod;
+	int			i,n = 0;
+	int			return_value = 0;
+	uint64_t		iters;
+	cycles_t		start,chunk_start,cycles;
+
+	if (mhz <= 0) {
+		fprintf(stderr," Can't get the CPU frequency to time the warm up\n");
+		return 1;
+	}
+
+	start = get_cycles();
+
+	if (warm_up_touch_pages(ctx,user_param))
+		return 1;
+
+	/* The chunks below advance the WQE addresses, keep the initial ones. */
+	ALLOCATE(saved_wr,struct ibv_send_wr,num_wr);
+	memcpy(saved_wr,ctx->wr,sizeof(struct ibv_send_wr)*num_wr);
+	ALLOCATE(saved_sge,struct ibv_sge,num_wr);
+	memcpy(saved_sge,ctx->sge_list,sizeof(struct ibv_sge)*num_wr);
+	if (ctx->sge_gather) {
+		ALLOCATE(saved_gather,struct ibv_sge,num_of_qps*user_param->num_sge_max);
+		memcpy(saved_gather,ctx->sge_gather,sizeof(struct ibv_sge)*num_of_qps*user_param->num_sge_max);
+	}
+	#ifdef HAVE_VERBS_EXP
+	ALLOCATE(saved_exp_wr,struct ibv_exp_send_wr,num_wr);
+	memcpy(saved_exp_wr,ctx->exp_wr,sizeof(struct ibv_exp_send_wr)*num_wr);
+	#endif
+
+	user_param->test_type = ITERATIONS;
+	user_param->warmup_stable = 0;
+
+	/* The first chunk fills the send queue twice, the next ones last a window each. */
+	iters = ((2 * user_param->tx_depth + cq_mod - 1) / cq_mod) * cq_mod;
+
+	while (1) {
+		if (user_param->noPeak == OFF && iters > (uint64_t)orig_iters)
+			iters = orig_iters;
+		user_param->iters = iters;
+
+		memset(ctx->scnt,0,sizeof(uint64_t)*num_of_qps);
+		memset(ctx->ccnt,0,sizeof(uint64_t)*num_of_qps);
+
+		chunk_start = get_cycles();
+		if (run_iter_bw(ctx,user_param)) {
+			return_value = 1;
+			goto restore;
+		}
+		cycles = get_cycles() - chunk_start;
+
+		rate[n % WARMUP_WINDOWS] = (double)iters * num_of_qps / cycles;
+		n++;
+
+		if (n >= WARMUP_WINDOWS) {
+			min = max = sum = rate[0];
+			for (i = 1; i < WARMUP_WINDOWS; i++) {
+				min = (rate[i] < min) ? rate[i] : min;
+				max = (rate[i] > max) ? rate[i] : max;
+				sum += rate[i];
+			}
+			if (max - min <= user_param->warmup_tol / 100 * sum / WARMUP_WINDOWS) {
+				user_param->warmup_stable = 1;
+				break;
+			}
+		}
+
+		if (get_cycles() - start >= (double)WARMUP_MAX_MS * mhz * 1000)
+			break;
+
+		iters = ((uint64_t)(rate[(n - 1) % WARMUP_WINDOWS] * WARMUP_WINDOW_MS * mhz * 1000 / num_of_qps) / cq_mod) * cq_mod;
+		if (iters < (uint64_t)cq_mod)
+			iters = cq_mod;
+	}
+
+	user_param->warmup_ms = (get_cycles() - start) / (mhz * 1000);
+	if (!user_param->warmup_stable)
+		fprintf(stderr," Warning: the message rate did not settle within %d ms of warm up\n",WARMUP_MAX_MS);
+
+	for (i = 0; i < user_param->num_servers; i++) {
+		user_param->fanout[i].msgs = 0;
+		user_param->fanout[i].lat_samples = 0;
+		user_param->fanout[i].lat_sum = 0;
+		user_param->fanout[i].lat_min = 0;
+		user_param->fanout[i].lat_max = 0;
+	}
+
+restore:
+	user_param->iters = orig_iters;
+	user_param->test_type = orig_test_type;
+	memset(ctx->scnt,0,sizeof(uint64_t)*num_of_qps);
+	memset(ctx->ccnt,0,sizeof(uint64_t)*num_of_qps);
+
+	memcpy(ctx->wr,saved_wr,sizeof(struct ibv_send_wr)*num_wr);
+	memcpy(ctx->sge_list,saved_sge,sizeof(struct ibv_sge)*num_wr);
+	if (saved_gather)
+		memcpy(ctx->sge_gather,saved_gather,sizeof(struct ibv_sge)*num_of_qps*user_param->num_sge_max);
+	#ifdef HAVE_VERBS_EXP
+	memcpy(ctx->exp_wr,saved_exp_wr,sizeof(struct ibv_exp_send_wr)*num_wr);
+	free(saved_exp_wr);
+	#endif
+	free(saved_wr);
+	free(saved_sge);
+	free(saved_gather);
+	return return_value;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -2694,6 +3757,9 @@ int perform_warm_up(struct pingpong_context *ctx,struct perftest_parameters *use
 	int 			num_of_qps = user_param->num_of_qps;
 	int			return_value = 0;
 
+	if (user_param->warmup_tol > 0)
+		return perform_steady_warm_up(ctx,user_param);
+
 	if(user_param->duplex && (user_param->use_xrc || user_param->connection_type == DC))
 		num_of_qps /= 2;
 
@@ -2750,47 +3816,148 @@ cleaning:
 }
 
 /******************************************************************************
- *
+ * Milliseconds until the check alive deadline, for a poll() on the channel.
  ******************************************************************************/
-int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+static int check_alive_timeout_ms(struct perftest_parameters *user_param)
 {
-	uint64_t           	totscnt = 0;
-	uint64_t       	   	totccnt = 0;
-	int                	i = 0;
-	int                	index,ne;
-	uint64_t	   	tot_iters;
-	int			err = 0;
-	#ifdef HAVE_VERBS_EXP
-	struct ibv_exp_send_wr 	*bad_exp_wr = NULL;
-	#endif
-	struct ibv_send_wr 	*bad_wr = NULL;
-	struct ibv_wc 	   	*wc = NULL;
-	int 			num_of_qps = user_param->num_of_qps;
+	cycles_t now;
 
-	/* Rate Limiter*/
-	int 			rate_limit_pps = 0;
-	double 			gap_time = 0;	/* in usec */
-	cycles_t 		gap_cycles = 0;	/* in cycles */
-	cycles_t 		gap_deadline = 0;
-	unsigned int 		number_of_bursts = 0;
-	int 			burst_iter = 0;
+	if (user_param->alive.deadline == TIMER_NEVER)
+		return -1;
+
+	now = get_cycles();
+	if (now >= user_param->alive.deadline)
+		return 0;
+
+	return (int)((user_param->alive.deadline - now) * 1000 / user_param->cycles_per_sec) + 1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_wait_cq_event(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct pollfd	pfd;
+	int		rc;
+
+	pfd.fd = ctx->channel->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	rc = poll(&pfd, 1, check_alive_timeout_ms(user_param));
+	if (rc < 0 && errno != EINTR) {
+		fprintf(stderr, "Failed to wait for CQ event\n");
+		return FAILURE;
+	}
+
+	/* The CQ stays armed, the caller finds it empty and runs the watchdog. */
+	if (rc <= 0)
+		return SUCCESS;
+
+	return ctx_notify_events(ctx->channel);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_poll_cq_hybrid(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		       struct ibv_cq *cq, int num_entries, struct ibv_wc *wc)
+{
+	struct pollfd	pfd;
+	struct ibv_cq	*ev_cq;
+	void		*ev_ctx;
+	cycles_t	deadline;
+	int		ne,rc;
+
+	if (!user_param->event_start) {
+		user_param->event_start = get_cycles();
+		user_param->event_cpu_start = get_thread_cpu_time();
+	}
+
+	deadline = get_cycles() + user_param->event_spin_cycles;
+	do {
+		ne = ibv_poll_cq(cq, num_entries, wc);
+		if (ne)
+			return ne;
+	} while (get_cycles() < deadline);
+
+	while (1) {
+		if (ibv_req_notify_cq(cq, 0)) {
+			fprintf(stderr, "Couldn't request CQ notification\n");
+			return -1;
+		}
+
+		/* Completions that arrived before the CQ was armed raise no event. */
+		ne = ibv_poll_cq(cq, num_entries, wc);
+		if (ne)
+			return ne;
+
+		/* All test CQs share one completion channel, so a plain poll() on
+		 * its fd is enough, an epoll set would hold this single fd. */
+		pfd.fd = ctx->channel->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		rc = poll(&pfd, 1, check_alive_timeout_ms(user_param));
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed to wait for CQ event\n");
+			return -1;
+		}
+
+		/* Let the server loops run the check alive watchdog. */
+		if (!rc)
+			return 0;
+
+		/* The channel is non blocking, drain every pending event. */
+		while (!ibv_get_cq_event(ctx->channel, &ev_cq, &ev_ctx))
+			ibv_ack_cq_events(ev_cq, 1);
+
+		user_param->event_wakeups++;
+
+		ne = ibv_poll_cq(cq, num_entries, wc);
+		if (ne)
+			return ne;
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t           	totscnt = 0;
+	uint64_t       	   	totccnt = 0;
+	int                	i = 0;
+	int                	index,ne;
+	uint64_t	   	tot_iters;
+	int			err = 0;
+	#ifdef HAVE_VERBS_EXP
+	struct ibv_exp_send_wr 	*bad_exp_wr = NULL;
+	#endif
+	struct ibv_send_wr 	*bad_wr = NULL;
+	struct ibv_wc 	   	*wc = NULL;
+	int 			num_of_qps = user_param->num_of_qps;
+
+	/* Rate Limiter*/
+	int 			rate_limit_pps = 0;
+	double 			gap_time = 0;	/* in usec */
+	cycles_t 		gap_cycles = 0;	/* in cycles */
+	cycles_t 		gap_deadline = 0;
+	unsigned int 		number_of_bursts = 0;
+	int 			burst_iter = 0;
 	int 			is_sending_burst = 0;
 	int 			cpu_mhz = 0;
 	int 			return_value = 0;
 	int			wc_id;
 	int pl_index;
 	struct ibv_sge		*sg_l;
+	uint64_t		ws_offset;
+	VerbType		rem_verb = (user_param->mix.total_weight) ? WRITE : user_param->verb;
 
 	ALLOCATE(wc ,struct ibv_wc ,CTX_POLL_BATCH);
 
 	if (user_param->test_type == DURATION) {
-		duration_param=user_param;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
-		if (user_param->margin > 0 )
-			alarm(user_param->margin);
-		else
-			catch_alarm(0); /* move to next state */
+		ctx_timer_start(user_param);
 
 		user_param->iters = 0;
 	}
@@ -2811,6 +3978,13 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 	if (user_param->test_type == ITERATIONS && user_param->noPeak == ON)
 		user_param->tposted[0] = get_cycles();
 
+	if (user_param->mix.total_weight) {
+		memset(user_param->mix.msgs, 0, sizeof(user_param->mix.msgs));
+		memset(user_param->mix.lat_samples, 0, sizeof(user_param->mix.lat_samples));
+		memset(user_param->mix.lat_sum, 0, sizeof(user_param->mix.lat_sum));
+		memset(user_param->mix.lat_max, 0, sizeof(user_param->mix.lat_max));
+	}
+
 	/* If using rate limiter, calculate gap time between bursts */
 	if (user_param->is_rate_limiting == 1) {
 		/* Calculate rate limit in pps */
@@ -2840,7 +4014,7 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 
 	/* main loop for posting */
 	while (totscnt < tot_iters  || totccnt < tot_iters ||
-		(user_param->test_type == DURATION && user_param->state != END_STATE) ) {
+		(user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE) ) {
 
 		/* main loop to run over all the qps and post each time n messages */
 		for (index =0 ; index < num_of_qps ; index++) {
@@ -2884,9 +4058,12 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 				if (user_param->noPeak == OFF)
 					user_param->tposted[totscnt] = get_cycles();
 
-				if (user_param->test_type == DURATION && user_param->state == END_STATE)
+				if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 					break;
 
+				if (ctx->mix_tposted)
+					ctx->mix_tposted[index * user_param->tx_depth + ctx->scnt[index] % user_param->tx_depth] = get_cycles();
+
 				#ifdef HAVE_VERBS_EXP
 				#ifdef HAVE_ACCL_VERBS
 				if (user_param->verb_type == ACCL_INTF) {
@@ -2918,7 +4095,18 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 					goto cleaning;
 				}
 
-				if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
+				if (user_param->post_list == 1 && ctx->ws_offsets) {
+					ws_offset = ctx->ws_offsets[(ctx->scnt[index] + 1) % ctx->ws_entries];
+					#ifdef HAVE_VERBS_EXP
+					if (user_param->use_exp == 1)
+						set_exp_ws_addr(&ctx->exp_wr[index],ws_offset,ctx->my_addr[index],
+								ctx->rem_addr[index],user_param->verb);
+					else
+					#endif
+						set_ws_addr(&ctx->wr[index],ws_offset,ctx->my_addr[index],
+								ctx->rem_addr[index],rem_verb);
+
+				} else if (user_param->post_list == 1 && user_param->num_sge_max == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
 					#ifdef HAVE_VERBS_EXP
 					if (user_param->use_exp == 1)
 						increase_loc_addr(ctx->exp_wr[index].sg_list,user_param->size,
@@ -2928,7 +4116,7 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 						increase_loc_addr(ctx->wr[index].sg_list,user_param->size,ctx->scnt[index],
 								ctx->my_addr[index],0,ctx->cache_line_size,ctx->cycle_buffer);
 
-					if (user_param->verb != SEND) {
+					if (rem_verb != SEND) {
 						#ifdef HAVE_VERBS_EXP
 						if (user_param->use_exp == 1)
 							increase_exp_rem_addr(&ctx->exp_wr[index],user_param->size,
@@ -2937,11 +4125,22 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 						else
 						#endif
 							increase_rem_addr(&ctx->wr[index],user_param->size,
-									ctx->scnt[index],ctx->rem_addr[index],user_param->verb,ctx->cache_line_size,
+									ctx->scnt[index],ctx->rem_addr[index],rem_verb,ctx->cache_line_size,
 									ctx->cycle_buffer);
 					}
 				}
 
+				if (ctx->size_ring)
+					set_dist_size(ctx,index,user_param->post_list,ctx->scnt[index] + user_param->post_list);
+
+				if (ctx->ud_ring)
+					set_ud_dest(ctx,index,user_param->post_list,ctx->scnt[index] + user_param->post_list);
+
+				if (user_param->mix.total_weight) {
+					user_param->mix.msgs[user_param->mix.ring[ctx->scnt[index] % MIX_RING_LEN]]++;
+					set_mix_verb(ctx,user_param,index,ctx->scnt[index] + 1);
+				}
+
 				ctx->scnt[index] += user_param->post_list;
 				totscnt += user_param->post_list;
 
@@ -2976,7 +4175,7 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 		}
 
 		if (totccnt < tot_iters || (user_param->test_type == DURATION &&  totccnt < totscnt)) {
-			if (user_param->use_event) {
+			if (user_param->use_event && user_param->event_spin < 0) {
 				if (ctx_notify_events(ctx->channel)) {
 					fprintf(stderr, "Couldn't request CQ notification\n");
 					return_value = 1;
@@ -2989,6 +4188,9 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 				ne = ctx->send_cq_family->poll_cnt(ctx->send_cq, CTX_POLL_BATCH);
 			else
 			#endif
+			if (user_param->event_spin >= 0)
+				ne = ctx_poll_cq_hybrid(ctx,user_param,ctx->send_cq,CTX_POLL_BATCH,wc);
+			else
 				ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
 
 			if (ne > 0) {
@@ -3004,6 +4206,13 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 						}
 					}
 
+					if (user_param->mix.total_weight)
+						mix_lat_sample(ctx,user_param,wc_id,get_cycles());
+					else if (ctx->tune_lat)
+						tune_lat_sample(ctx,user_param,wc_id,get_cycles());
+					else if (ctx->mix_tposted)
+						fanout_lat_sample(ctx,user_param,wc_id,get_cycles());
+
 					ctx->ccnt[wc_id] += user_param->cq_mod;
 					totccnt += user_param->cq_mod;
 
@@ -3034,12 +4243,874 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 	if (user_param->noPeak == ON && user_param->test_type == ITERATIONS)
 		user_param->tcompleted[0] = get_cycles();
 
+	if (ctx->size_ring)
+		ctx_count_size_dist(ctx,user_param);
+
 cleaning:
 
 	free(wc);
 	return return_value;
 }
 
+/******************************************************************************
+ * Rebuilds the send WQEs, then warms up, runs and reports one sweep point.
+ ******************************************************************************/
+static int run_buffer_sweep_point(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep)
+{
+	ctx_set_send_wqes(ctx,user_param,rem_dest);
+
+	if (perform_warm_up(ctx,user_param)) {
+		fprintf(stderr,"Problems with warm up\n");
+		return FAILURE;
+	}
+
+	if (run_iter_bw(ctx,user_param)) {
+		fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
+		return FAILURE;
+	}
+
+	print_report_bw(user_param,my_bw_rep);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Runs the working set sweep or the SGE sweep, doubling from the first value
+ * and ending on the max. The connected QPs are reused.
+ ******************************************************************************/
+int run_buffer_sweep_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep)
+{
+	uint64_t	ws;
+	int		sge;
+
+	if (user_param->working_set_max) {
+		for (ws = user_param->working_set; ; ws *= 2) {
+			user_param->working_set = (ws < user_param->working_set_max) ? ws : user_param->working_set_max;
+			if (run_buffer_sweep_point(ctx,user_param,rem_dest,my_bw_rep))
+				return FAILURE;
+			if (user_param->working_set == user_param->working_set_max)
+				break;
+		}
+		return SUCCESS;
+	}
+
+	for (sge = user_param->num_sge; ; sge *= 2) {
+		user_param->num_sge = (sge < user_param->num_sge_max) ? sge : user_param->num_sge_max;
+		if (run_buffer_sweep_point(ctx,user_param,rem_dest,my_bw_rep))
+			return FAILURE;
+		if (user_param->num_sge == user_param->num_sge_max)
+			break;
+	}
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Runs every point of a sweep on the QPs created for the largest one. The
+ * message size changes fastest, so each block of rows is a size curve.
+ ******************************************************************************/
+int run_sweep_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep)
+{
+	static const int	order[SWEEP_PARAMS] = {SWEEP_QPS,SWEEP_TX_DEPTH,SWEEP_POST_LIST,SWEEP_CQ_MOD,SWEEP_SIZE};
+	struct sweep_dim	*sweep = user_param->sweep;
+	int			idx[SWEEP_PARAMS] = {0};
+	int			k,skipped = 0;
+	uint64_t		size = user_param->size;
+	int			num_of_qps = user_param->num_of_qps;
+	int			tx_depth = user_param->tx_depth;
+	int			post_list = user_param->post_list;
+	int			cq_mod = user_param->cq_mod;
+
+	do {
+		user_param->size = sweep[SWEEP_SIZE].val[idx[SWEEP_SIZE]];
+		user_param->num_of_qps = sweep[SWEEP_QPS].val[idx[SWEEP_QPS]];
+		user_param->tx_depth = sweep[SWEEP_TX_DEPTH].val[idx[SWEEP_TX_DEPTH]];
+		user_param->post_list = sweep[SWEEP_POST_LIST].val[idx[SWEEP_POST_LIST]];
+		user_param->cq_mod = sweep[SWEEP_CQ_MOD].val[idx[SWEEP_CQ_MOD]];
+
+		/* A post list is signaled once, so it sets the CQ moderation itself. */
+		if (user_param->post_list > 1)
+			user_param->cq_mod = user_param->post_list;
+
+		/* With a post list every CQ moderation value is the same point. */
+		if (user_param->post_list == 1 || !idx[SWEEP_CQ_MOD]) {
+
+			if (user_param->post_list > user_param->tx_depth || user_param->cq_mod > user_param->tx_depth) {
+				skipped++;
+			} else {
+				ctx_set_send_wqes(ctx,user_param,rem_dest);
+
+				if (perform_warm_up(ctx,user_param)) {
+					fprintf(stderr,"Problems with warm up\n");
+					return FAILURE;
+				}
+
+				if (user_param->adaptive ? run_iter_bw_adaptive(ctx,user_param,rem_dest) : run_iter_bw(ctx,user_param)) {
+					fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
+					return FAILURE;
+				}
+
+				print_report_bw(user_param,my_bw_rep);
+			}
+		}
+
+		for (k = SWEEP_PARAMS - 1; k >= 0; k--) {
+			if (++idx[order[k]] < sweep[order[k]].count)
+				break;
+			idx[order[k]] = 0;
+		}
+	} while (k >= 0);
+
+	if (skipped && user_param->output == FULL_VERBOSITY)
+		printf(" Skipped %d points with post_list or cq_mod above tx_depth\n", skipped);
+
+	/* The resources are destroyed for what they were created for. */
+	user_param->size = size;
+	user_param->num_of_qps = num_of_qps;
+	user_param->tx_depth = tx_depth;
+	user_param->post_list = post_list;
+	user_param->cq_mod = cq_mod;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * The load-latency probe: back to back small WRs on its own QP and CQ, timed
+ * from post to completion, while the main thread runs the background QPs.
+ ******************************************************************************/
+struct load_probe {
+	struct pingpong_context		*ctx;
+	struct ibv_send_wr		wr;
+	struct ibv_sge			sge;
+	cycles_t			gap;
+	cycles_t			reap;
+	cycles_t			*samples;
+	int				count;
+	volatile int			stop;
+	int				failed;
+};
+
+static void *load_probe_thread(void *arg)
+{
+	struct load_probe	*probe = arg;
+	struct ibv_send_wr	*bad_wr = NULL;
+	struct ibv_wc		wc;
+	cycles_t		start;
+	int			ne;
+
+	while (!probe->stop) {
+		start = get_cycles();
+		if (ibv_post_send(probe->ctx->qp[probe->wr.wr_id],&probe->wr,&bad_wr)) {
+			fprintf(stderr," Couldn't post the latency probe\n");
+			probe->failed = 1;
+			break;
+		}
+
+		do {
+			ne = ibv_poll_cq(probe->ctx->probe_cq,1,&wc);
+		} while (ne == 0 && !probe->stop);
+
+		/* Stopped with the probe in flight: reap it without a sample, so the
+		 * next step does not take this completion for its own probe. */
+		if (ne == 0) {
+			do {
+				ne = ibv_poll_cq(probe->ctx->probe_cq,1,&wc);
+			} while (ne == 0 && get_cycles() - start < probe->reap);
+
+			if (ne == 0) {
+				fprintf(stderr," Latency probe did not complete\n");
+				probe->failed = 1;
+			} else if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+				fprintf(stderr," Latency probe failed, status %d\n",ne < 0 ? ne : (int)wc.status);
+				probe->failed = 1;
+			}
+			break;
+		}
+
+		if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+			fprintf(stderr," Latency probe failed, status %d\n",ne < 0 ? ne : (int)wc.status);
+			probe->failed = 1;
+			break;
+		}
+
+		if (probe->count < LOAD_LAT_SAMPLES)
+			probe->samples[probe->count++] = get_cycles() - start;
+
+		/* The probe must not become load itself. */
+		while (get_cycles() - start < probe->gap && !probe->stop)
+			;
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * Calibrates the unthrottled message rate of the background QPs, then runs
+ * each load step with the rate limiter while the probe thread samples the
+ * round trip latency, and prints one row of the curve per step.
+ ******************************************************************************/
+int run_load_lat_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest)
+{
+	struct load_probe	probe;
+	pthread_t		thread;
+	double			mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	double			max_pps,pps,msg_rate,bw,format_factor;
+	uint64_t		iters;
+	cycles_t		*s;
+	int			probe_index = user_param->num_of_qps - 1;
+	int			bg_qps = user_param->num_of_qps - 1;
+	int			orig_iters = user_param->iters;
+	int			target_time_ms = user_param->target_time_ms;
+	int			cq_mod = user_param->cq_mod;
+	int			k,n;
+	int			return_value = SUCCESS;
+
+	if (mhz <= 0) {
+		fprintf(stderr," Can't get the CPU frequency to pace the load\n");
+		return FAILURE;
+	}
+
+	memset(&probe,0,sizeof(probe));
+	probe.ctx = ctx;
+	probe.gap = LOAD_LAT_PROBE_GAP_US * mhz;
+	probe.reap = (cycles_t)LOAD_LAT_REAP_MS * 1000 * mhz;
+	ALLOCATE(probe.samples,cycles_t,LOAD_LAT_SAMPLES);
+
+	probe.sge.addr = (uintptr_t)ctx->buf[probe_index];
+	probe.sge.length = LOAD_LAT_PROBE_SIZE;
+	probe.sge.lkey = ctx->mr[probe_index]->lkey;
+	probe.wr.wr_id = probe_index;
+	probe.wr.sg_list = &probe.sge;
+	probe.wr.num_sge = 1;
+	probe.wr.opcode = (user_param->verb == READ) ? IBV_WR_RDMA_READ : IBV_WR_RDMA_WRITE;
+	probe.wr.send_flags = IBV_SEND_SIGNALED;
+	if (user_param->verb == WRITE && user_param->inline_size >= LOAD_LAT_PROBE_SIZE)
+		probe.wr.send_flags |= IBV_SEND_INLINE;
+	probe.wr.wr.rdma.remote_addr = rem_dest[probe_index].vaddr;
+	probe.wr.wr.rdma.rkey = rem_dest[probe_index].rkey;
+
+	/* The probe QP stays out of the background loops. */
+	user_param->num_of_qps = bg_qps;
+	format_factor = (user_param->report_fmt == MBS) ? 0x100000 : 125000000;
+
+	/* 100% is what the background QPs reach unthrottled. */
+	ctx_set_send_wqes(ctx,user_param,rem_dest);
+	if (perform_warm_up(ctx,user_param)) {
+		fprintf(stderr,"Problems with warm up\n");
+		return_value = FAILURE;
+		goto restore;
+	}
+
+	user_param->target_time_ms = LOAD_LAT_STEP_MS;
+	if (run_iter_bw_adaptive(ctx,user_param,rem_dest)) {
+		fprintf(stderr," Failed to calibrate the background load\n");
+		return_value = FAILURE;
+		goto restore;
+	}
+	max_pps = (double)user_param->iters * bg_qps * mhz * 1000000 / (user_param->tcompleted[0] - user_param->tposted[0]);
+
+	printf(RESULT_LINE);
+	printf(" Load-latency curve : %d background QPs at up to %.3f[Mpps], probe of %d[B] on QP %d, %s\n",
+		bg_qps, max_pps / 1000000, LOAD_LAT_PROBE_SIZE, probe_index,
+		user_param->report_fmt == MBS ? "BW in MB/sec" : "BW in Gb/sec");
+	printf(RESULT_FMT_LOAD_LAT);
+
+	for (k = 0; k < user_param->load_lat_steps; k++) {
+		pps = max_pps * user_param->load_lat[k] / 100;
+
+		if (user_param->load_lat[k] < 100) {
+			user_param->is_rate_limiting = 1;
+			user_param->rate_units = PACKET_PS;
+			user_param->rate_limit = (int)pps;
+			/* Small bursts keep the offered load smooth against the probe. */
+			user_param->burst_size = (int)(pps / LOAD_LAT_BURSTS_PER_SEC);
+			if (user_param->burst_size < 1)
+				user_param->burst_size = 1;
+			if (user_param->burst_size > user_param->tx_depth)
+				user_param->burst_size = user_param->tx_depth;
+		} else {
+			user_param->is_rate_limiting = 0;
+		}
+
+		iters = ((uint64_t)(pps * LOAD_LAT_STEP_MS / 1000 / bg_qps) / cq_mod) * cq_mod;
+		if (iters < (uint64_t)cq_mod)
+			iters = cq_mod;
+		if (iters > INT_MAX)
+			iters = (INT_MAX / cq_mod) * cq_mod;
+		user_param->iters = iters;
+
+		ctx_set_send_wqes(ctx,user_param,rem_dest);
+
+		probe.stop = 0;
+		probe.count = 0;
+		if (pthread_create(&thread,NULL,load_probe_thread,&probe)) {
+			fprintf(stderr," Couldn't start the latency probe thread\n");
+			return_value = FAILURE;
+			goto restore;
+		}
+
+		if (run_iter_bw(ctx,user_param)) {
+			fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
+			return_value = FAILURE;
+		}
+
+		probe.stop = 1;
+		pthread_join(thread,NULL);
+
+		if (return_value || probe.failed) {
+			return_value = FAILURE;
+			goto restore;
+		}
+
+		msg_rate = (double)user_param->iters * bg_qps * mhz / (user_param->tcompleted[0] - user_param->tposted[0]);
+		bw = msg_rate * 1000000 * user_param->size / format_factor;
+
+		n = probe.count;
+		s = probe.samples;
+		if (!n) {
+			printf(REPORT_FMT_LOAD_LAT_NONE, user_param->load_lat[k], pps / 1000000, msg_rate, bw);
+			continue;
+		}
+
+		qsort(s,n,sizeof(cycles_t),cycles_compare);
+		printf(REPORT_FMT_LOAD_LAT, user_param->load_lat[k], pps / 1000000, msg_rate, bw, n,
+			s[0] / mhz, s[n / 2] / mhz, s[(n - 1) * 99 / 100] / mhz, s[(n - 1) * 999 / 1000] / mhz, s[n - 1] / mhz);
+
+		/* Log2 buckets of the probe latency, only the non empty ones. */
+		if (user_param->r_flag->histogram) {
+			printf(" Histogram %d%% [usec:count] :", user_param->load_lat[k]);
+			print_hist_buckets(stdout,s,n,mhz);
+			putchar('\n');
+		}
+	}
+
+restore:
+	user_param->num_of_qps = bg_qps + 1;
+	user_param->iters = orig_iters;
+	user_param->target_time_ms = target_time_ms;
+	user_param->is_rate_limiting = 0;
+	free(probe.samples);
+	return return_value;
+}
+
+/******************************************************************************
+ * Fills the address ring of every QP for one contention level: word 0 for a
+ * single address, uniform picks for K words, or Zipf picks by inverse CDF.
+ ******************************************************************************/
+static void contention_fill_ring(struct contention_level *level,uint32_t *ring,double *cdf,int num_of_qps)
+{
+	double	sum = 0,point;
+	int	i,lo,hi,mid;
+
+	if (level->zipf > 0) {
+		for (i = 0; i < level->addrs; i++) {
+			sum += 1 / pow(i + 1,level->zipf);
+			cdf[i] = sum;
+		}
+	}
+
+	for (i = 0; i < num_of_qps * CONTENTION_RING_LEN; i++) {
+		if (level->addrs == 1) {
+			ring[i] = 0;
+		} else if (level->zipf == 0) {
+			ring[i] = lrand48() % level->addrs;
+		} else {
+			point = drand48() * sum;
+			for (lo = 0, hi = level->addrs - 1; lo < hi; ) {
+				mid = (lo + hi) / 2;
+				if (point < cdf[mid])
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			ring[i] = lo;
+		}
+	}
+}
+
+/******************************************************************************
+ * Runs every --contention level: all QPs aim their atomics at the same remote
+ * words, one cache line apart, through the ring of the level. Each operation
+ * is timed from its slot to its completion. With --cas_retry, CMP_AND_SWAP
+ * compares with the last value the QP saw of that word and swaps in the value
+ * plus one, so the fetched value tells whether it won, and a QP retries a lost
+ * word until its increment lands. One attempt is in flight, so the compare
+ * value is never stale because of the QP's own operations, and the success
+ * rate only measures the other QPs.
+ ******************************************************************************/
+int run_atomic_contention_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep)
+{
+	struct contention_level	*level;
+	struct ibv_send_wr	*wr,*bad_wr = NULL;
+	struct ibv_wc		wc[CTX_POLL_BATCH];
+	double			mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	double			msg_rate = 0,format_factor;
+	double			*cdf = NULL;
+	uint32_t		*ring = NULL,*slot_addr = NULL,*cur = NULL;
+	uint64_t		*expect = NULL,*slot_cmp = NULL,*pos = NULL;
+	uint64_t		total = (uint64_t)user_param->iters * user_param->num_of_qps;
+	uint64_t		totscnt,totccnt,succ,fetched,compare;
+	cycles_t		*slot_ts = NULL,*lat = NULL,start,now;
+	int			is_cas = (user_param->atomicType == CMP_AND_SWAP);
+	int			cas_retry = is_cas && user_param->cas_retry;
+	int			depth = cas_retry ? 1 : user_param->tx_depth;
+	int			max_addrs = 1;
+	int			i,k,q,ne,slot,idx;
+	uint32_t		addr;
+	char			dist[32];
+	int			return_value = SUCCESS;
+
+	if (mhz <= 0) {
+		fprintf(stderr," Can't get the CPU frequency to time the atomics\n");
+		return FAILURE;
+	}
+
+	for (k = 0; k < user_param->contention_levels; k++) {
+		if (user_param->contention[k].addrs > max_addrs)
+			max_addrs = user_param->contention[k].addrs;
+	}
+
+	ALLOCATE(ring,uint32_t,user_param->num_of_qps * CONTENTION_RING_LEN);
+	ALLOCATE(cdf,double,max_addrs);
+	ALLOCATE(pos,uint64_t,user_param->num_of_qps);
+	ALLOCATE(cur,uint32_t,user_param->num_of_qps);
+	ALLOCATE(slot_ts,cycles_t,user_param->num_of_qps * depth);
+	ALLOCATE(slot_addr,uint32_t,user_param->num_of_qps * depth);
+	ALLOCATE(slot_cmp,uint64_t,user_param->num_of_qps * depth);
+	ALLOCATE(lat,cycles_t,total);
+	/* Kept across levels, the remote words are never reset. */
+	if (cas_retry) {
+		ALLOCATE(expect,uint64_t,(uint64_t)user_param->num_of_qps * max_addrs);
+		memset(expect,0,sizeof(uint64_t) * user_param->num_of_qps * max_addrs);
+	}
+
+	format_factor = (user_param->report_fmt == MBS) ? 0x100000 : 125000000;
+
+	if (perform_warm_up(ctx,user_param)) {
+		fprintf(stderr,"Problems with warm up\n");
+		return_value = FAILURE;
+		goto cleaning;
+	}
+
+	printf(RESULT_LINE);
+	printf(" Atomic contention : %s over %d QPs, %d operations per QP per level, words %d[B] apart\n",
+		is_cas ? (cas_retry ? "CMP_AND_SWAP retry loops" : "CMP_AND_SWAP") : "FETCH_AND_ADD",
+		user_param->num_of_qps, user_param->iters, ctx->cache_line_size);
+	printf(RESULT_FMT_CONTENTION);
+	printf(cas_retry ? RESULT_EXT_CONTENTION_CAS : "\n");
+
+	for (k = 0; k < user_param->contention_levels; k++) {
+		level = &user_param->contention[k];
+		contention_fill_ring(level,ring,cdf,user_param->num_of_qps);
+
+		for (q = 0; q < user_param->num_of_qps; q++) {
+			ctx->scnt[q] = 0;
+			ctx->ccnt[q] = 0;
+			pos[q] = 1;
+			cur[q] = ring[q * CONTENTION_RING_LEN];
+		}
+		totscnt = totccnt = succ = 0;
+
+		start = get_cycles();
+		while (totccnt < total) {
+
+			for (q = 0; q < user_param->num_of_qps; q++) {
+				while (ctx->scnt[q] < user_param->iters && ctx->scnt[q] - ctx->ccnt[q] < depth) {
+
+					slot = ctx->scnt[q] % depth;
+					idx = q * depth + slot;
+					addr = cas_retry ? cur[q] : ring[q * CONTENTION_RING_LEN + pos[q]++ % CONTENTION_RING_LEN];
+
+					/* Each slot fetches into a word of its own. */
+					wr = &ctx->wr[q * user_param->post_list];
+					wr->sg_list->addr = (uintptr_t)ctx->buf[q] + slot * sizeof(uint64_t);
+					wr->wr.atomic.remote_addr = rem_dest[0].vaddr + (uint64_t)addr * ctx->cache_line_size;
+					wr->wr.atomic.rkey = rem_dest[0].rkey;
+					wr->send_flags = IBV_SEND_SIGNALED;
+					if (cas_retry) {
+						compare = expect[(uint64_t)q * max_addrs + addr];
+						wr->wr.atomic.compare_add = compare;
+						wr->wr.atomic.swap = compare + 1;
+						slot_cmp[idx] = compare;
+					}
+					slot_addr[idx] = addr;
+					slot_ts[idx] = get_cycles();
+
+					#ifdef HAVE_VERBS_EXP
+					if ((ctx->post_send_func_pointer)(ctx->qp[q],wr,&bad_wr)) {
+					#else
+					if (ibv_post_send(ctx->qp[q],wr,&bad_wr)) {
+					#endif
+						fprintf(stderr,"Couldn't post send: qp %d scnt=%lu\n",q,ctx->scnt[q]);
+						return_value = FAILURE;
+						goto cleaning;
+					}
+					ctx->scnt[q]++;
+					totscnt++;
+				}
+			}
+
+			ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
+			if (ne < 0) {
+				fprintf(stderr, "poll CQ failed %d\n", ne);
+				return_value = FAILURE;
+				goto cleaning;
+			}
+
+			now = get_cycles();
+			for (i = 0; i < ne; i++) {
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					NOTIFY_COMP_ERROR_SEND(wc[i],totscnt,totccnt);
+					return_value = FAILURE;
+					goto cleaning;
+				}
+
+				/* RC completes the WRs of a QP in order. */
+				q = (int)wc[i].wr_id;
+				idx = q * depth + ctx->ccnt[q] % depth;
+				lat[totccnt++] = now - slot_ts[idx];
+
+				if (cas_retry) {
+					/* The HCA returns the fetched word in network order. */
+					fetched = be64toh(*(volatile uint64_t*)((char*)ctx->buf[q] + (ctx->ccnt[q] % depth) * sizeof(uint64_t)));
+					addr = slot_addr[idx];
+					if (fetched == slot_cmp[idx]) {
+						succ++;
+						expect[(uint64_t)q * max_addrs + addr] = fetched + 1;
+						cur[q] = ring[q * CONTENTION_RING_LEN + pos[q]++ % CONTENTION_RING_LEN];
+					} else {
+						expect[(uint64_t)q * max_addrs + addr] = fetched;
+					}
+				}
+				ctx->ccnt[q]++;
+			}
+		}
+		msg_rate = (double)total * mhz / (get_cycles() - start);
+
+		if (level->addrs == 1)
+			snprintf(dist,sizeof(dist),"hot");
+		else if (level->zipf > 0)
+			snprintf(dist,sizeof(dist),"zipf %.2f",level->zipf);
+		else
+			snprintf(dist,sizeof(dist),"uniform");
+
+		qsort(lat,total,sizeof(cycles_t),cycles_compare);
+		printf(REPORT_FMT_CONTENTION, level->addrs, dist, msg_rate, total,
+			lat[0] / mhz, lat[total / 2] / mhz, lat[(total - 1) * 99 / 100] / mhz,
+			lat[(total - 1) * 999 / 1000] / mhz, lat[total - 1] / mhz);
+		if (cas_retry)
+			printf(REPORT_EXT_CONTENTION_CAS, (double)succ * 100 / total,
+				succ ? (double)(total - succ) / succ : 0);
+		else
+			putchar('\n');
+
+		/* Log2 buckets of the operation latency, only the non empty ones. */
+		if (user_param->r_flag->histogram) {
+			printf(" Histogram %s x%d [usec:count] :", dist, level->addrs);
+			print_hist_buckets(stdout,lat,total,mhz);
+			putchar('\n');
+		}
+	}
+
+	/* The server prints the last level as a regular BW line. */
+	my_bw_rep->size = user_param->size;
+	my_bw_rep->iters = user_param->iters;
+	my_bw_rep->bw_peak = 0;
+	my_bw_rep->bw_avg = msg_rate * 1000000 * user_param->size / format_factor;
+	my_bw_rep->msgRate_avg = msg_rate;
+	my_bw_rep->bw_avg_p1 = my_bw_rep->bw_avg_p2 = 0;
+	my_bw_rep->msgRate_avg_p1 = my_bw_rep->msgRate_avg_p2 = 0;
+	my_bw_rep->sl = user_param->sl;
+
+cleaning:
+	ctx_set_send_wqes(ctx,user_param,rem_dest);
+	free(ring);
+	free(cdf);
+	free(pos);
+	free(cur);
+	free(slot_ts);
+	free(slot_addr);
+	free(slot_cmp);
+	free(lat);
+	if (expect)
+		free(expect);
+	return return_value;
+}
+
+/* One measured point of the autotune search, indexed into the sweep dimensions. */
+struct tune_point {
+	int			idx[SWEEP_PARAMS + 1];
+	double			rate;
+	double			p99;
+};
+
+#define TUNE_INLINE	(SWEEP_PARAMS)
+
+/******************************************************************************
+ * Sets the parameters of a point, returns 0 if it can't run on these QPs.
+ ******************************************************************************/
+static int tune_set_point(struct perftest_parameters *user_param,const int *idx,int inline_size)
+{
+	struct sweep_dim *sweep = user_param->sweep;
+
+	user_param->num_of_qps = sweep[SWEEP_QPS].val[idx[SWEEP_QPS]];
+	user_param->tx_depth = sweep[SWEEP_TX_DEPTH].val[idx[SWEEP_TX_DEPTH]];
+	user_param->post_list = sweep[SWEEP_POST_LIST].val[idx[SWEEP_POST_LIST]];
+	user_param->cq_mod = sweep[SWEEP_CQ_MOD].val[idx[SWEEP_CQ_MOD]];
+	user_param->inline_size = idx[TUNE_INLINE] ? inline_size : 0;
+
+	/* A post list is signaled once, so it sets the CQ moderation itself. */
+	if (user_param->post_list > 1) {
+		if (idx[SWEEP_CQ_MOD])
+			return 0;
+		user_param->cq_mod = user_param->post_list;
+	}
+
+	return user_param->post_list <= user_param->tx_depth && user_param->cq_mod <= user_param->tx_depth;
+}
+
+/******************************************************************************
+ * Measures one point for a short time and prints its row.
+ ******************************************************************************/
+static int tune_measure(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep,double mhz,struct tune_point *point)
+{
+	uint64_t n;
+
+	ctx_set_send_wqes(ctx,user_param,rem_dest);
+
+	if (perform_warm_up(ctx,user_param)) {
+		fprintf(stderr,"Problems with warm up\n");
+		return FAILURE;
+	}
+
+	ctx->tune_lat_cnt = 0;
+	if (run_iter_bw_adaptive(ctx,user_param,rem_dest)) {
+		fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
+		return FAILURE;
+	}
+
+	point->rate = (double)user_param->iters * user_param->num_of_qps * mhz /
+		(user_param->tcompleted[0] - user_param->tposted[0]);
+
+	point->p99 = 0;
+	if (user_param->autotune == AUTOTUNE_P99 && ctx->tune_lat_cnt) {
+		n = (ctx->tune_lat_cnt < AUTOTUNE_LAT_SAMPLES) ? ctx->tune_lat_cnt : AUTOTUNE_LAT_SAMPLES;
+		qsort(ctx->tune_lat, n, sizeof(cycles_t), cycles_compare);
+		point->p99 = ctx->tune_lat[(n * 99) / 100] / mhz;
+	}
+
+	user_param->tune_p99 = point->p99;
+	print_report_bw(user_param,my_bw_rep);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Searches the sweep grid by coordinate descent: each pass tries every value
+ * of one parameter with the others at their best so far, until a pass changes
+ * nothing. The message size and the QPs and MRs stay those of the largest point.
+ ******************************************************************************/
+int run_autotune_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep)
+{
+	static const int	order[] = {SWEEP_POST_LIST,SWEEP_CQ_MOD,SWEEP_TX_DEPTH,SWEEP_QPS,TUNE_INLINE};
+	struct sweep_dim	*sweep = user_param->sweep;
+	struct tune_point	*points = NULL;
+	struct tune_point	*cur,*best = NULL;
+	int			count[SWEEP_PARAMS + 1];
+	int			idx[SWEEP_PARAMS + 1];
+	int			max_points,num_points = 0;
+	int			d,k,p,v,pass,changed = 1;
+	int			return_value = SUCCESS;
+	double			mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	int			num_of_qps = user_param->num_of_qps;
+	int			tx_depth = user_param->tx_depth;
+	int			post_list = user_param->post_list;
+	int			cq_mod = user_param->cq_mod;
+	int			inline_size = user_param->inline_size;
+	int			target_time_ms = user_param->target_time_ms;
+
+	if (mhz <= 0) {
+		fprintf(stderr," Can't get the CPU frequency to rate the points\n");
+		return FAILURE;
+	}
+
+	for (d = 0; d < SWEEP_PARAMS; d++)
+		count[d] = sweep[d].count;
+	/* Inline can only be turned off per WR, up to what the QPs were created with. */
+	count[TUNE_INLINE] = (user_param->verb == WRITE && user_param->size <= inline_size) ? 2 : 1;
+
+	max_points = 0;
+	for (d = 0; d <= SWEEP_PARAMS; d++)
+		max_points += count[d];
+	max_points *= AUTOTUNE_MAX_PASSES;
+	ALLOCATE(points,struct tune_point,max_points);
+
+	/* Start from the largest point, one WR per post and inline as configured. */
+	memset(idx,0,sizeof(idx));
+	idx[SWEEP_QPS] = count[SWEEP_QPS] - 1;
+	idx[SWEEP_TX_DEPTH] = count[SWEEP_TX_DEPTH] - 1;
+	idx[SWEEP_CQ_MOD] = count[SWEEP_CQ_MOD] - 1;
+	idx[TUNE_INLINE] = count[TUNE_INLINE] - 1;
+
+	if (!user_param->target_time_ms)
+		user_param->target_time_ms = AUTOTUNE_POINT_MS;
+
+	for (pass = 0; pass < AUTOTUNE_MAX_PASSES && changed; pass++) {
+		changed = 0;
+
+		for (k = 0; k < (int)(sizeof(order) / sizeof(order[0])); k++) {
+			d = order[k];
+			if (count[d] < 2)
+				continue;
+
+			for (v = 0; v < count[d]; v++) {
+				int trial[SWEEP_PARAMS + 1];
+
+				memcpy(trial,idx,sizeof(trial));
+				trial[d] = v;
+
+				/* A post list sets the CQ moderation itself, keep those points at cq_mod index 0. */
+				if (sweep[SWEEP_POST_LIST].val[trial[SWEEP_POST_LIST]] > 1) {
+					if (d == SWEEP_CQ_MOD && v)
+						continue;
+					trial[SWEEP_CQ_MOD] = 0;
+				}
+
+				for (p = 0; p < num_points; p++)
+					if (!memcmp(points[p].idx,trial,sizeof(trial)))
+						break;
+				if (p < num_points)
+					continue;
+
+				if (!tune_set_point(user_param,trial,inline_size) || num_points == max_points)
+					continue;
+
+				cur = &points[num_points++];
+				memcpy(cur->idx,trial,sizeof(trial));
+				if (tune_measure(ctx,user_param,rem_dest,my_bw_rep,mhz,cur)) {
+					return_value = FAILURE;
+					goto restore;
+				}
+
+				if (!best || (user_param->autotune == AUTOTUNE_P99 ? cur->p99 < best->p99 : cur->rate > best->rate))
+					best = cur;
+			}
+
+			if (best && memcmp(best->idx,idx,sizeof(idx))) {
+				memcpy(idx,best->idx,sizeof(idx));
+				changed = 1;
+			}
+		}
+	}
+
+	if (!best) {
+		fprintf(stderr," No autotune point fits in tx_depth\n");
+		return_value = FAILURE;
+		goto restore;
+	}
+
+	tune_set_point(user_param,best->idx,inline_size);
+	printf(RESULT_LINE);
+	printf(" Autotune best   : qps=%d tx_depth=%d post_list=%d cq_mod=%d inline=%d",
+		user_param->num_of_qps, user_param->tx_depth, user_param->post_list, user_param->cq_mod, user_param->inline_size);
+	if (user_param->autotune == AUTOTUNE_P99)
+		printf(" -> p99 %.2f[usec], %.3f[Mpps]\n", best->p99, best->rate);
+	else
+		printf(" -> %.3f[Mpps]\n", best->rate);
+	printf(" Explored        : %d points in %d passes\n", num_points, pass);
+
+restore:
+	/* The resources are destroyed for what they were created for. */
+	user_param->num_of_qps = num_of_qps;
+	user_param->tx_depth = tx_depth;
+	user_param->post_list = post_list;
+	user_param->cq_mod = cq_mod;
+	user_param->inline_size = inline_size;
+	user_param->target_time_ms = target_time_ms;
+	free(points);
+	return return_value;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_bw_adaptive(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest)
+{
+	double		mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	double		budget,chunk_cycles,per_iter,rate,delta;
+	double		mean = 0,m2 = 0,ci = 100;
+	cycles_t	start,cycles,sum_cycles = 0;
+	uint64_t	iters,sum_iters = 0;
+	int		n = 0,cq_mod = user_param->cq_mod;
+
+	if (mhz <= 0) {
+		fprintf(stderr," Can't get the CPU frequency to scale the iterations\n");
+		return FAILURE;
+	}
+
+	budget = (double)(user_param->target_time_ms ? user_param->target_time_ms : ADAPTIVE_MAX_MS) * mhz * 1000;
+	chunk_cycles = user_param->target_time_ms ? budget / ADAPTIVE_TIME_CHUNKS : (double)ADAPTIVE_CHUNK_MS * mhz * 1000;
+	start = get_cycles();
+
+	/* The pilot fills the send queue twice, it only sizes the first chunk. */
+	user_param->iters = ((2 * user_param->tx_depth + cq_mod - 1) / cq_mod) * cq_mod;
+	if (run_iter_bw(ctx,user_param))
+		return FAILURE;
+
+	per_iter = (double)(user_param->tcompleted[0] - user_param->tposted[0]) / user_param->iters;
+
+	while (1) {
+		iters = ((uint64_t)(chunk_cycles / per_iter) / cq_mod) * cq_mod;
+		if (iters < (uint64_t)cq_mod)
+			iters = cq_mod;
+
+		/* The report counts all the chunks in the int iterations field. */
+		if (n >= 2 && sum_iters + iters > INT_MAX)
+			break;
+		if (iters > INT_MAX - sum_iters)
+			iters = ((INT_MAX - sum_iters) / cq_mod) * cq_mod;
+
+		user_param->iters = iters;
+		ctx_set_send_wqes(ctx,user_param,rem_dest);
+
+		if (run_iter_bw(ctx,user_param))
+			return FAILURE;
+
+		cycles = user_param->tcompleted[0] - user_param->tposted[0];
+		sum_cycles += cycles;
+		sum_iters += iters;
+
+		/* Running mean and variance of the per chunk message rate. */
+		rate = (double)iters / cycles;
+		delta = rate - mean;
+		mean += delta / ++n;
+		m2 += delta * (rate - mean);
+
+		if (n > 1)
+			ci = 100 * student_t95(n - 1) * sqrt(m2 / (n - 1) / n) / mean;
+
+		if (n >= ADAPTIVE_MIN_CHUNKS && user_param->target_ci > 0 && ci <= user_param->target_ci)
+			break;
+
+		if (n >= 2 && get_cycles() - start >= budget)
+			break;
+
+		per_iter = (double)sum_cycles / sum_iters;
+	}
+
+	/* Report the chunks as one run. */
+	user_param->iters = sum_iters;
+	user_param->tposted[0] = 0;
+	user_param->tcompleted[0] = sum_cycles;
+	user_param->achieved_ci = ci;
+	return SUCCESS;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -3047,14 +5118,8 @@ static inline void set_on_first_rx_packet(struct perftest_parameters *user_param
 {
 	if (user_param->test_type == DURATION) {
 
-		duration_param=user_param;
 		user_param->iters=0;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
-		if (user_param->margin > 0) 
-			alarm(user_param->margin);
-		else
-			catch_alarm(0);
+		ctx_timer_start(user_param);
 
 	} else if (user_param->tst == BW) {
 		user_param->tposted[0] = get_cycles();
@@ -3095,18 +5160,13 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 	else
 		tot_iters = (uint64_t)user_param->iters*user_param->num_of_qps;
 
-	if (user_param->test_type == ITERATIONS) {
-		check_alive_data.is_events = user_param->use_event;
-		signal(SIGALRM, check_alive);
-		alarm(60);
-	}
-
-	check_alive_data.g_total_iters = tot_iters;
 
-	while (rcnt < tot_iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+	ctx_check_alive_start(user_param,tot_iters);
 
-		if (user_param->use_event) {
-			if (ctx_notify_events(ctx->channel)) {
+	while (rcnt < tot_iters || (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE)) {
+
+		if (user_param->use_event && user_param->event_spin < 0) {
+			if (ctx_wait_cq_event(ctx,user_param)) {
 				fprintf(stderr ," Failed to notify events to CQ");
 				return_value = 1;
 				goto cleaning;
@@ -3119,7 +5179,10 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 				ne = ctx->recv_cq_family->poll_cnt(ctx->recv_cq, CTX_POLL_BATCH);
 			else {
 			#endif
-				if (user_param->connection_type == DC)
+				if (user_param->event_spin >= 0)
+					ne = ctx_poll_cq_hybrid(ctx,user_param,
+						user_param->connection_type == DC ? ctx->send_cq : ctx->recv_cq,CTX_POLL_BATCH,wc);
+				else if (user_param->connection_type == DC)
 					ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
 				else
 					ne = ibv_poll_cq(ctx->recv_cq,CTX_POLL_BATCH,wc);
@@ -3148,7 +5211,7 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 
 					rcnt_for_qp[wc_id]++;
 					rcnt++;
-					check_alive_data.current_totrcnt = rcnt;
+					user_param->alive.current_totrcnt = rcnt;
 
 					if (user_param->test_type==DURATION && user_param->state == SAMPLE_STATE) {
 						if (user_param->report_per_port) {
@@ -3157,7 +5220,14 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 						user_param->iters++;
 					}
 
-					if (user_param->test_type==DURATION || rcnt_for_qp[wc_id] + size_per_qp <= user_param->iters) {
+					if (user_param->recv_batch > 1 &&
+						(user_param->test_type==DURATION || rcnt_for_qp[wc_id] + size_per_qp <= user_param->iters)) {
+						if (ctx_post_recv_batch(ctx,user_param,wc_id,
+							user_param->test_type == ITERATIONS && rcnt_for_qp[wc_id] + size_per_qp == user_param->iters)) {
+							return_value = 1;
+							goto cleaning;
+						}
+					} else if (user_param->test_type==DURATION || rcnt_for_qp[wc_id] + size_per_qp <= user_param->iters) {
 						#ifdef HAVE_ACCL_VERBS
 						if (user_param->verb_type == ACCL_INTF) {
 							if (ctx->qp_burst_family[wc_id]->recv_burst(ctx->qp[wc_id], ctx->rwr[wc_id].sg_list, 1)) {
@@ -3185,7 +5255,8 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 						#ifdef HAVE_ACCL_VERBS
 						}
 						#endif
-						if (SIZE(user_param->connection_type,user_param->size,!(int)user_param->machine) <= (ctx->cycle_buffer / 2)) {
+						if (user_param->num_sge_max == 1 &&
+							SIZE(user_param->connection_type,user_param->size,!(int)user_param->machine) <= (ctx->cycle_buffer / 2)) {
 							increase_loc_addr(ctx->rwr[wc_id].sg_list,
 									user_param->size,
 									rcnt_for_qp[wc_id] + size_per_qp,
@@ -3243,7 +5314,7 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 			goto cleaning;
 		}
 		else if (ne == 0) {
-			if (check_alive_data.to_exit) {
+			if (ctx_check_alive(user_param)) {
 				user_param->check_alive_exited = 1;
 				return_value = 0;
 				goto cleaning;
@@ -3260,7 +5331,7 @@ cleaning:
 			return_value = 1;
 	}
 
-	check_alive_data.last_totrcnt=0;
+	user_param->alive.deadline = TIMER_NEVER;
 	free(wc);
 	free(rcnt_for_qp);
 	free(swc);
@@ -3269,47 +5340,165 @@ cleaning:
 	return return_value;
 }
 
+/******************************************************************************
+ * Run infinitely reporting.
+ * The data path publishes its counters with single writer atomic stores, and
+ * a separate thread samples them every interval, so no report work runs in
+ * signal context or stalls the sender.
+ ******************************************************************************/
+struct inf_report {
+	struct perftest_parameters	*user_param;
+	double				cycles_to_units;
+	uint64_t			completed;
+	uint64_t			lat_hist[INF_LAT_BUCKETS];
+};
+
+static inline int inf_lat_bucket(cycles_t lat)
+{
+	int msb;
+
+	if (lat < (1 << INF_LAT_SUB_BITS))
+		return (int)lat;
+
+	msb = 63 - __builtin_clzll(lat);
+	return ((msb - INF_LAT_SUB_BITS + 1) << INF_LAT_SUB_BITS) +
+		(int)((lat >> (msb - INF_LAT_SUB_BITS)) & ((1 << INF_LAT_SUB_BITS) - 1));
+}
+
+static inline double inf_lat_bucket_value(int bucket)
+{
+	int msb = (bucket >> INF_LAT_SUB_BITS) + INF_LAT_SUB_BITS - 1;
+	int sub = bucket & ((1 << INF_LAT_SUB_BITS) - 1);
+
+	if (bucket < (1 << INF_LAT_SUB_BITS))
+		return bucket;
+
+	return (double)((1ULL << INF_LAT_SUB_BITS) + sub) * (1ULL << (msb - INF_LAT_SUB_BITS));
+}
+
+static double inf_lat_percentile(uint64_t *hist, uint64_t samples, double percent)
+{
+	int		i;
+	uint64_t	seen = 0;
+	uint64_t	target = (uint64_t)(samples * percent / 100);
+
+	if (target >= samples)
+		target = samples - 1;
+
+	for (i = 0; i < INF_LAT_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > target)
+			return inf_lat_bucket_value(i);
+	}
+	return inf_lat_bucket_value(INF_LAT_BUCKETS - 1);
+}
+
+static void *inf_reporter(void *arg)
+{
+	struct inf_report		*rep = arg;
+	struct perftest_parameters	*user_param = rep->user_param;
+	struct bw_report_data		bw_rep;
+	uint64_t			last_hist[INF_LAT_BUCKETS];
+	uint64_t			hist[INF_LAT_BUCKETS];
+	uint64_t			completed,last_completed = 0;
+	uint64_t			samples;
+	cycles_t			now,last = get_cycles();
+	double				seconds,tsize;
+	double				format_factor = (user_param->report_fmt == MBS) ? 0x100000 : 125000000;
+	int				bi_factor = user_param->duplex ? (user_param->verb == SEND ? 1 : 2) : 1;
+	struct timespec			interval;
+	int				i;
+
+	interval.tv_sec = user_param->duration / 1000;
+	interval.tv_nsec = (user_param->duration % 1000) * 1000000L;
+
+	memset(last_hist, 0, sizeof(last_hist));
+	memset(&bw_rep, 0, sizeof(bw_rep));
+
+	tsize = (user_param->size_dist.type != SIZE_DIST_NONE) ?
+		user_param->size_dist.avg_size : user_param->size;
+
+	while (1) {
+		nanosleep(&interval,NULL);
+
+		now = get_cycles();
+		completed = __atomic_load_n(&rep->completed, __ATOMIC_ACQUIRE);
+		seconds = (now - last) / rep->cycles_to_units;
+
+		bw_rep.size = (unsigned long)tsize;
+		bw_rep.iters = completed - last_completed;
+		bw_rep.bw_avg = bi_factor * tsize * bw_rep.iters / (seconds * format_factor);
+		bw_rep.msgRate_avg = bi_factor * bw_rep.iters / (seconds * 1000000);
+		bw_rep.sl = user_param->sl;
+		print_full_bw_report(user_param, &bw_rep, NULL);
+
+		samples = 0;
+		for (i = 0; i < INF_LAT_BUCKETS; i++) {
+			hist[i] = __atomic_load_n(&rep->lat_hist[i], __ATOMIC_RELAXED) - last_hist[i];
+			last_hist[i] += hist[i];
+			samples += hist[i];
+		}
+
+		if (samples && user_param->output == FULL_VERBOSITY)
+			printf(" Completion lat. : p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f [usec]\n",
+				inf_lat_percentile(hist, samples, 50) * 1000000 / rep->cycles_to_units,
+				inf_lat_percentile(hist, samples, 99) * 1000000 / rep->cycles_to_units,
+				inf_lat_percentile(hist, samples, 99.9) * 1000000 / rep->cycles_to_units,
+				inf_lat_percentile(hist, samples, 100) * 1000000 / rep->cycles_to_units);
+		fflush(stdout);
+
+		last = now;
+		last_completed = completed;
+	}
+	return NULL;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
 int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_parameters *user_param)
 {
-	int 			i,j = 0;
+	int 			i;
 	int 			index = 0,ne;
 	int 			err = 0;
+	int			wc_id;
 	#ifdef HAVE_VERBS_EXP
 	struct ibv_exp_send_wr 	*bad_exp_wr = NULL;
 	#endif
-	uint64_t		*scnt_for_qp = NULL;
 	struct ibv_send_wr 	*bad_wr = NULL;
 	struct ibv_wc 		*wc = NULL;
 	int 			num_of_qps = user_param->num_of_qps;
 	int 			return_value = 0;
-
-	ALLOCATE(wc ,struct ibv_wc ,CTX_POLL_BATCH);
-	ALLOCATE(scnt_for_qp,uint64_t,user_param->num_of_qps);
-	memset(scnt_for_qp,0,sizeof(uint64_t)*user_param->num_of_qps);
-
-	duration_param=user_param;
-	signal(SIGALRM,catch_alarm_infintely);
-	alarm(user_param->duration);
-	user_param->iters = 0;
+	uint64_t		totccnt = 0;
+	cycles_t		*signal_tposted = NULL;
+	cycles_t		lat;
+	struct inf_report	*rep = NULL;
+	pthread_t		reporter;
+	int			bucket;
 
 	/* Will be 0, in case of Duration (look at force_dependencies or in the exp above) */
 	if (user_param->duplex && (user_param->use_xrc || user_param->connection_type == DC))
 		num_of_qps /= 2;
 
-	for (i=0; i < num_of_qps; i++)
-		for (j=0 ; j < user_param->post_list; j++) {
-			#ifdef HAVE_VERBS_EXP
-			if (user_param->use_exp == 1)
-				ctx->exp_wr[i*user_param->post_list +j].exp_send_flags |= IBV_EXP_SEND_SIGNALED;
-			else
-			#endif
-				ctx->wr[i*user_param->post_list +j].send_flags |= IBV_SEND_SIGNALED;
-		}
+	ALLOCATE(wc ,struct ibv_wc ,CTX_POLL_BATCH);
+	ALLOCATE(signal_tposted,cycles_t,num_of_qps*user_param->tx_depth);
+	ALLOCATE(rep,struct inf_report,1);
+	memset(rep,0,sizeof(struct inf_report));
+
+	rep->user_param = user_param;
+	rep->cycles_to_units = get_cpu_mhz(user_param->cpu_freq_f) * 1000000;
+	if (rep->cycles_to_units == 0) {
+		fprintf(stderr,"Can't produce a report\n");
+		return_value = 1;
+		goto free_rep;
+	}
 
-	user_param->tposted[0] = get_cycles();
+	user_param->iters = 0;
+	if (pthread_create(&reporter,NULL,inf_reporter,rep)) {
+		fprintf(stderr,"Couldn't create the report thread\n");
+		return_value = 1;
+		goto free_rep;
+	}
 
 	/* main loop for posting */
 	while (1) {
@@ -3317,12 +5506,25 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 		/* main loop to run over all the qps and post each time n messages */
 		for (index =0 ; index < num_of_qps ; index++) {
 
-			while (ctx->scnt[index] < user_param->tx_depth) {
+			while ((ctx->scnt[index] - ctx->ccnt[index]) < user_param->tx_depth) {
 				if (ctx->send_rcredit) {
-					uint32_t swindow = scnt_for_qp[index] + user_param->post_list - ctx->credit_buf[index];
+					uint32_t swindow = ctx->scnt[index] + user_param->post_list - ctx->credit_buf[index];
 					if (swindow >= user_param->rx_depth)
 						break;
 				}
+				if (user_param->post_list == 1 && ctx->scnt[index] % user_param->cq_mod == 0 && user_param->cq_mod > 1) {
+					#ifdef HAVE_VERBS_EXP
+					if (user_param->use_exp == 1)
+						ctx->exp_wr[index].exp_send_flags &= ~IBV_EXP_SEND_SIGNALED;
+					else
+					#endif
+						ctx->wr[index].send_flags &= ~IBV_SEND_SIGNALED;
+				}
+
+				/* The stamp of the signaled WR, the last one of this post, times the completion. */
+				signal_tposted[index * user_param->tx_depth +
+					(ctx->scnt[index] + user_param->post_list - 1) % user_param->tx_depth] = get_cycles();
+
 				#ifdef HAVE_VERBS_EXP
 				if (user_param->use_exp == 1)
 					err = (ctx->exp_post_send_func_pointer)(ctx->qp[index],&ctx->exp_wr[index*user_param->post_list],&bad_exp_wr);
@@ -3336,8 +5538,23 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 					return_value = 1;
 					goto cleaning;
 				}
+				if (ctx->size_ring)
+					set_dist_size(ctx,index,user_param->post_list,ctx->scnt[index] + user_param->post_list);
+
+				if (ctx->ud_ring)
+					set_ud_dest(ctx,index,user_param->post_list,ctx->scnt[index] + user_param->post_list);
+
 				ctx->scnt[index] += user_param->post_list;
-				scnt_for_qp[index] += user_param->post_list;
+
+				/* ask for completion on this wr */
+				if (user_param->post_list == 1 && ctx->scnt[index] % user_param->cq_mod == user_param->cq_mod - 1) {
+					#ifdef HAVE_VERBS_EXP
+					if (user_param->use_exp == 1)
+						ctx->exp_wr[index].exp_send_flags |= IBV_EXP_SEND_SIGNALED;
+					else
+					#endif
+						ctx->wr[index].send_flags |= IBV_SEND_SIGNALED;
+				}
 			}
 		}
 
@@ -3347,14 +5564,22 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 		if (ne > 0) {
 
 			for (i = 0; i < ne; i++) {
+				wc_id = (int)wc[i].wr_id;
 				if (wc[i].status != IBV_WC_SUCCESS) {
-					NOTIFY_COMP_ERROR_SEND(wc[i],ctx->scnt[(int)wc[i].wr_id],ctx->scnt[(int)wc[i].wr_id]);
+					NOTIFY_COMP_ERROR_SEND(wc[i],ctx->scnt[wc_id],ctx->ccnt[wc_id]);
 					return_value = 1;
 					goto cleaning;
 				}
-				ctx->scnt[(int)wc[i].wr_id]--;
-				user_param->iters++;
+
+				lat = get_cycles() - signal_tposted[wc_id * user_param->tx_depth +
+					(ctx->ccnt[wc_id] + user_param->cq_mod - 1) % user_param->tx_depth];
+				bucket = inf_lat_bucket(lat);
+				__atomic_store_n(&rep->lat_hist[bucket], rep->lat_hist[bucket] + 1, __ATOMIC_RELAXED);
+
+				ctx->ccnt[wc_id] += user_param->cq_mod;
+				totccnt += user_param->cq_mod;
 			}
+			__atomic_store_n(&rep->completed, totccnt, __ATOMIC_RELEASE);
 
 		} else if (ne < 0) {
 			fprintf(stderr, "poll CQ failed %d\n",ne);
@@ -3364,7 +5589,11 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 	}
 
 cleaning:
-	free(scnt_for_qp);
+	pthread_cancel(reporter);
+	pthread_join(reporter,NULL);
+free_rep:
+	free(rep);
+	free(signal_tposted);
 	free(wc);
 	return return_value;
 }
@@ -3531,23 +5760,11 @@ int run_iter_bi(struct pingpong_context *ctx,
 
 		before_first_rx = OFF;
 		if (user_param->test_type == DURATION) {
-			duration_param=user_param;
 			user_param->iters=0;
-			duration_param->state = START_STATE;
-			signal(SIGALRM, catch_alarm);
-
-			if (user_param->margin > 0 )
-				alarm(user_param->margin);
-			else
-				catch_alarm(0); /* move to next state */
+			ctx_timer_start(user_param);
 		}
 	}
 
-	if (user_param->test_type == ITERATIONS) {
-		check_alive_data.is_events = user_param->use_event;
-		signal(SIGALRM, check_alive);
-		alarm(60);
-	}
 
 
 	if(user_param->duplex && (user_param->use_xrc || user_param->connection_type == DC))
@@ -3555,9 +5772,9 @@ int run_iter_bi(struct pingpong_context *ctx,
 
 	tot_iters = (uint64_t)user_param->iters*num_of_qps;
 	iters=user_param->iters;
-	check_alive_data.g_total_iters = tot_iters;
+	ctx_check_alive_start(user_param,tot_iters);
 
-	while ((user_param->test_type == DURATION && user_param->state != END_STATE) ||
+	while ((user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE) ||
 							totccnt < tot_iters || totrcnt < tot_iters ) {
 
 		for (index=0; index < num_of_qps; index++) {
@@ -3580,7 +5797,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 				if (user_param->noPeak == OFF)
 					user_param->tposted[totscnt] = get_cycles();
 
-				if (user_param->test_type == DURATION && duration_param->state == END_STATE)
+				if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 					break;
 
 				#ifdef HAVE_VERBS_EXP
@@ -3599,7 +5816,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 					goto cleaning;
 				}
 
-				if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
+				if (user_param->post_list == 1 && user_param->num_sge_max == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
 					#ifdef HAVE_VERBS_EXP
 					if (user_param->use_exp == 1)
 						increase_loc_addr(ctx->exp_wr[index].sg_list,user_param->size,ctx->scnt[index],
@@ -3610,6 +5827,9 @@ int run_iter_bi(struct pingpong_context *ctx,
 								ctx->my_addr[index],0,ctx->cache_line_size,ctx->cycle_buffer);
 				}
 
+				if (ctx->size_ring)
+					set_dist_size(ctx,index,user_param->post_list,ctx->scnt[index] + user_param->post_list);
+
 				ctx->scnt[index] += user_param->post_list;
 				totscnt += user_param->post_list;
 
@@ -3628,7 +5848,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 		}
 		if (user_param->use_event) {
 
-			if (ctx_notify_events(ctx->channel)) {
+			if (ctx_wait_cq_event(ctx,user_param)) {
 				fprintf(stderr,"Failed to notify events to CQ");
 				return_value = 1;
 				goto cleaning;
@@ -3641,14 +5861,8 @@ int run_iter_bi(struct pingpong_context *ctx,
 			if (user_param->machine == SERVER && before_first_rx == ON) {
 				before_first_rx = OFF;
 				if (user_param->test_type == DURATION) {
-					duration_param=user_param;
 					user_param->iters=0;
-					duration_param->state = START_STATE;
-					signal(SIGALRM, catch_alarm);
-					if (user_param->margin > 0 )
-						alarm(user_param->margin);
-					else
-						catch_alarm(0); /* move to next state */
+					ctx_timer_start(user_param);
 				}
 			}
 
@@ -3661,7 +5875,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 
 				rcnt_for_qp[wc[i].wr_id]++;
 				totrcnt++;
-				check_alive_data.current_totrcnt = totrcnt;
+				user_param->alive.current_totrcnt = totrcnt;
 
 				if (user_param->test_type==DURATION && user_param->state == SAMPLE_STATE) {
 					if (user_param->report_per_port) {
@@ -3670,7 +5884,14 @@ int run_iter_bi(struct pingpong_context *ctx,
 					user_param->iters++;
 				}
 
-				if (user_param->test_type==DURATION || rcnt_for_qp[wc[i].wr_id] + size_per_qp <= user_param->iters) {
+				if (user_param->recv_batch > 1 &&
+					(user_param->test_type==DURATION || rcnt_for_qp[wc[i].wr_id] + size_per_qp <= user_param->iters)) {
+					if (ctx_post_recv_batch(ctx,user_param,(int)wc[i].wr_id,
+						user_param->test_type == ITERATIONS && rcnt_for_qp[wc[i].wr_id] + size_per_qp == user_param->iters)) {
+						return_value = 1;
+						goto cleaning;
+					}
+				} else if (user_param->test_type==DURATION || rcnt_for_qp[wc[i].wr_id] + size_per_qp <= user_param->iters) {
 					if (user_param->use_srq) {
 						if (ibv_post_srq_recv(ctx->srq, &ctx->rwr[wc[i].wr_id],&bad_wr_recv)) {
 							fprintf(stderr, "Couldn't post recv SRQ. QP = %d: counter=%d\n",(int)wc[i].wr_id,(int)totrcnt);
@@ -3687,7 +5908,8 @@ int run_iter_bi(struct pingpong_context *ctx,
 						}
 					}
 
-					if (SIZE(user_param->connection_type,user_param->size,!(int)user_param->machine) <= (ctx->cycle_buffer / 2)) {
+					if (user_param->num_sge_max == 1 &&
+						SIZE(user_param->connection_type,user_param->size,!(int)user_param->machine) <= (ctx->cycle_buffer / 2)) {
 						increase_loc_addr(ctx->rwr[wc[i].wr_id].sg_list,
 								user_param->size,
 								rcnt_for_qp[wc[i].wr_id] + size_per_qp -1,
@@ -3754,7 +5976,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 			goto cleaning;
 		}
 		else if (ne == 0) {
-			if (check_alive_data.to_exit) {
+			if (ctx_check_alive(user_param)) {
 				user_param->check_alive_exited = 1;
 				return_value = 0;
 				goto cleaning;
@@ -3783,48 +6005,388 @@ int run_iter_bi(struct pingpong_context *ctx,
 					totccnt += user_param->cq_mod;
 					ctx->ccnt[(int)wc_tx[i].wr_id] += user_param->cq_mod;
 
-					if (user_param->noPeak == OFF) {
+					if (user_param->noPeak == OFF) {
+
+						if ((user_param->test_type == ITERATIONS && (totccnt >= tot_iters - 1)))
+							user_param->tcompleted[tot_iters - 1] = get_cycles();
+						else
+							user_param->tcompleted[totccnt-1] = get_cycles();
+					}
+
+					if (user_param->test_type==DURATION && user_param->state == SAMPLE_STATE) {
+						if (user_param->report_per_port) {
+							user_param->iters_per_port[user_param->port_by_qp[(int)wc[i].wr_id]] += user_param->cq_mod;
+						}
+						user_param->iters += user_param->cq_mod;
+					}
+				}
+			}
+
+		} else if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			return_value = FAILURE;
+			goto cleaning;
+		}
+	}
+
+	if (user_param->noPeak == ON && user_param->test_type == ITERATIONS) {
+		user_param->tcompleted[0] = get_cycles();
+	}
+
+	if (ctx->send_rcredit) {
+		if (clean_scq_credit(tot_scredit, ctx, user_param)) {
+			return_value = 1;
+			goto cleaning;
+		}
+	}
+
+cleaning:
+	user_param->alive.deadline = TIMER_NEVER;
+	free(rcnt_for_qp);
+	free(scredit_for_qp);
+	free(wc);
+	free(wc_tx);
+	return return_value;
+}
+
+/******************************************************************************
+ * Points WR 0 at one slot of a pipelined latency loop: wr_id carries the slot,
+ * and in WRITE the slot also moves the local and remote addresses.
+ ******************************************************************************/
+static inline void qd_set_wr(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+			     uint64_t wr_id,uint64_t laddr,uint64_t raddr)
+{
+	#ifdef HAVE_VERBS_EXP
+	if (user_param->use_exp == 1) {
+		ctx->exp_wr[0].wr_id = wr_id;
+		if (user_param->verb == WRITE) {
+			ctx->exp_wr[0].sg_list->addr = laddr;
+			ctx->exp_wr[0].wr.rdma.remote_addr = raddr;
+		}
+		return;
+	}
+	#endif
+
+	ctx->wr[0].wr_id = wr_id;
+	if (user_param->verb == WRITE) {
+		ctx->wr[0].sg_list->addr = laddr;
+		ctx->wr[0].wr.rdma.remote_addr = raddr;
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static inline int qd_post_wr(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	#ifdef HAVE_VERBS_EXP
+	struct ibv_exp_send_wr	*bad_exp_wr = NULL;
+	#endif
+	struct ibv_send_wr	*bad_wr = NULL;
+
+	#ifdef HAVE_VERBS_EXP
+	if (user_param->use_exp == 1)
+		return (ctx->exp_post_send_func_pointer)(ctx->qp[0],&ctx->exp_wr[0],&bad_exp_wr);
+	else
+		return (ctx->post_send_func_pointer)(ctx->qp[0],&ctx->wr[0],&bad_wr);
+	#else
+	return ibv_post_send(ctx->qp[0],&ctx->wr[0],&bad_wr);
+	#endif
+}
+
+/******************************************************************************
+ * Sets WR 0 signaled (and inline when it fits) for a pipelined loop and saves
+ * the wr_id and addresses the loop restores when it is done.
+ ******************************************************************************/
+static void qd_prepare_wr(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+			  uint64_t *wr_id,uint64_t *laddr,uint64_t *raddr)
+{
+	int use_inline = (user_param->size <= user_param->inline_size);
+
+	#ifdef HAVE_VERBS_EXP
+	if (user_param->use_exp == 1) {
+		ctx->exp_wr[0].sg_list->length = user_param->size;
+		ctx->exp_wr[0].exp_send_flags = IBV_EXP_SEND_SIGNALED;
+		if (use_inline)
+			ctx->exp_wr[0].exp_send_flags |= IBV_EXP_SEND_INLINE;
+		*wr_id = ctx->exp_wr[0].wr_id;
+		*laddr = ctx->exp_wr[0].sg_list->addr;
+		*raddr = ctx->exp_wr[0].wr.rdma.remote_addr;
+		return;
+	}
+	#endif
+
+	ctx->wr[0].sg_list->length = user_param->size;
+	ctx->wr[0].send_flags = IBV_SEND_SIGNALED;
+	if (use_inline)
+		ctx->wr[0].send_flags |= IBV_SEND_INLINE;
+	*wr_id = ctx->wr[0].wr_id;
+	*laddr = ctx->wr[0].sg_list->addr;
+	*raddr = ctx->wr[0].wr.rdma.remote_addr;
+}
+
+/******************************************************************************
+ * Reaps send completions until fewer than limit WQEs are outstanding. A limit
+ * above the send queue depth makes it a single non blocking pass.
+ ******************************************************************************/
+static int qd_poll_send(struct pingpong_context *ctx,int *outstanding,int limit,uint64_t scnt)
+{
+	struct ibv_wc	wc[CTX_POLL_BATCH];
+	int		ne,i;
+
+	do {
+		ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
+		if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			return FAILURE;
+		}
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_SEND(wc[i],scnt,scnt - *outstanding + i);
+				return FAILURE;
+			}
+		}
+		*outstanding -= ne;
+	} while (*outstanding >= limit);
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Write latency at queue depth qd. Operation n goes to slot n % qd, a region of
+ * its own in the buffer whose last byte carries the generation n / qd + 1. The
+ * server polls the slots in order and echoes each into the same slot, so the
+ * client keeps qd writes in flight and times each from its slot to its echo.
+ ******************************************************************************/
+static int run_iter_lat_write_qd(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t		scnt = 0;
+	uint64_t		rcnt = 0;
+	uint64_t		wr_id,laddr,raddr;
+	int			outstanding = 0;
+	int			qd = user_param->qd;
+	int			stride = INC(user_param->size,ctx->cache_line_size);
+	int			slot;
+	char			*post_base = (char*)ctx->buf[0] + user_param->size - 1;
+	volatile char		*poll_base = (char*)ctx->buf[0] +
+					user_param->num_of_qps*BUFF_SIZE(ctx->size,ctx->cycle_buffer) + user_param->size - 1;
+
+	if ((uint64_t)qd * stride > BUFF_SIZE(ctx->size,ctx->cycle_buffer)) {
+		fprintf(stderr," %d slots of %d bytes don't fit in the buffer\n",qd,stride);
+		return FAILURE;
+	}
+
+	qd_prepare_wr(ctx,user_param,&wr_id,&laddr,&raddr);
+	user_param->qd_samples = 0;
+
+	while (rcnt < user_param->iters) {
+
+		/* The client fills the pipe, the server only answers what arrived. */
+		while (user_param->machine == CLIENT && scnt < user_param->iters && scnt - rcnt < qd &&
+				outstanding < user_param->tx_depth) {
+
+			slot = scnt % qd;
+			post_base[slot*stride] = (char)(scnt / qd + 1);
+			qd_set_wr(ctx,user_param,slot,laddr + slot*stride,raddr + slot*stride);
+			ctx->qd_slot[slot] = get_cycles();
+			if (qd_post_wr(ctx,user_param)) {
+				fprintf(stderr,"Couldn't post send: scnt=%lu\n",scnt);
+				return 1;
+			}
+			outstanding++;
+			scnt++;
+		}
+
+		slot = rcnt % qd;
+		if (poll_base[slot*stride] == (char)(rcnt / qd + 1)) {
+
+			/* On the server a slot is timed from its echo to the next write into it. */
+			if (user_param->machine == CLIENT || rcnt >= qd)
+				user_param->tcompleted[user_param->qd_samples++] = get_cycles() - ctx->qd_slot[slot];
+			rcnt++;
+
+			if (user_param->machine == SERVER) {
+				if (qd_poll_send(ctx,&outstanding,user_param->tx_depth,scnt))
+					return FAILURE;
+
+				post_base[slot*stride] = poll_base[slot*stride];
+				qd_set_wr(ctx,user_param,slot,laddr + slot*stride,raddr + slot*stride);
+				ctx->qd_slot[slot] = get_cycles();
+				if (qd_post_wr(ctx,user_param)) {
+					fprintf(stderr,"Couldn't post send: scnt=%lu\n",scnt);
+					return 1;
+				}
+				outstanding++;
+				scnt++;
+			}
+		}
+
+		if (qd_poll_send(ctx,&outstanding,user_param->tx_depth + 1,scnt))
+			return FAILURE;
+	}
+
+	if (qd_poll_send(ctx,&outstanding,1,scnt))
+		return FAILURE;
+
+	qd_set_wr(ctx,user_param,wr_id,laddr,raddr);
+
+	/* A later run of the same size must not take these last values for its first. */
+	for (slot = 0; slot < qd; slot++)
+		poll_base[slot*stride] = 0;
+
+	return 0;
+}
+
+/******************************************************************************
+ * Read and atomic latency at queue depth qd. Operation n is posted with its
+ * slot n % qd as wr_id, and each completion is timed from the slot it names.
+ ******************************************************************************/
+static int run_iter_lat_qd(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t		scnt = 0;
+	uint64_t		ccnt = 0;
+	uint64_t		wr_id,laddr,raddr;
+	int			qd = user_param->qd;
+	int			ne,i,slot;
+	cycles_t		now;
+	struct ibv_wc		wc[CTX_POLL_BATCH];
+
+	qd_prepare_wr(ctx,user_param,&wr_id,&laddr,&raddr);
+	user_param->qd_samples = 0;
+
+	while (ccnt < user_param->iters) {
+
+		while (scnt < user_param->iters && scnt - ccnt < qd) {
+			slot = scnt % qd;
+			qd_set_wr(ctx,user_param,slot,laddr,raddr);
+			ctx->qd_slot[slot] = get_cycles();
+			if (qd_post_wr(ctx,user_param)) {
+				fprintf(stderr,"Couldn't post send: scnt=%lu\n",scnt);
+				return 1;
+			}
+			scnt++;
+		}
+
+		ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
+		if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			return FAILURE;
+		}
+
+		now = get_cycles();
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_SEND(wc[i],scnt,ccnt);
+				return 1;
+			}
+			user_param->tcompleted[user_param->qd_samples++] = now - ctx->qd_slot[wc[i].wr_id];
+			ccnt++;
+		}
+	}
+
+	qd_set_wr(ctx,user_param,wr_id,laddr,raddr);
+	return 0;
+}
+
+/******************************************************************************
+ * Send latency at queue depth qd. The client keeps qd sends in flight, each
+ * posted with its slot n % qd as wr_id, and the server answers every message
+ * it receives. RC delivers the answers in order, so answer n closes slot n % qd.
+ ******************************************************************************/
+static int run_iter_lat_send_qd(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t		scnt = 0;
+	uint64_t		rcnt = 0;
+	uint64_t		wr_id,laddr,raddr;
+	int			outstanding = 0;
+	int			qd = user_param->qd;
+	int			ne,slot;
+	int			firstRx = 1;
+	int			size_per_qp = (user_param->use_srq) ?
+					user_param->rx_depth/user_param->num_of_qps : user_param->rx_depth;
+	struct ibv_wc		wc;
+	struct ibv_recv_wr	*bad_wr_recv;
+
+	qd_prepare_wr(ctx,user_param,&wr_id,&laddr,&raddr);
+	user_param->qd_samples = 0;
+
+	while (rcnt < user_param->iters) {
+
+		/* The client fills the pipe, the server only answers what arrived. */
+		while (user_param->machine == CLIENT && scnt < user_param->iters && scnt - rcnt < qd &&
+				outstanding < user_param->tx_depth) {
+
+			slot = scnt % qd;
+			qd_set_wr(ctx,user_param,slot,laddr,raddr);
+			ctx->qd_slot[slot] = get_cycles();
+			if (qd_post_wr(ctx,user_param)) {
+				fprintf(stderr,"Couldn't post send: scnt=%lu\n",scnt);
+				return 1;
+			}
+			outstanding++;
+			scnt++;
+		}
+
+		ne = ibv_poll_cq(ctx->recv_cq,1,&wc);
+		if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			return 1;
+		}
 
-						if ((user_param->test_type == ITERATIONS && (totccnt >= tot_iters - 1)))
-							user_param->tcompleted[tot_iters - 1] = get_cycles();
-						else
-							user_param->tcompleted[totccnt-1] = get_cycles();
-					}
+		if (ne > 0) {
+			if (firstRx) {
+				set_on_first_rx_packet(user_param);
+				firstRx = 0;
+			}
 
-					if (user_param->test_type==DURATION && user_param->state == SAMPLE_STATE) {
-						if (user_param->report_per_port) {
-							user_param->iters_per_port[user_param->port_by_qp[(int)wc[i].wr_id]] += user_param->cq_mod;
-						}
-						user_param->iters += user_param->cq_mod;
+			if (wc.status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_RECV(wc,rcnt);
+				return 1;
+			}
+
+			/* On the server a slot is timed from its answer to the next message in it. */
+			slot = rcnt % qd;
+			if (user_param->machine == CLIENT || rcnt >= qd)
+				user_param->tcompleted[user_param->qd_samples++] = get_cycles() - ctx->qd_slot[slot];
+			rcnt++;
+
+			if (rcnt + size_per_qp <= user_param->iters) {
+				if (user_param->use_srq) {
+					if (ibv_post_srq_recv(ctx->srq,&ctx->rwr[wc.wr_id],&bad_wr_recv)) {
+						fprintf(stderr, "Couldn't post recv SRQ. QP = %d: counter=%lu\n",(int)wc.wr_id,rcnt);
+						return 1;
 					}
+				} else if (ibv_post_recv(ctx->qp[wc.wr_id],&ctx->rwr[wc.wr_id],&bad_wr_recv)) {
+					fprintf(stderr, "Couldn't post recv: rcnt=%lu\n",rcnt);
+					return 15;
 				}
 			}
 
-		} else if (ne < 0) {
-			fprintf(stderr, "poll CQ failed %d\n", ne);
-			return_value = FAILURE;
-			goto cleaning;
+			if (user_param->machine == SERVER) {
+				if (qd_poll_send(ctx,&outstanding,user_param->tx_depth,scnt))
+					return FAILURE;
+
+				qd_set_wr(ctx,user_param,slot,laddr,raddr);
+				ctx->qd_slot[slot] = get_cycles();
+				if (qd_post_wr(ctx,user_param)) {
+					fprintf(stderr,"Couldn't post send: scnt=%lu\n",scnt);
+					return 1;
+				}
+				outstanding++;
+				scnt++;
+			}
 		}
-	}
 
-	if (user_param->noPeak == ON && user_param->test_type == ITERATIONS) {
-		user_param->tcompleted[0] = get_cycles();
+		if (qd_poll_send(ctx,&outstanding,user_param->tx_depth + 1,scnt))
+			return FAILURE;
 	}
 
-	if (ctx->send_rcredit) {
-		if (clean_scq_credit(tot_scredit, ctx, user_param)) {
-			return_value = 1;
-			goto cleaning;
-		}
-	}
+	if (qd_poll_send(ctx,&outstanding,1,scnt))
+		return FAILURE;
 
-cleaning:
-	check_alive_data.last_totrcnt=0;
-	free(rcnt_for_qp);
-	free(scredit_for_qp);
-	free(wc);
-	free(wc_tx);
-	return return_value;
+	qd_set_wr(ctx,user_param,wr_id,laddr,raddr);
+	return 0;
 }
 
 /******************************************************************************
@@ -3850,6 +6412,9 @@ int run_iter_lat_write(struct pingpong_context *ctx,struct perftest_parameters *
 	int 			total_gap_cycles = user_param->latency_gap * cpu_mhz;
 	cycles_t 		end_cycle, start_gap=0;
 
+	if (user_param->qd > 1)
+		return run_iter_lat_write_qd(ctx,user_param);
+
 	#ifdef HAVE_VERBS_EXP
 	if (user_param->use_exp == 1) {
 		ctx->exp_wr[0].sg_list->length = user_param->size;
@@ -3874,23 +6439,17 @@ int run_iter_lat_write(struct pingpong_context *ctx,struct perftest_parameters *
 
 	/* Duration support in latency tests. */
 	if (user_param->test_type == DURATION) {
-		duration_param=user_param;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
 		user_param->iters = 0;
-		if (user_param->margin > 0)
-			alarm(user_param->margin);
-		else
-			catch_alarm(0);
+		ctx_timer_start(user_param);
 	}
 
 	/* Done with setup. Start the test. */
 	while (scnt < user_param->iters || ccnt < user_param->iters || rcnt < user_param->iters
-			|| ((user_param->test_type == DURATION && user_param->state != END_STATE))) {
+			|| ((user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE))) {
 
 		if ((rcnt < user_param->iters || user_param->test_type == DURATION) && !(scnt < 1 && user_param->machine == SERVER)) {
 			rcnt++;
-			while (*poll_buf != (char)rcnt && user_param->state != END_STATE);
+			while (*poll_buf != (char)rcnt && (user_param->test_type != DURATION || ctx_test_state(user_param) != END_STATE));
 		}
 
 		if (scnt < user_param->iters || user_param->test_type == DURATION) {
@@ -3921,7 +6480,7 @@ int run_iter_lat_write(struct pingpong_context *ctx,struct perftest_parameters *
 			}
 		}
 
-		if (user_param->test_type == DURATION && user_param->state == END_STATE)
+		if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 			break;
 
 		if (ccnt < user_param->iters || user_param->test_type == DURATION) {
@@ -3945,6 +6504,9 @@ int run_iter_lat_write(struct pingpong_context *ctx,struct perftest_parameters *
 			}
 		}
 	}
+
+	/* A later run of the same size must not take this last value for its first. */
+	*poll_buf = 0;
 	return 0;
 }
 
@@ -3965,6 +6527,10 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 	int 		cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
 	int 		total_gap_cycles = user_param->latency_gap * cpu_mhz;
 	cycles_t 	end_cycle, start_gap=0;
+	uint64_t	dist_cnt = 0;
+
+	if (user_param->qd > 1)
+		return run_iter_lat_qd(ctx,user_param);
 
 	#ifdef HAVE_VERBS_EXP
 	if (user_param->use_exp == 1) {
@@ -3978,19 +6544,16 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 	}
 	#endif
 
+	if (ctx->size_ring)
+		set_dist_size(ctx,0,1,0);
+
 	/* Duration support in latency tests. */
 	if (user_param->test_type == DURATION) {
-		duration_param=user_param;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
 		user_param->iters = 0;
-		if (user_param->margin > 0)
-			alarm(user_param->margin);
-		else
-			catch_alarm(0);
+		ctx_timer_start(user_param);
 	}
 
-	while (scnt < user_param->iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+	while (scnt < user_param->iters || (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE)) {
 		if (user_param->latency_gap) {
 			start_gap = get_cycles();
 			end_cycle = start_gap + total_gap_cycles;
@@ -4014,10 +6577,13 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 			return 1;
 		}
 
-		if (user_param->test_type == DURATION && user_param->state == END_STATE)
+		if (ctx->size_ring)
+			set_dist_size(ctx,0,1,++dist_cnt);
+
+		if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 			break;
 
-		if (user_param->use_event) {
+		if (user_param->use_event && user_param->event_spin < 0) {
 			if (ctx_notify_events(ctx->channel)) {
 				fprintf(stderr, "Couldn't request CQ notification\n");
 				return 1;
@@ -4025,7 +6591,10 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 		}
 
 		do {
-			ne = ibv_poll_cq(ctx->send_cq, 1, &wc);
+			if (user_param->event_spin >= 0)
+				ne = ctx_poll_cq_hybrid(ctx, user_param, ctx->send_cq, 1, &wc);
+			else
+				ne = ibv_poll_cq(ctx->send_cq, 1, &wc);
 
 			if(ne > 0) {
 				if (wc.status != IBV_WC_SUCCESS) {
@@ -4069,6 +6638,9 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 	int			total_gap_cycles = user_param->latency_gap * cpu_mhz;
 	cycles_t 		end_cycle, start_gap=0;
 
+	if (user_param->qd > 1)
+		return run_iter_lat_send_qd(ctx,user_param);
+
 	if (user_param->connection_type != RawEth) {
 		#ifdef HAVE_VERBS_EXP
 		if (user_param->use_exp == 1) {
@@ -4082,6 +6654,9 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 		}
 		#endif
 
+		if (ctx->size_ring)
+			set_dist_size(ctx,0,1,0);
+
 	}
 
 	if (user_param->size <= user_param->inline_size) {
@@ -4093,7 +6668,7 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 			ctx->wr[0].send_flags |= IBV_SEND_INLINE;
 	}
 	while (scnt < user_param->iters || rcnt < user_param->iters ||
-			( (user_param->test_type == DURATION && user_param->state != END_STATE))) {
+			( (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE))) {
 
 		/* 
 		 * Get the received packet. make sure that the client won't enter here until he sends
@@ -4102,7 +6677,7 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 		 */
 		if ((rcnt < user_param->iters || user_param->test_type == DURATION) && !(scnt < 1 && user_param->machine == CLIENT)) {
 
-			if (user_param->use_event) {
+			if (user_param->use_event && user_param->event_spin < 0) {
 				if (ctx_notify_events(ctx->channel)) {
 					fprintf(stderr , " Failed to notify events to CQ");
 					return 1;
@@ -4110,9 +6685,12 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 			}
 
 			do {
-				ne = ibv_poll_cq(ctx->recv_cq,1,&wc);
+				if (user_param->event_spin >= 0)
+					ne = ctx_poll_cq_hybrid(ctx,user_param,ctx->recv_cq,1,&wc);
+				else
+					ne = ibv_poll_cq(ctx->recv_cq,1,&wc);
 
-				if (user_param->test_type == DURATION && user_param->state == END_STATE)
+				if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 					break;
 
 				if (ne > 0) {
@@ -4135,7 +6713,14 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 					 * is enough space in the rx_depth,
 					 * post that you received a packet.
 					 */
-					if (user_param->test_type==DURATION || (rcnt + size_per_qp  <= user_param->iters)) {
+					if (user_param->recv_batch > 1 &&
+						(user_param->test_type==DURATION || (rcnt + size_per_qp  <= user_param->iters))) {
+
+						if (ctx_post_recv_batch(ctx,user_param,(int)wc.wr_id,
+							user_param->test_type == ITERATIONS && rcnt + size_per_qp == user_param->iters))
+							return 1;
+
+					} else if (user_param->test_type==DURATION || (rcnt + size_per_qp  <= user_param->iters)) {
 
 						if (user_param->use_srq) {
 
@@ -4159,7 +6744,7 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 			} while (!user_param->use_event && ne == 0);
 		}
 
-		if (scnt < user_param->iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+		if (scnt < user_param->iters || (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE)) {
 
 			if (user_param->latency_gap) {
 				start_gap = get_cycles();
@@ -4185,7 +6770,7 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 			}
 
 			/* if we're in duration mode and the time is over, exit from this function */
-			if (user_param->test_type == DURATION && user_param->state == END_STATE)
+			if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 				break;
 
 			/* send the packet that's in index 0 on the buffer */
@@ -4202,12 +6787,15 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 				return 1;
 			}
 
+			if (ctx->size_ring)
+				set_dist_size(ctx,0,1,scnt);
+
 			if (poll == 1) {
 
 				struct ibv_wc s_wc;
 				int s_ne;
 
-				if (user_param->use_event) {
+				if (user_param->use_event && user_param->event_spin < 0) {
 					if (ctx_notify_events(ctx->channel)) {
 						fprintf(stderr , " Failed to notify events to CQ");
 						return FAILURE;
@@ -4216,7 +6804,10 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 
 				/* wait until you get a cq for the last packet */
 				do {
-					s_ne = ibv_poll_cq(ctx->send_cq, 1, &s_wc);
+					if (user_param->event_spin >= 0)
+						s_ne = ctx_poll_cq_hybrid(ctx, user_param, ctx->send_cq, 1, &s_wc);
+					else
+						s_ne = ibv_poll_cq(ctx->send_cq, 1, &s_wc);
 				} while (!user_param->use_event && s_ne == 0);
 
 
@@ -4261,63 +6852,586 @@ uint16_t ctx_get_local_lid(struct ibv_context *context,int port)
 /******************************************************************************
  *
  ******************************************************************************/
-void catch_alarm(int sig)
+static void ctx_timer_arm(struct perftest_parameters *user_param,int msec)
+{
+	user_param->timer_deadline = get_cycles() + (cycles_t)(msec * user_param->cycles_per_sec / 1000);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_timer_start(struct perftest_parameters *user_param)
+{
+	if (!user_param->cycles_per_sec)
+		user_param->cycles_per_sec = get_cpu_mhz(user_param->cpu_freq_f) * 1000000;
+
+	user_param->state = START_STATE;
+	if (user_param->margin > 0)
+		ctx_timer_arm(user_param,user_param->margin);
+	else
+		ctx_timer_advance(user_param); /* move to next state */
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_timer_advance(struct perftest_parameters *user_param)
 {
-	switch (duration_param->state) {
+	switch (user_param->state) {
 		case START_STATE:
-			duration_param->state = SAMPLE_STATE;
-			get_cpu_stats(duration_param,1);
-			duration_param->tposted[0] = get_cycles();
-			alarm(duration_param->duration - 2*(duration_param->margin));
+			user_param->state = SAMPLE_STATE;
+			get_cpu_stats(user_param,1);
+			user_param->tposted[0] = get_cycles();
+			ctx_timer_arm(user_param,user_param->duration - 2*(user_param->margin));
 			break;
 		case SAMPLE_STATE:
-			duration_param->state = STOP_SAMPLE_STATE;
-			duration_param->tcompleted[0] = get_cycles();
-			get_cpu_stats(duration_param,2);
-			if (duration_param->margin > 0) 
-				alarm(duration_param->margin);
+			user_param->state = STOP_SAMPLE_STATE;
+			user_param->tcompleted[0] = get_cycles();
+			get_cpu_stats(user_param,2);
+			if (user_param->margin > 0)
+				ctx_timer_arm(user_param,user_param->margin);
 			else
-				catch_alarm(0);
+				ctx_timer_advance(user_param);
 
 			break;
 		case STOP_SAMPLE_STATE:
-			duration_param->state = END_STATE;
+			user_param->state = END_STATE;
+			user_param->timer_deadline = TIMER_NEVER;
 			break;
 		default:
+			user_param->timer_deadline = TIMER_NEVER;
 			fprintf(stderr,"unknown state\n");
 	}
 }
 
-void check_alive(int sig)
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_check_alive_start(struct perftest_parameters *user_param,uint64_t tot_iters)
+{
+	user_param->alive.g_total_iters = tot_iters;
+	user_param->alive.last_totrcnt = 0;
+	user_param->alive.to_exit = 0;
+	user_param->alive.deadline = TIMER_NEVER;
+
+	if (user_param->test_type == ITERATIONS) {
+		if (!user_param->cycles_per_sec)
+			user_param->cycles_per_sec = get_cpu_mhz(user_param->cpu_freq_f) * 1000000;
+		user_param->alive.deadline = get_cycles() + (cycles_t)(CHECK_ALIVE_SEC * user_param->cycles_per_sec);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void ctx_check_alive_expired(struct perftest_parameters *user_param)
+{
+	struct check_alive_data *alive = &user_param->alive;
+
+	alive->deadline = TIMER_NEVER;
+	if (alive->current_totrcnt > alive->last_totrcnt) {
+		alive->last_totrcnt = alive->current_totrcnt;
+		alive->deadline = get_cycles() + (cycles_t)(CHECK_ALIVE_SEC * user_param->cycles_per_sec);
+	} else if (alive->current_totrcnt < alive->g_total_iters) {
+		fprintf(stderr," Did not get Message for 120 Seconds, exiting..\n Total Received=%d, Total Iters Required=%d\n",alive->current_totrcnt, alive->g_total_iters);
+
+		/* exit nice from run_iter function and report known bw/mr */
+		alive->to_exit = 1;
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+struct child_proc {
+	pid_t	pid;
+	int	fd;
+	int	ready_fd;
+	int	go_fd;
+	char	*out;
+	size_t	len;
+	size_t	size;
+	char	label[64];
+};
+
+struct report_row {
+	unsigned long	size;
+	unsigned long	iters;
+	double		bw_peak;
+	double		bw_avg;
+	double		msg_rate;
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static pid_t spawn_device_child(char **args, int *fd)
+{
+	int	pfd[2];
+	pid_t	pid;
+
+	if (pipe(pfd)) {
+		fprintf(stderr, " Couldn't create pipe - %s\n", strerror(errno));
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, " Couldn't fork - %s\n", strerror(errno));
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (!pid) {
+		close(pfd[0]);
+		dup2(pfd[1], STDOUT_FILENO);
+		close(pfd[1]);
+		execv("/proc/self/exe", args);
+		execvp(args[0], args);
+		fprintf(stderr, " Couldn't exec %s - %s\n", args[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(pfd[1]);
+	*fd = pfd[0];
+	return pid;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int collect_child_output(struct child_proc *child, int num)
+{
+	struct pollfd	*pfd;
+	int		open_fds = num;
+	int		i;
+	ssize_t		n;
+
+	ALLOCATE(pfd, struct pollfd, num);
+	for (i = 0; i < num; i++) {
+		pfd[i].fd = child[i].fd;
+		pfd[i].events = POLLIN;
+	}
+
+	while (open_fds) {
+		if (poll(pfd, num, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, " poll failed - %s\n", strerror(errno));
+			free(pfd);
+			return FAILURE;
+		}
+
+		for (i = 0; i < num; i++) {
+			if (pfd[i].fd < 0 || !pfd[i].revents)
+				continue;
+
+			if (child[i].size - child[i].len < 4096) {
+				child[i].size = child[i].size ? 2 * child[i].size : 16384;
+				child[i].out = realloc(child[i].out, child[i].size);
+				if (!child[i].out) {
+					fprintf(stderr, " Failed to allocate memory\n");
+					free(pfd);
+					return FAILURE;
+				}
+			}
+
+			n = read(pfd[i].fd, child[i].out + child[i].len, child[i].size - child[i].len - 1);
+			if (n > 0) {
+				child[i].len += n;
+				child[i].out[child[i].len] = '\0';
+			} else if (n == 0 || errno != EINTR) {
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+				open_fds--;
+			}
+		}
+	}
+	free(pfd);
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int wait_children(struct child_proc *child, int num, int ret)
+{
+	int i,status;
+
+	for (i = 0; i < num; i++) {
+		if (child[i].pid <= 0)
+			continue;
+
+		if (ret != SUCCESS)
+			kill(child[i].pid, SIGTERM);
+
+		if (waitpid(child[i].pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, " Test on %s failed\n", child[i].label);
+			if (child[i].out)
+				fprintf(stderr, "%s", child[i].out);
+			ret = FAILURE;
+		}
+	}
+	return ret;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int parse_report_rows(char *out, struct report_row *rows, int max_rows)
+{
+	char	*line,*save = NULL;
+	int	n = 0;
+
+	if (!out)
+		return 0;
+
+	for (line = strtok_r(out, "\n", &save); line && n < max_rows; line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, " %lu %lu %lf %lf %lf", &rows[n].size, &rows[n].iters,
+				&rows[n].bw_peak, &rows[n].bw_avg, &rows[n].msg_rate) == 5)
+			n++;
+	}
+	return n;
+}
+
+/******************************************************************************
+ * Prints the rows of every child and their per size aggregate.
+ * Rows line up by index since every child runs the same size sweep.
+ ******************************************************************************/
+static void print_children_report(struct perftest_parameters *user_param,
+		struct child_proc *child, int num, int fairness)
+{
+	struct report_row	*rows;
+	struct report_row	sum;
+	int			*num_rows;
+	double			sum_sq[MAX_DEV_REPORT_ROWS];
+	int			i,k;
+
+	ALLOCATE(rows, struct report_row, num * MAX_DEV_REPORT_ROWS);
+	ALLOCATE(num_rows, int, num);
+
+	printf(RESULT_LINE);
+	printf((user_param->report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+	printf(RESULT_EXT);
+
+	for (k = 0; k < num; k++) {
+		struct report_row *r = &rows[k * MAX_DEV_REPORT_ROWS];
+
+		num_rows[k] = parse_report_rows(child[k].out, r, MAX_DEV_REPORT_ROWS);
+		printf(" %s\n", child[k].label);
+		for (i = 0; i < num_rows[k]; i++)
+			printf(REPORT_FMT "\n", r[i].size, r[i].iters, r[i].bw_peak, r[i].bw_avg, r[i].msg_rate);
+	}
+
+	printf(" Aggregate\n");
+	for (i = 0; i < num_rows[0]; i++) {
+		sum = rows[i];
+		sum_sq[i] = rows[i].bw_avg * rows[i].bw_avg;
+		for (k = 1; k < num; k++) {
+			struct report_row *r = &rows[k * MAX_DEV_REPORT_ROWS + i];
+
+			if (i >= num_rows[k])
+				continue;
+			sum.iters += r->iters;
+			sum.bw_peak += r->bw_peak;
+			sum.bw_avg += r->bw_avg;
+			sum.msg_rate += r->msg_rate;
+			sum_sq[i] += r->bw_avg * r->bw_avg;
+		}
+		printf(REPORT_FMT "\n", sum.size, sum.iters, sum.bw_peak, sum.bw_avg, sum.msg_rate);
+		rows[i].bw_avg = sum.bw_avg;
+	}
+
+	/* Jain's index: (sum x)^2 / (n * sum x^2), 1 when every client gets the same BW. */
+	if (fairness) {
+		printf(" Jain's fairness index\n");
+		for (i = 0; i < num_rows[0]; i++)
+			printf(" %-7lu    %-7.4lf\n", rows[i].size,
+					sum_sq[i] ? rows[i].bw_avg * rows[i].bw_avg / (num * sum_sq[i]) : 0);
+	}
+	printf(RESULT_LINE);
+
+	free(num_rows);
+	free(rows);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_multi_device(struct perftest_parameters *user_param, int argc, char *argv[])
+{
+	struct child_proc	child[MAX_DEVICES];
+	char			**args;
+	char			dev_port[8],tcp_port[8],start_fds[32];
+	int			ready[2],go[2];
+	int			num_args = 0;
+	int			i,k;
+	char			token = 0;
+	int			ret = SUCCESS;
+
+	/* Room for the original arguments plus "-d dev -i port -p port --numa=auto --start_fds=r,g". */
+	ALLOCATE(args, char*, argc + 9);
+
+	for (i = 0; i < argc; i++) {
+		if (!strncmp(argv[i], "--devices=", strlen("--devices="))) {
+			continue;
+		} else if (!strcmp(argv[i], "--devices")) {
+			i++;
+			continue;
+		}
+		args[num_args++] = argv[i];
+	}
+
+	memset(child, 0, sizeof(child));
+	for (k = 0; k < user_param->num_devices; k++) {
+		int n = num_args;
+
+		snprintf(child[k].label, sizeof(child[k].label), "%s:%d",
+				user_param->devices[k], user_param->device_ports[k]);
+		snprintf(dev_port, sizeof(dev_port), "%d", user_param->device_ports[k]);
+		snprintf(tcp_port, sizeof(tcp_port), "%d", user_param->port + k);
+		args[n++] = "-d";
+		args[n++] = user_param->devices[k];
+		args[n++] = "-i";
+		args[n++] = dev_port;
+		args[n++] = "-p";
+		args[n++] = tcp_port;
+		/* Each device gets buffers and a polling thread local to its own NUMA node. */
+		if (user_param->numa_mode == NUMA_OFF)
+			args[n++] = "--numa=auto";
+
+		/* The child keeps its pipe ends across exec, ours are closed there. */
+		if (pipe(ready) || pipe(go)) {
+			fprintf(stderr, " Couldn't create pipe - %s\n", strerror(errno));
+			ret = FAILURE;
+			break;
+		}
+		fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+		fcntl(go[1], F_SETFD, FD_CLOEXEC);
+		snprintf(start_fds, sizeof(start_fds), "--start_fds=%d,%d", ready[1], go[0]);
+		args[n++] = start_fds;
+		args[n] = NULL;
+
+		child[k].pid = spawn_device_child(args, &child[k].fd);
+		close(ready[1]);
+		close(go[0]);
+		child[k].ready_fd = ready[0];
+		child[k].go_fd = go[1];
+		if (child[k].pid < 0) {
+			close(ready[0]);
+			close(go[1]);
+			ret = FAILURE;
+			break;
+		}
+	}
+	free(args);
+
+	/* Start barrier: let the devices run only once every one is connected. */
+	for (k = 0; k < user_param->num_devices && ret == SUCCESS; k++) {
+		if (read(child[k].ready_fd, &token, 1) != 1) {
+			fprintf(stderr, " %s failed before the start barrier\n", child[k].label);
+			ret = FAILURE;
+		}
+	}
+
+	for (k = 0; k < user_param->num_devices && ret == SUCCESS; k++) {
+		if (write(child[k].go_fd, &token, 1) != 1) {
+			fprintf(stderr, " Couldn't release %s\n", child[k].label);
+			ret = FAILURE;
+		}
+	}
+
+	for (k = 0; k < user_param->num_devices; k++) {
+		if (child[k].pid <= 0)
+			continue;
+		close(child[k].ready_fd);
+		close(child[k].go_fd);
+	}
+
+	if (ret == SUCCESS)
+		ret = collect_child_output(child, user_param->num_devices);
+
+	ret = wait_children(child, user_param->num_devices, ret);
+	if (ret == SUCCESS)
+		print_children_report(user_param, child, user_param->num_devices, 0);
+
+	for (k = 0; k < user_param->num_devices; k++)
+		free(child[k].out);
+
+	return ret == SUCCESS ? 0 : 1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int incast_listen(struct perftest_parameters *user_param)
+{
+	struct sockaddr_in	addr;
+	int			sockfd,n = 1;
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0) {
+		fprintf(stderr, " Couldn't create socket - %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(user_param->port);
+
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &n, sizeof n);
+	if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) || listen(sockfd, user_param->incast)) {
+		fprintf(stderr, "Couldn't listen to port %d\n", user_param->port);
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_incast_server(struct perftest_parameters *user_param)
 {
-	if (check_alive_data.current_totrcnt > check_alive_data.last_totrcnt) {
-		check_alive_data.last_totrcnt = check_alive_data.current_totrcnt;
-		alarm(60);
-	} else if (check_alive_data.current_totrcnt == check_alive_data.last_totrcnt && check_alive_data.current_totrcnt < check_alive_data.g_total_iters) {
-		fprintf(stderr," Did not get Message for 120 Seconds, exiting..\n Total Received=%d, Total Iters Required=%d\n",check_alive_data.current_totrcnt, check_alive_data.g_total_iters);
-
-		if (check_alive_data.is_events) {
-			/* Can't report BW, as we are stuck in event_loop */
-			fprintf(stderr," Due to this issue, Perftest cannot produce a report when in event mode.\n");
-			exit(0);
-		}
-		else {
-			/* exit nice from run_iter function and report known bw/mr */
-			check_alive_data.to_exit = 1;
-		}
-	} 
+	struct child_proc	*child;
+	struct sockaddr_in	addr;
+	socklen_t		addr_len;
+	int			out[2],ready[2],go[2];
+	int			sockfd,connfd;
+	int			num = user_param->incast;
+	int			i,k;
+	char			token = 0;
+	int			ret = SUCCESS;
+
+	sockfd = incast_listen(user_param);
+	if (sockfd < 0)
+		return FAILURE;
+
+	printf("\n************************************\n");
+	printf("* Waiting for %3d clients to connect *\n", num);
+	printf("************************************\n");
+	fflush(stdout);
+
+	ALLOCATE(child, struct child_proc, num);
+	memset(child, 0, num * sizeof(struct child_proc));
+
+	for (k = 0; k < num; k++) {
+		addr_len = sizeof(addr);
+		connfd = accept(sockfd, (struct sockaddr*)&addr, &addr_len);
+		if (connfd < 0) {
+			perror("server accept");
+			ret = FAILURE;
+			break;
+		}
+
+		snprintf(child[k].label, sizeof(child[k].label), "client %d (%s)", k,
+				inet_ntoa(addr.sin_addr));
+
+		if (pipe(out) || pipe(ready) || pipe(go)) {
+			fprintf(stderr, " Couldn't create pipe - %s\n", strerror(errno));
+			close(connfd);
+			ret = FAILURE;
+			break;
+		}
+
+		child[k].pid = fork();
+		if (child[k].pid < 0) {
+			fprintf(stderr, " Couldn't fork - %s\n", strerror(errno));
+			close(connfd);
+			ret = FAILURE;
+			break;
+		}
+
+		if (!child[k].pid) {
+			/* Drop what belongs to the parent and the other clients. */
+			for (i = 0; i < k; i++) {
+				close(child[i].fd);
+				close(child[i].ready_fd);
+				close(child[i].go_fd);
+			}
+			free(child);
+			close(sockfd);
+			close(out[0]);
+			close(ready[0]);
+			close(go[1]);
+			dup2(out[1], STDOUT_FILENO);
+			close(out[1]);
+
+			user_param->incast_sockfd = connfd;
+			user_param->incast_ready_fd = ready[1];
+			user_param->incast_go_fd = go[0];
+			return INCAST_CHILD;
+		}
+
+		close(connfd);
+		close(out[1]);
+		close(ready[1]);
+		close(go[0]);
+		child[k].fd = out[0];
+		child[k].ready_fd = ready[0];
+		child[k].go_fd = go[1];
+	}
+	close(sockfd);
+
+	/* Start barrier: let clients run only once every QP set is connected. */
+	for (k = 0; k < num && ret == SUCCESS; k++) {
+		if (read(child[k].ready_fd, &token, 1) != 1) {
+			fprintf(stderr, " %s failed before the start barrier\n", child[k].label);
+			ret = FAILURE;
+		}
+	}
+
+	for (k = 0; k < num && ret == SUCCESS; k++) {
+		if (write(child[k].go_fd, &token, 1) != 1) {
+			fprintf(stderr, " Couldn't release %s\n", child[k].label);
+			ret = FAILURE;
+		}
+	}
+
+	for (k = 0; k < num; k++) {
+		if (child[k].pid <= 0)
+			continue;
+		close(child[k].ready_fd);
+		close(child[k].go_fd);
+	}
+
+	if (ret == SUCCESS)
+		ret = collect_child_output(child, num);
+
+	ret = wait_children(child, num, ret);
+	if (ret == SUCCESS)
+		print_children_report(user_param, child, num, 1);
+
+	for (k = 0; k < num; k++)
+		free(child[k].out);
+	free(child);
+
+	return ret == SUCCESS ? 0 : 1;
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-void catch_alarm_infintely(int sig)
+int ctx_incast_barrier(struct perftest_parameters *user_param)
 {
-	duration_param->tcompleted[0] = get_cycles();
-	print_report_bw(duration_param,NULL);
-	duration_param->iters = 0;
-	alarm(duration_param->duration);
-	duration_param->tposted[0] = get_cycles();
+	char token = 0;
+
+	if (user_param->incast_ready_fd < 0)
+		return SUCCESS;
+
+	if (write(user_param->incast_ready_fd, &token, 1) != 1 ||
+		read(user_param->incast_go_fd, &token, 1) != 1) {
+		fprintf(stderr, " Start barrier failed\n");
+		return FAILURE;
+	}
+
+	close(user_param->incast_ready_fd);
+	close(user_param->incast_go_fd);
+	user_param->incast_ready_fd = -1;
+	user_param->incast_go_fd = -1;
+	return SUCCESS;
 }
 
 /******************************************************************************
@@ -62,6 +62,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "perftest_parameters.h"
 
 #define NUM_OF_RETRIES		(10)
@@ -70,6 +71,11 @@
 #define MAX_SEND_SGE		(1)
 #define MAX_RECV_SGE		(1)
 #define CTX_POLL_BATCH		(16)
+#define CHECK_ALIVE_SEC		(60)
+#define INCAST_CHILD		(-1)
+/* Completion latency histogram of run_infinitely: log2 buckets split in 2^INF_LAT_SUB_BITS. */
+#define INF_LAT_SUB_BITS	(4)
+#define INF_LAT_BUCKETS		(64 << INF_LAT_SUB_BITS)
 #define PL			(1)
 #define ATOMIC_ADD_VALUE	(1)
 #define ATOMIC_SWAP_VALUE	(0)
@@ -115,6 +121,10 @@
 #define INC(size,cache_line_size) ((size > cache_line_size) ? ((size%cache_line_size == 0) ?  \
 	       (size) : (cache_line_size*(size/cache_line_size+1))) : (cache_line_size))
 
+/* Whether batched receives cycle through the receive buffer like single reposts do. */
+#define RECV_BATCH_CYCLE(ctx,user_param) ((user_param)->tst == BW && (user_param)->num_sge_max == 1 && \
+	(user_param)->size <= (uint64_t)((ctx)->cycle_buffer / 2))
+
 #define UD_MSG_2_EXP(size) ((log(size))/(log(2)))
 
 #define MASK_IS_SET(mask, attr)      (((mask)&(attr))!=0)
@@ -132,6 +142,7 @@ struct pingpong_context {
 	struct ibv_mr				**mr;
 	struct ibv_cq				*send_cq;
 	struct ibv_cq				*recv_cq;
+	struct ibv_cq				*probe_cq;
 	void					**buf;
 	struct ibv_ah				**ah;
 	struct ibv_qp				**qp;
@@ -157,7 +168,25 @@ struct pingpong_context {
 	int                                     send_rcredit;
 	int                                     credit_cnt;
 	int					cache_line_size;
-	int					cycle_buffer;
+	uint64_t				cycle_buffer;
+	cycles_t				mr_reg_cycles;
+	uint64_t				*ws_offsets;
+	uint64_t				ws_entries;
+	uint32_t				*size_ring;
+	cycles_t				*mix_tposted;
+	cycles_t				*tune_lat;
+	uint64_t				tune_lat_cnt;
+	cycles_t				*qd_slot;
+	struct ibv_ah				**ud_ah;
+	uint32_t				*ud_qpn;
+	uint32_t				*ud_ring;
+	struct ibv_sge				*sge_gather;
+	struct ibv_sge				*recv_sge_gather;
+	struct ibv_recv_wr			*rx_batch_wr;
+	struct ibv_sge				*rx_batch_sge;
+	int					*rx_batch_pending;
+	void					**sge_buf;
+	struct ibv_mr				**sge_mr;
 	#ifdef HAVE_XRCD
 	struct ibv_xrcd				*xrc_domain;
 	int 					fd;
@@ -235,6 +264,21 @@ int check_add_port(char **service,int port,
  */
 struct ibv_device* ctx_find_dev(const char *ib_devname);
 
+/* ctx_set_numa_placement
+ *
+ * Description : Binds all further memory allocations to a NUMA node and pins
+ *	the calling (polling) thread to an allowed CPU on that node.
+ *	In auto mode the node is read from the device sysfs entry.
+ *
+ * Parameters :
+ *
+ *	ib_dev - The device the test runs on.
+ *	user_param - user_parameters struct for this test.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int ctx_set_numa_placement(struct ibv_device *ib_dev, struct perftest_parameters *user_param);
+
 /* create_rdma_resources
  *
  * Description : Creates the rdma_cm_id and rdma_channel for the rdma_cm QPs.
@@ -390,6 +434,33 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 					   struct perftest_parameters *user_param,
 					   struct pingpong_dest *rem_dest);
 
+/* ctx_set_working_set
+ *
+ * Description : Builds the working set address table for the current message
+ *	size and user_param->working_set, following the requested access pattern.
+ *	The first entry is always offset 0, matching the initial WR addresses.
+ *
+ * Parameters :
+ *
+ *	ctx - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *
+ */
+void ctx_set_working_set(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* ctx_set_size_dist
+ *
+ * Description : Fills the per-QP message size rings by sampling the
+ *	requested size distribution, and sets the first WR lengths from them.
+ *
+ * Parameters :
+ *
+ *	ctx - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *
+ */
+void ctx_set_size_dist(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
 /* ctx_set_send_wqes.
  *
  * Description :
@@ -459,6 +530,46 @@ int ctx_alloc_credit(struct pingpong_context *ctx,
 int ctx_set_credit_wqes(struct pingpong_context *ctx,
 				struct perftest_parameters *user_param,
 				struct pingpong_dest *rem_dest);
+/* ctx_poll_cq_hybrid.
+ *
+ * Description :
+ *
+ *	Polls the CQ in the hybrid event mode (--event_spin). Busy polls for the
+ *	spin budget, then arms the CQ and sleeps in poll() on the completion
+ *	channel, which all the test CQs share, until completions arrive.
+ *	Counts the wakeups for the event statistics.
+ *
+ * Parameters :
+ *
+ *	ctx         - Test Context.
+ *	user_param  - user_parameters struct for this test.
+ *	cq          - The CQ to poll.
+ *	num_entries - Max number of completions to return.
+ *	wc          - Array of at least num_entries work completions.
+ *
+ * Return Value : Number of completions (> 0), or -1 on failure.
+ */
+int ctx_poll_cq_hybrid(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		       struct ibv_cq *cq, int num_entries, struct ibv_wc *wc);
+
+/* ctx_post_recv_batch.
+ *
+ * Description :
+ *
+ *	Counts a consumed receive of the QP and, once --recv_batch of them are
+ *	pending, reposts them with a single post of the prebuilt chained list.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	qp_index   - The QP whose receive was consumed.
+ *	flush      - Post the pending receives even if the batch is not full.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int ctx_post_recv_batch(struct pingpong_context *ctx,struct perftest_parameters *user_param,int qp_index,int flush);
+
 /* run_iter_bw.
  *
  * Description :
@@ -473,11 +584,136 @@ int ctx_set_credit_wqes(struct pingpong_context *ctx,
  */
 int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param);
 
+/* run_iter_bw_adaptive.
+ *
+ * Description :
+ *
+ *	Runs run_iter_bw in chunks instead of a fixed iteration count. A short
+ *	pilot sizes the chunks to --target_time/10 (or 20ms), and chunks are added
+ *	until the 95% confidence interval of the message rate is within
+ *	--target_ci, or the time budget of the size is spent. The chunks are then
+ *	reported as one run, with the achieved interval in achieved_ci.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations, to rebuild the WQEs between chunks.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_iter_bw_adaptive(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest);
+
+/* run_buffer_sweep_bw.
+ *
+ * Description :
+ *
+ *	Runs run_iter_bw for every point of the working set sweep (<size>:<max>),
+ *	or else of the SGE sweep (<sge>:<max>), and prints one report row per
+ *	point. Both double and their last point is the max.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations of the QPs.
+ *	my_bw_rep  - The report of the last point.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_buffer_sweep_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep);
+
+/* run_sweep_bw.
+ *
+ * Description :
+ *
+ *	Runs run_iter_bw for every combination of the --sweep values and prints
+ *	one report row per point. The connected QPs and MRs of the largest point
+ *	are reused, only the send WQEs are rebuilt between points.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations of the QPs.
+ *	my_bw_rep  - The report of the last point.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_sweep_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep);
+
+/* run_load_lat_bw.
+ *
+ * Description :
+ *
+ *	Load-latency curve. The last QP is a probe: a thread posts small
+ *	signaled WRs on it back to back and records their round trip, while the
+ *	other QPs run run_iter_bw at each offered load, in percent of their
+ *	unthrottled message rate. Prints latency percentiles per load step.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations of the QPs.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_load_lat_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest);
+
+/* run_atomic_contention_bw.
+ *
+ * Description :
+ *
+ *	Atomic contention. For each --contention level all QPs aim their
+ *	atomics at the same set of remote words (one, K uniform or K Zipf),
+ *	and every operation is timed. Prints the message rate and latency
+ *	percentiles per level, and for CMP_AND_SWAP the share of attempts that
+ *	won and the retries per increment.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations of the QPs.
+ *	my_bw_rep  - Filled with the last level, for the server.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_atomic_contention_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep);
+
+/* run_autotune_bw.
+ *
+ * Description :
+ *
+ *	Searches the sweep grid for the qps, tx_depth, post_list, cq_mod and
+ *	inline setting with the best message rate or p99 latency. Each point
+ *	runs for a short time and prints a row, then the best set is printed.
+ *
+ * Parameters :
+ *
+ *	ctx        - Test Context.
+ *	user_param - user_parameters struct for this test.
+ *	rem_dest   - The remote destinations of the QPs.
+ *	my_bw_rep  - The report of the last point.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int run_autotune_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param,
+		struct pingpong_dest *rem_dest,struct bw_report_data *my_bw_rep);
+
 /* run_iter_bw_infinitely
  *
  * Description :
  *
- *	Infinite BW method, that prints BW every 5 seconds and never stops.
+ *	Infinite BW method that never stops. Completions are signaled every
+ *	cq_mod WRs like in run_iter_bw, and a report thread prints the BW, message
+ *	rate and completion latency percentiles of every --duration interval.
  *
  * Parameters :
  *
@@ -647,7 +883,7 @@ void gen_udp_header(void* UDP_header_buffer,int* sPort ,int* dPort,uint32_t sadd
  */
 
 #if defined(HAVE_VERBS_EXP)
-static __inline void increase_exp_rem_addr(struct ibv_exp_send_wr *wr,int size,uint64_t scnt,uint64_t prim_addr,VerbType verb, int cache_line_size, int cycle_buffer)
+static __inline void increase_exp_rem_addr(struct ibv_exp_send_wr *wr,int size,uint64_t scnt,uint64_t prim_addr,VerbType verb, int cache_line_size, uint64_t cycle_buffer)
 {
 	if (verb == ATOMIC)
 		wr->wr.atomic.remote_addr += INC(size,cache_line_size);
@@ -665,7 +901,7 @@ static __inline void increase_exp_rem_addr(struct ibv_exp_send_wr *wr,int size,u
 	}
 }
 #endif
-static __inline void increase_rem_addr(struct ibv_send_wr *wr,int size,uint64_t scnt,uint64_t prim_addr,VerbType verb, int cache_line_size, int cycle_buffer)
+static __inline void increase_rem_addr(struct ibv_send_wr *wr,int size,uint64_t scnt,uint64_t prim_addr,VerbType verb, int cache_line_size, uint64_t cycle_buffer)
 {
 	if (verb == ATOMIC)
 		wr->wr.atomic.remote_addr += INC(size,cache_line_size);
@@ -683,6 +919,91 @@ static __inline void increase_rem_addr(struct ibv_send_wr *wr,int size,uint64_t
 	}
 }
 
+/* set_dist_size.
+ *
+ * Description :
+ *	Sets the lengths of the next WR list of the QP from its precomputed
+ *	message size ring (see ctx_set_size_dist).
+ *
+ * Parameters :
+ *
+ *	ctx - Test Context.
+ *	index - The QP index.
+ *	post_list - Number of WRs in the list.
+ *	cnt - Number of messages posted so far on the QP.
+ */
+static __inline void set_dist_size(struct pingpong_context *ctx,int index,int post_list,uint64_t cnt)
+{
+	int j;
+	uint32_t *ring = &ctx->size_ring[index * SIZE_RING_LEN];
+
+	for (j = 0; j < post_list; j++)
+		ctx->sge_list[index * post_list + j].length = ring[(cnt + j) & (SIZE_RING_LEN - 1)];
+}
+
+/* set_ud_dest.
+ *
+ * Description :
+ *	Points the next WR list of the QP at the destinations its ring picks
+ *	from the UD destination table (see ctx_connect and --ud_dests).
+ *
+ * Parameters :
+ *
+ *	ctx - Test Context.
+ *	index - The QP index.
+ *	post_list - Number of WRs in the list.
+ *	cnt - Number of messages posted so far on the QP.
+ */
+static __inline void set_ud_dest(struct pingpong_context *ctx,int index,int post_list,uint64_t cnt)
+{
+	int j;
+	uint32_t dest;
+	uint32_t *ring = &ctx->ud_ring[index * UD_DEST_RING_LEN];
+
+	for (j = 0; j < post_list; j++) {
+		dest = ring[(cnt + j) & (UD_DEST_RING_LEN - 1)];
+		ctx->wr[index * post_list + j].wr.ud.ah = ctx->ud_ah[dest];
+		ctx->wr[index * post_list + j].wr.ud.remote_qpn = ctx->ud_qpn[dest];
+	}
+}
+
+/* set_ws_addr.
+ *
+ * Description :
+ *	Moves the local and remote addresses of the WR to the given offset
+ *	from the working set address table (see ctx_set_working_set).
+ *
+ * Parameters :
+ *
+ *	wr - The send wqe.
+ *	offset - Offset taken from the working set table.
+ *	loc_addr - The first local address of the QP.
+ *	rem_addr - The first remote address of the QP.
+ *	verb - The verb used.
+ */
+#ifdef HAVE_VERBS_EXP
+static __inline void set_exp_ws_addr(struct ibv_exp_send_wr *wr,uint64_t offset,uint64_t loc_addr,uint64_t rem_addr,VerbType verb)
+{
+	wr->sg_list->addr = loc_addr + offset;
+
+	if (verb == ATOMIC)
+		wr->wr.atomic.remote_addr = rem_addr + offset;
+
+	else if (verb != SEND)
+		wr->wr.rdma.remote_addr = rem_addr + offset;
+}
+#endif
+static __inline void set_ws_addr(struct ibv_send_wr *wr,uint64_t offset,uint64_t loc_addr,uint64_t rem_addr,VerbType verb)
+{
+	wr->sg_list->addr = loc_addr + offset;
+
+	if (verb == ATOMIC)
+		wr->wr.atomic.remote_addr = rem_addr + offset;
+
+	else if (verb != SEND)
+		wr->wr.rdma.remote_addr = rem_addr + offset;
+}
+
 /* increase_loc_addr.
  *
  * Description :
@@ -697,7 +1018,7 @@ static __inline void increase_rem_addr(struct ibv_send_wr *wr,int size,uint64_t
  *		prim_addr - The address of the original buffer.
  *		server_is_ud - Indication to weather we are in UD mode.
  */
-static __inline void increase_loc_addr(struct ibv_sge *sg,int size,uint64_t rcnt,uint64_t prim_addr,int server_is_ud, int cache_line_size, int cycle_buffer)
+static __inline void increase_loc_addr(struct ibv_sge *sg,int size,uint64_t rcnt,uint64_t prim_addr,int server_is_ud, int cache_line_size, uint64_t cycle_buffer)
 {
 	sg->addr  += INC(size,cache_line_size);
 
@@ -706,27 +1027,76 @@ static __inline void increase_loc_addr(struct ibv_sge *sg,int size,uint64_t rcnt
 
 }
 
-/* catch_alarm.
+/* ctx_timer_start.
  *
  * Description :
- * 	Signal catcher for duration feature.
- *  run_iter_bw in start will set it to triger at MARGIN (parameter), it will then start counting packets
- *  and triger it back to SAMPLE TIME, in that time the test will count packets and completion and
- *  will calculate BW accordingley.
+ * 	Starts the duration state machine of this test.
+ *  The test warms up for MARGIN (parameter), then counts packets and completions for
+ *  the SAMPLE TIME and stops after another MARGIN. Each test owns its deadline, so no
+ *  signals or process wide state are involved and several tests can run in parallel threads.
  *
  */
-void catch_alarm(int sig);
+void ctx_timer_start(struct perftest_parameters *user_param);
 
-void check_alive(int sig);
+/* ctx_timer_advance.
+ *
+ * Description :
+ * 	Moves the duration state machine to the next state once its deadline passed.
+ *
+ */
+void ctx_timer_advance(struct perftest_parameters *user_param);
 
-/* catch_alarm.
+/* ctx_test_state.
  *
  * Description :
- * 	Signal catcher for run_infinitely feature.
- *  Will be triggered every 5 sec and measure BW in this time frame.
+ * 	Returns the duration state of the test, after advancing it if the deadline passed.
+ *  The data path loops call it instead of reading user_param->state.
  *
  */
-void catch_alarm_infintely(int sig) ;
+static __inline DurationStates ctx_test_state(struct perftest_parameters *user_param)
+{
+	if (get_cycles() >= user_param->timer_deadline)
+		ctx_timer_advance(user_param);
+
+	return user_param->state;
+}
+
+/* ctx_check_alive_start.
+ *
+ * Description :
+ * 	Starts the watchdog of iterations based server loops, which stops the test
+ *  if no message arrived for CHECK_ALIVE_SEC seconds.
+ *
+ */
+void ctx_check_alive_start(struct perftest_parameters *user_param,uint64_t tot_iters);
+
+void ctx_check_alive_expired(struct perftest_parameters *user_param);
+
+/* ctx_wait_cq_event.
+ *
+ * Description :
+ * 	Like ctx_notify_events, but waits in poll() on the completion channel
+ *  and returns early at the check alive deadline, so the server loops that
+ *  work with events still stop when the client is gone.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ *
+ */
+int ctx_wait_cq_event(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* ctx_check_alive.
+ *
+ * Description :
+ * 	Polled by the server loops when idle. Returns non zero if the test should stop.
+ *
+ */
+static __inline int ctx_check_alive(struct perftest_parameters *user_param)
+{
+	if (get_cycles() >= user_param->alive.deadline)
+		ctx_check_alive_expired(user_param);
+
+	return user_param->alive.to_exit;
+}
 
 /* ctx_modify_dc_qp_to_init.
  *
@@ -811,4 +1181,58 @@ int create_single_mr(struct pingpong_context *ctx,
  */
 int create_mr(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param);
+
+/* run_multi_device
+ *
+ * Description :
+ *
+ *	Runs the test on every device given with --devices, each in its own
+ *	process on its own TCP port, releases them together once every one
+ *	reached ctx_incast_barrier, and prints the per device and the
+ *	aggregate BW report.
+ *
+ *	Parameters :
+ *		user_param - the perftest parameters.
+ *		argc, argv - the original command line, re-used for every device.
+ *
+ * Return Value : 0 on success, 1 if any device failed.
+ *
+ */
+int run_multi_device(struct perftest_parameters *user_param, int argc, char *argv[]);
+
+/* run_incast_server
+ *
+ * Description :
+ *
+ *	Accepts --incast clients on the server port and forks a process per
+ *	client that continues the regular test on the accepted socket.
+ *	The parent releases all of them together once every one reached
+ *	ctx_incast_barrier, and then prints the per client report, the
+ *	aggregate and Jain's fairness index.
+ *
+ *	Parameters :
+ *		user_param - the perftest parameters.
+ *
+ * Return Value : INCAST_CHILD in the forked processes,
+ *		  0 or 1 in the parent once all clients are done.
+ *
+ */
+int run_incast_server(struct perftest_parameters *user_param);
+
+/* ctx_incast_barrier
+ *
+ * Description :
+ *
+ *	Blocks an incast server process until all clients are connected, or a
+ *	--devices process until all devices are connected.
+ *	Does nothing outside of these modes.
+ *
+ *	Parameters :
+ *		user_param - the perftest parameters.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ *
+ */
+int ctx_incast_barrier(struct perftest_parameters *user_param);
+
 #endif /* PERFTEST_RESOURCES_H */
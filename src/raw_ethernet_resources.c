@@ -47,8 +47,6 @@
 #include "perftest_communication.h"
 #include "raw_ethernet_resources.h"
 
-struct perftest_parameters* duration_param;
-
 int check_flow_steering_support(char *dev_name)
 {
 	char* file_name = "/sys/module/mlx4_core/parameters/log_num_mgm_entry_size";
@@ -706,14 +704,11 @@ int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 
 	if(user_param->test_type == DURATION && user_param->machine == CLIENT && firstRx) {
 		firstRx = OFF;
-		duration_param=user_param;
 		user_param->iters=0;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
-		alarm(user_param->margin);
+		ctx_timer_start(user_param);
 	}
 
-	while ((user_param->test_type == DURATION && user_param->state != END_STATE) || totccnt < tot_iters || totrcnt < tot_iters) {
+	while ((user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE) || totccnt < tot_iters || totrcnt < tot_iters) {
 
 		for (index=0; index < user_param->num_of_qps; index++) {
 
@@ -740,7 +735,7 @@ int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 				if (user_param->noPeak == OFF)
 					user_param->tposted[totscnt] = get_cycles();
 
-				if (user_param->test_type == DURATION && duration_param->state == END_STATE)
+				if (user_param->test_type == DURATION && ctx_test_state(user_param) == END_STATE)
 					break;
 				switch_smac_dmac(ctx->wr[index*user_param->post_list].sg_list);
 
@@ -814,7 +809,7 @@ int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 			}
 		}
 
-		if ((user_param->test_type == ITERATIONS && (totrcnt < tot_iters)) || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+		if ((user_param->test_type == ITERATIONS && (totrcnt < tot_iters)) || (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE)) {
 			#ifdef HAVE_ACCL_VERBS
 			if (user_param->verb_type == ACCL_INTF)
 				ne = ctx->recv_cq_family->poll_cnt(ctx->recv_cq, CTX_POLL_BATCH);
@@ -825,11 +820,8 @@ int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 			if (ne > 0) {
 				if (user_param->machine == SERVER && firstRx && user_param->test_type == DURATION) {
 					firstRx = OFF;
-					duration_param=user_param;
 					user_param->iters=0;
-					duration_param->state = START_STATE;
-					signal(SIGALRM, catch_alarm);
-					alarm(user_param->margin);
+					ctx_timer_start(user_param);
 				}
 
 				for (i = 0; i < ne; i++) {
@@ -851,7 +843,7 @@ int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 				goto cleaning;
 			}
 		}
-		if ((totccnt < tot_iters) || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+		if ((totccnt < tot_iters) || (user_param->test_type == DURATION && ctx_test_state(user_param) != END_STATE)) {
 			#ifdef HAVE_ACCL_VERBS
 			if (user_param->verb_type == ACCL_INTF)
 				ne = ctx->send_cq_family->poll_cnt(ctx->send_cq, CTX_POLL_BATCH);
@@ -116,6 +116,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -276,6 +282,11 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	if (user_param.output == FULL_VERBOSITY)
 		printf(RESULT_LINE);
 
@@ -89,6 +89,12 @@ int main(int argc, char *argv[])
 		return FAILURE;
 	}
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -222,6 +228,14 @@ int main(int argc, char *argv[])
 	/* Only Client post read request. */
 	if (user_param.machine == SERVER) {
 
+		/* Follow the client through its trials. */
+		do {
+			ret_parser = ctx_repeat_next(&user_comm,&user_param);
+		} while (ret_parser > 0);
+
+		if (ret_parser < 0)
+			return FAILURE;
+
 		if (ctx_close_connection(&user_comm,my_dest,rem_dest)) {
 			fprintf(stderr,"Failed to close connection between server and client\n");
 			return 1;
@@ -256,6 +270,20 @@ int main(int argc, char *argv[])
 
 			user_param.test_type == ITERATIONS ? print_report_lat(&user_param) : print_report_lat_duration(&user_param);
 		}
+	} else if (user_param.repeat > 1) {
+		do {
+			if(run_iter_lat(&ctx,&user_param))
+				return 18;
+
+			print_report_lat(&user_param);
+			ret_parser = ctx_repeat_next(&user_comm,&user_param);
+		} while (ret_parser > 0);
+
+		if (ret_parser < 0)
+			return FAILURE;
+
+		if (user_param.output == FULL_VERBOSITY)
+			print_repeat_stats(&user_param);
 	} else {
 		if(run_iter_lat(&ctx,&user_param))
 			return 18;
@@ -271,5 +299,11 @@ int main(int argc, char *argv[])
 	if (user_param.output == FULL_VERBOSITY) {
 		printf(RESULT_LINE);
 	}
+
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	return 0;
 }
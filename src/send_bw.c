@@ -162,6 +162,7 @@ int main(int argc, char *argv[])
 	struct bw_report_data		my_bw_rep, rem_bw_rep;
 	int                      	ret_parser,i = 0;
 	int                      	size_max_pow = 24;
+	int				mix_rdma_only;
 
 	/* init default values to user's parameters */
 	memset(&ctx, 0,sizeof(struct pingpong_context));
@@ -180,6 +181,18 @@ int main(int argc, char *argv[])
 			fprintf(stderr," Parser function exited with Error\n");
 		return 1;
 	}
+
+	/* Run one test per device and aggregate their reports. */
+	if (user_param.num_devices > 1)
+		return run_multi_device(&user_param,argc,argv);
+
+	/* Accept every incast client up front and serve each one from its own process. */
+	if (user_param.incast > 1) {
+		ret_parser = run_incast_server(&user_param);
+		if (ret_parser != INCAST_CHILD)
+			return ret_parser;
+	}
+
 	if((user_param.connection_type == DC || user_param.use_xrc) && user_param.duplex) {
 		user_param.num_of_qps *= 2;
 	}
@@ -200,6 +213,12 @@ int main(int argc, char *argv[])
 	if (user_param.use_mcg)
 		GET_STRING(mcg_params.ib_devname,ibv_get_device_name(ib_dev));
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -353,6 +372,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Hold this incast client until all of them are connected. */
+	if (ctx_incast_barrier(&user_param)) {
+		fprintf(stderr," Failed to synchronize the incast clients\n");
+		return FAILURE;
+	}
+
 	/* shaking hands and gather the other side info. */
 	if (ctx_hand_shake(&user_comm,&my_dest[0],&rem_dest[0])) {
 		fprintf(stderr,"Failed to exchange data between server and clients\n");
@@ -381,9 +406,16 @@ int main(int argc, char *argv[])
 			printf(RESULT_LINE);
 			printf((user_param.report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
 		}
+		if (user_param.working_set)
+			printf(RESULT_EXT_WS);
+		if (user_param.num_sge_max > 1)
+			printf(RESULT_EXT_SGE);
 		printf((user_param.cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
 	}
 
+	/* A server of a verb mix without sends has nothing to receive. */
+	mix_rdma_only = (user_param.machine == SERVER && user_param.mix.total_weight && !user_param.mix.msgs[SEND]);
+
 	if (user_param.test_method == RUN_ALL) {
 
 		if (user_param.connection_type == UD)
@@ -476,12 +508,15 @@ int main(int argc, char *argv[])
 				return 17;
 			}
 
-		} else if(run_iter_bw_server(&ctx,&user_param)) {
+		} else if (!mix_rdma_only && run_iter_bw_server(&ctx,&user_param)) {
 
 			return 17;
 		}
 
-		print_report_bw(&user_param,&my_bw_rep);
+		if (mix_rdma_only)
+			printf(" No send messages in the verb mix, see the client for results\n");
+		else
+			print_report_bw(&user_param,&my_bw_rep);
 
 		if (user_param.duplex && user_param.test_type != DURATION) {
 			xchg_bw_reports(&user_comm, &my_bw_rep,&rem_bw_rep,atof(user_param.rem_version));
@@ -572,5 +607,10 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	return 0;
 }
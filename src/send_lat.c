@@ -226,6 +226,12 @@ int main(int argc, char *argv[])
 	if (user_param.use_mcg)
 		GET_STRING(mcg_params.ib_devname,ibv_get_device_name(ib_dev));
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -427,6 +433,33 @@ int main(int argc, char *argv[])
 			user_param.test_type == ITERATIONS ? print_report_lat(&user_param) : print_report_lat_duration(&user_param);
 		}
 
+	} else if (user_param.repeat > 1) {
+
+		do {
+			/* Every trial consumes the receives it finds posted. */
+			if (ctx_set_recv_wqes(&ctx,&user_param)) {
+				fprintf(stderr," Failed to post receive recv_wqes\n");
+				return 1;
+			}
+
+			if (ctx_hand_shake(&user_comm,my_dest,rem_dest)) {
+				fprintf(stderr,"Failed to exchange data between server and clients\n");
+				return 1;
+			}
+
+			if(run_iter_lat_send(&ctx, &user_param))
+				return 17;
+
+			print_report_lat(&user_param);
+			ret_val = ctx_repeat_next(&user_comm,&user_param);
+		} while (ret_val > 0);
+
+		if (ret_val < 0)
+			return FAILURE;
+
+		if (user_param.output == FULL_VERBOSITY)
+			print_repeat_stats(&user_param);
+
 	} else {
 
 		/* Post recevie recv_wqes fo current message size */
@@ -459,5 +492,10 @@ int main(int argc, char *argv[])
 		fprintf(stderr," Trying to close this side resources\n");
 	}
 
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	return send_destroy_ctx(&ctx,&user_param,&mcg_params);
 }
@@ -72,10 +72,29 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* Run one test per device and aggregate their reports. */
+	if (user_param.num_devices > 1)
+		return run_multi_device(&user_param,argc,argv);
+
+	/* Accept every incast client up front and serve each one from its own process. */
+	if (user_param.incast > 1) {
+		ret_parser = run_incast_server(&user_param);
+		if (ret_parser != INCAST_CHILD)
+			return ret_parser;
+	}
+
 	if((user_param.connection_type == DC || user_param.use_xrc) && user_param.duplex) {
 		user_param.num_of_qps *= 2;
 	}
 
+	/* With fan-out -q is per server, each server gets its own QP group. */
+	if (user_param.num_servers > 1)
+		user_param.num_of_qps *= user_param.num_servers;
+
+	/* The load-latency probe gets one more QP after the background ones. */
+	if (user_param.load_lat_steps)
+		user_param.num_of_qps++;
+
 	/* Finding the IB device selected (or default if none is selected). */
 	ib_dev = ctx_find_dev(user_param.ib_devname);
 	if (!ib_dev) {
@@ -83,6 +102,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* Place memory and the polling thread on the device NUMA node. */
+	if (ctx_set_numa_placement(ib_dev, &user_param)) {
+		fprintf(stderr, " Couldn't set NUMA placement\n");
+		return FAILURE;
+	}
+
 	/* Getting the relevant context from the device */
 	ctx.context = ibv_open_device(ib_dev);
 	if (!ctx.context) {
@@ -178,7 +203,7 @@ int main(int argc, char *argv[])
 	user_comm.rdma_params->side = REMOTE;
 	for (i=0; i < user_param.num_of_qps; i++) {
 
-		if (ctx_hand_shake(&user_comm,&my_dest[i],&rem_dest[i])) {
+		if (ctx_hand_shake(ctx_peer_comm(&user_comm,i),&my_dest[i],&rem_dest[i])) {
 			fprintf(stderr," Failed to exchange data between server and clients\n");
 			return 1;
 		}
@@ -201,13 +226,19 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Hold this incast client until all of them are connected. */
+	if (ctx_incast_barrier(&user_param)) {
+		fprintf(stderr," Failed to synchronize the incast clients\n");
+		return FAILURE;
+	}
+
 	/* An additional handshake is required after moving qp to RTR. */
 	if (ctx_hand_shake(&user_comm,&my_dest[0],&rem_dest[0])) {
 		fprintf(stderr," Failed to exchange data between server and clients\n");
 		return FAILURE;
 	}
 
-	if (user_param.output == FULL_VERBOSITY) {
+	if (user_param.output == FULL_VERBOSITY && !user_param.load_lat_steps) {
 		if (user_param.report_per_port) {
 			printf(RESULT_LINE_PER_PORT);
 			printf((user_param.report_fmt == MBS ? RESULT_FMT_PER_PORT : RESULT_FMT_G_PER_PORT));
@@ -217,12 +248,34 @@ int main(int argc, char *argv[])
 			printf((user_param.report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
 		}
 
+		if (user_param.working_set)
+			printf(RESULT_EXT_WS);
+		if (user_param.num_sge_max > 1)
+			printf(RESULT_EXT_SGE);
+		if (user_param.is_sweep && user_param.machine == CLIENT)
+			printf(RESULT_EXT_SWEEP);
+		if (user_param.autotune && user_param.machine == CLIENT)
+			printf(RESULT_EXT_INLINE);
+		if (user_param.autotune == AUTOTUNE_P99 && user_param.machine == CLIENT)
+			printf(RESULT_EXT_P99);
+		if (user_param.adaptive && user_param.machine == CLIENT)
+			printf(RESULT_EXT_CI);
+		if (user_param.warmup_tol > 0 && (user_param.machine == CLIENT || user_param.duplex))
+			printf(RESULT_EXT_WARMUP);
 		printf((user_param.cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
 	}
 
 	/* For half duplex tests, server just waits for client to exit */
 	if (user_param.machine == SERVER && !user_param.duplex) {
 
+		/* Follow the client through its trials. */
+		do {
+			ret_parser = ctx_repeat_next(&user_comm,&user_param);
+		} while (ret_parser > 0);
+
+		if (ret_parser < 0)
+			return FAILURE;
+
 		if (ctx_hand_shake(&user_comm,&my_dest[0],&rem_dest[0])) {
 			fprintf(stderr," Failed to exchange data between server and clients\n");
 			return FAILURE;
@@ -243,6 +296,11 @@ int main(int argc, char *argv[])
 				printf(RESULT_LINE);
 		}
 
+		if (results_finish(&user_param)) {
+			fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+			return 1;
+		}
+
 		if (user_param.work_rdma_cm == ON) {
 			if (destroy_ctx(&ctx,&user_param)) {
 				fprintf(stderr, "Failed to destroy resources\n");
@@ -274,7 +332,7 @@ int main(int argc, char *argv[])
 				}
 			}
 
-			if(run_iter_bw(&ctx,&user_param)) {
+			if (user_param.adaptive ? run_iter_bw_adaptive(&ctx,&user_param,rem_dest) : run_iter_bw(&ctx,&user_param)) {
 				fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
 				return 1;
 			}
@@ -294,6 +352,55 @@ int main(int argc, char *argv[])
 			}
 		}
 
+	} else if (user_param.test_method == RUN_REGULAR && user_param.load_lat_steps) {
+
+		if (run_load_lat_bw(&ctx,&user_param,rem_dest)) {
+			fprintf(stderr," Failed to complete the load-latency curve\n");
+			return 1;
+		}
+
+	} else if (user_param.test_method == RUN_REGULAR && user_param.is_sweep) {
+
+		if (user_param.autotune ? run_autotune_bw(&ctx,&user_param,rem_dest,&my_bw_rep) :
+				run_sweep_bw(&ctx,&user_param,rem_dest,&my_bw_rep)) {
+			fprintf(stderr," Failed to complete the sweep\n");
+			return 1;
+		}
+
+	} else if (user_param.test_method == RUN_REGULAR && user_param.repeat > 1) {
+
+		do {
+			ctx_set_send_wqes(&ctx,&user_param,rem_dest);
+
+			if(perform_warm_up(&ctx,&user_param)) {
+				fprintf(stderr,"Problems with warm up\n");
+				return 1;
+			}
+
+			if (user_param.adaptive ? run_iter_bw_adaptive(&ctx,&user_param,rem_dest) : run_iter_bw(&ctx,&user_param)) {
+				fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
+				return 1;
+			}
+
+			print_report_bw(&user_param,&my_bw_rep);
+
+			ret_parser = ctx_repeat_next(&user_comm,&user_param);
+		} while (ret_parser > 0);
+
+		if (ret_parser < 0)
+			return FAILURE;
+
+		if (user_param.output == FULL_VERBOSITY)
+			print_repeat_stats(&user_param);
+
+	} else if (user_param.test_method == RUN_REGULAR &&
+			(user_param.working_set_max || user_param.num_sge_max > user_param.num_sge)) {
+
+		if (run_buffer_sweep_bw(&ctx,&user_param,rem_dest,&my_bw_rep)) {
+			fprintf(stderr," Failed to complete run_buffer_sweep_bw function successfully\n");
+			return 1;
+		}
+
 	} else if (user_param.test_method == RUN_REGULAR) {
 
 		ctx_set_send_wqes(&ctx,&user_param,rem_dest);
@@ -312,7 +419,7 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		if(run_iter_bw(&ctx,&user_param)) {
+		if (user_param.adaptive ? run_iter_bw_adaptive(&ctx,&user_param,rem_dest) : run_iter_bw(&ctx,&user_param)) {
 			fprintf(stderr," Failed to complete run_iter_bw function successfully\n");
 			return 1;
 		}
@@ -383,6 +490,11 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (results_finish(&user_param)) {
+		fprintf(stderr,"Error: results regressed against the baseline, or it could not be compared\n");
+		return 1;
+	}
+
 	free(my_dest);
 	free(rem_dest);
 